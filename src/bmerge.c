@@ -26,33 +26,53 @@ Differences over standard binary search (e.g. bsearch in stdlib.h) :
 #define GE 4
 #define GT 5
 
-static SEXP i, x, nqgrp;
-static int ncol, *icols, *xcols, *o, *xo, *retFirst, *retLength, *retIndex, *allLen1, *allGrp1, *rollends, ilen, anslen;
-static int *op, nqmaxgrp, *tmpptr, scols;
-static int ctr, nomatch; // populating matches for non-equi joins
-enum {ALL, FIRST, LAST} mult = ALL;
-static double roll, rollabs;
-static Rboolean rollToNearest=FALSE;
-#define XIND(i) (xo ? xo[(i)]-1 : i)
+// Joins are done in parallel by splitting the (sorted) rows of i into one contiguous range per thread. Each
+// range is merged by bmerge_r as the whole of i used to be, starting from all of x, so its first bisection
+// finds its own bounds in x. The state of the join is in a bmctx : bmerge() fills in the part shared by all
+// threads and each thread works on its own copy. A row of i is written to retFirst/retLength only by the
+// thread whose range holds it. Non-equi joins with mult="all" append the second and later matches of a
+// row to a buffer of that thread, and the buffers are concatenated in range order at the end.
+enum bmmult {ALL, FIRST, LAST};
+typedef struct {
+    SEXP i, x, nqgrp;
+    int ncol, *icols, *xcols, *isi64, *o, *xo, *op, *rollends, nqmaxgrp, nomatch;
+    enum bmmult mult;
+    double roll, rollabs;
+    Rboolean rollToNearest;
+    SEXP *ic, *xc;  // the join columns, for bmerge_merge
+    int **irank, **xrank;  // character join columns ranked by strrank, NULL for columns not ranked
+    int *retFirst, *retLength, *retIndex;
+    // per thread
+    int *exFirst, *exLength, *exIndex, exn, exalloc;
+    Rboolean allLen1, allGrp1, oom, interr;
+} bmctx;
 
-void bmerge_r(int xlow, int xupp, int ilow, int iupp, int col, int thisgrp, int lowmax, int uppmax);
+#define XIND(i) (c->xo ? c->xo[(i)]-1 : i)
+#define BMERGE_MINROWS 1024  // rows of i per thread, at least (counting each row once per nested group)
+#define BMERGE_MERGERATIO 8  // an equi join merges when x has at most this many rows per row of i
+#define BMERGE_RANKRATIO 8   // character join columns are ranked up front when x has at most this many rows per row of i
+
+static void bmerge_r(bmctx *c, int xlow, int xupp, int ilow, int iupp, int col, int thisgrp, int lowmax, int uppmax);
+static void bmerge_merge(bmctx *c, int from, int to, int xN);
+static void strrank(SEXP xs, SEXP is, int *xr, int *ir, SEXP *u);
 
 SEXP bmerge(SEXP iArg, SEXP xArg, SEXP icolsArg, SEXP xcolsArg, SEXP isorted, SEXP xoArg, SEXP rollarg, SEXP rollendsArg, SEXP nomatchArg, SEXP multArg, SEXP opArg, SEXP nqgrpArg, SEXP nqmaxgrpArg) {
     int xN, iN, protecti=0;
-    ctr=0; // needed for non-equi join case
     SEXP retFirstArg, retLengthArg, retIndexArg, allLen1Arg, allGrp1Arg;
     retFirstArg = retLengthArg = retIndexArg = R_NilValue; // suppress gcc msg
+    bmctx shared;
+    memset(&shared, 0, sizeof(bmctx));
 
     // iArg, xArg, icolsArg and xcolsArg
-    i = iArg; x = xArg;  // set globals so bmerge_r can see them.
+    SEXP i = shared.i = iArg, x = shared.x = xArg;
     if (!isInteger(icolsArg)) error("Internal error: icols is not integer vector");
     if (!isInteger(xcolsArg)) error("Internal error: xcols is not integer vector");
     if (LENGTH(icolsArg) > LENGTH(xcolsArg)) error("Internal error: length(icols) [%d] > length(xcols) [%d]", LENGTH(icolsArg), LENGTH(xcolsArg)); 
-    icols = INTEGER(icolsArg);
-    xcols = INTEGER(xcolsArg);
+    int *icols = shared.icols = INTEGER(icolsArg);
+    int *xcols = shared.xcols = INTEGER(xcolsArg);
     xN = LENGTH(VECTOR_ELT(x,0));
-    iN = ilen = anslen = LENGTH(VECTOR_ELT(i,0));
-    ncol = LENGTH(icolsArg);    // there may be more sorted columns in x than involved in the join
+    iN = LENGTH(VECTOR_ELT(i,0));
+    int ncol = shared.ncol = LENGTH(icolsArg);    // there may be more sorted columns in x than involved in the join
     for(int col=0; col<ncol; col++) {
         if (icols[col]==NA_INTEGER) error("Internal error. icols[%d] is NA", col);
         if (xcols[col]==NA_INTEGER) error("Internal error. xcols[%d] is NA", col);
@@ -61,11 +81,13 @@ SEXP bmerge(SEXP iArg, SEXP xArg, SEXP icolsArg, SEXP xcolsArg, SEXP isorted, SE
         int it = TYPEOF(VECTOR_ELT(i, icols[col]-1));
         int xt = TYPEOF(VECTOR_ELT(x, xcols[col]-1));
         if (it != xt) error("typeof x.%s (%s) != typeof i.%s (%s)", CHAR(STRING_ELT(getAttrib(x,R_NamesSymbol),xcols[col]-1)), type2char(xt), CHAR(STRING_ELT(getAttrib(i,R_NamesSymbol),icols[col]-1)), type2char(it));
+        if (xt != LGLSXP && xt != INTSXP && xt != STRSXP && xt != REALSXP) error("Type '%s' not supported as key column", type2char(xt));
     }
     // raise(SIGINT);
 
     // rollArg, rollendsArg
-    roll = 0.0; rollToNearest = FALSE;
+    double roll = 0.0;
+    Rboolean rollToNearest = FALSE;
     if (isString(rollarg)) {
         if (strcmp(CHAR(STRING_ELT(rollarg,0)),"nearest") != 0) error("roll is character but not 'nearest'");
         roll=1.0; rollToNearest=TRUE;       // the 1.0 here is just any non-0.0, so roll!=0.0 can be used later
@@ -73,55 +95,88 @@ SEXP bmerge(SEXP iArg, SEXP xArg, SEXP icolsArg, SEXP xcolsArg, SEXP isorted, SE
         if (!isReal(rollarg)) error("Internal error: roll is not character or double");
         roll = REAL(rollarg)[0];   // more common case (rolling forwards or backwards) or no roll when 0.0
     }
-    rollabs = fabs(roll);
+    shared.roll = roll;
+    shared.rollToNearest = rollToNearest;
+    shared.rollabs = fabs(roll);
     if (!isLogical(rollendsArg) || LENGTH(rollendsArg) != 2)
         error("rollends must be a length 2 logical vector");
-    rollends = LOGICAL(rollendsArg);
+    shared.rollends = LOGICAL(rollendsArg);
     if (rollToNearest && TYPEOF(VECTOR_ELT(i, icols[ncol-1]-1))==STRSXP)
         error("roll='nearest' can't be applied to a character column, yet.");
 
     // nomatch arg
-    nomatch = INTEGER(nomatchArg)[0];
+    int nomatch = shared.nomatch = INTEGER(nomatchArg)[0];
 
     // mult arg
+    enum bmmult mult;
     if (!strcmp(CHAR(STRING_ELT(multArg, 0)), "all")) mult = ALL;
     else if (!strcmp(CHAR(STRING_ELT(multArg, 0)), "first")) mult = FIRST;
     else if (!strcmp(CHAR(STRING_ELT(multArg, 0)), "last")) mult = LAST;
     else error("Internal error: invalid value for 'mult'. Please report to datatable-help");
+    shared.mult = mult;
 
     // opArg
     if (!isInteger(opArg) || length(opArg) != ncol)
         error("Internal error: opArg is not an integer vector of length equal to length(on)");
-    op = INTEGER(opArg);
+    shared.op = INTEGER(opArg);
+    // checked here rather than in bmerge_r, which may run in parallel and so can't error()
+    Rboolean anystr = FALSE, alleq = TRUE;
+    shared.isi64 = (int *)R_alloc(ncol, sizeof(int));
+    shared.ic = (SEXP *)R_alloc(ncol, sizeof(SEXP));
+    shared.xc = (SEXP *)R_alloc(ncol, sizeof(SEXP));
+    for (int col=0; col<ncol; col++) {
+        SEXP xc = shared.xc[col] = VECTOR_ELT(x, xcols[col]-1);
+        shared.ic[col] = VECTOR_ELT(i, icols[col]-1);
+        alleq &= shared.op[col] == EQ;
+        shared.isi64[col] = TYPEOF(xc)==REALSXP && INHERITS(xc, char_integer64);
+        if (TYPEOF(xc)==STRSXP) {
+            if (shared.op[col] != EQ) error("Only '==' operator is supported for columns of type %s.", type2char(TYPEOF(xc)));
+            anystr = TRUE;
+        }
+    }
+    // Character columns are otherwise compared with ENC2UTF8 and StrCmp at each step of the search. When i is large
+    // enough to pay for it, the strings of each one are ranked once here instead and the search compares the ranks.
+    shared.irank = (int **)R_alloc(ncol, sizeof(int *));
+    shared.xrank = (int **)R_alloc(ncol, sizeof(int *));
+    Rboolean ranked = anystr && iN && xN/iN <= BMERGE_RANKRATIO;
+    for (int col=0; col<ncol; col++) {
+        shared.irank[col] = shared.xrank[col] = NULL;
+        if (!ranked || TYPEOF(shared.xc[col]) != STRSXP) continue;
+        SEXP xs = PROTECT(ENC2UTF8vec(shared.xc[col])), is = PROTECT(ENC2UTF8vec(shared.ic[col])); protecti += 2;
+        shared.xrank[col] = (int *)R_alloc(xN, sizeof(int));
+        shared.irank[col] = (int *)R_alloc(iN, sizeof(int));
+        strrank(xs, is, shared.xrank[col], shared.irank[col], (SEXP *)R_alloc((size_t)xN+iN, sizeof(SEXP)));
+    }
     if (!isInteger(nqgrpArg))
         error("Internal error: nqgrpArg must be an integer vector");
-    nqgrp = nqgrpArg; // set global for bmerge_r
-    scols = (!length(nqgrpArg)) ? 0 : -1; // starting col index, -1 is external group column for non-equi join case
+    shared.nqgrp = nqgrpArg;
+    int scols = (!length(nqgrpArg)) ? 0 : -1; // starting col index, -1 is external group column for non-equi join case
 
     // nqmaxgrpArg
     if (!isInteger(nqmaxgrpArg) || length(nqmaxgrpArg) != 1 || INTEGER(nqmaxgrpArg)[0] <= 0)
         error("Intrnal error: nqmaxgrpArg is not a positive length-1 integer vector");
-    nqmaxgrp = INTEGER(nqmaxgrpArg)[0];
+    int nqmaxgrp = shared.nqmaxgrp = INTEGER(nqmaxgrpArg)[0];
+    int *retFirst, *retLength, *retIndex;
     if (nqmaxgrp>1 && mult == ALL) {
-        // non-equi case with mult=ALL, may need reallocation
-        anslen = 1.1 * ((iN > 1000) ? iN : 1000);
-        retFirst = Calloc(anslen, int); // anslen is set above
-        retLength = Calloc(anslen, int);
-        retIndex = Calloc(anslen, int);
-        if (retFirst==NULL || retLength==NULL || retIndex==NULL)
-            error("Internal error in allocating memory for non-equi join");
+        // non-equi case with mult=ALL : the first match of each row of i, the others go to the buffers of the threads
+        retFirst = (int *)R_alloc(iN, sizeof(int));
+        retLength = (int *)R_alloc(iN, sizeof(int));
+        retIndex = (int *)R_alloc(iN, sizeof(int));
         // initialise retIndex here directly, as next loop is meant for both equi and non-equi joins
-        for (int j=0; j<anslen; j++) retIndex[j] = j+1;
+        for (int j=0; j<iN; j++) retIndex[j] = j+1;
     } else { // equi joins (or) non-equi join but no multiple matches
-        retFirstArg = PROTECT(allocVector(INTSXP, anslen));
+        retFirstArg = PROTECT(allocVector(INTSXP, iN));
         retFirst = INTEGER(retFirstArg);
-        retLengthArg = PROTECT(allocVector(INTSXP, anslen)); // TODO: no need to allocate length at all when
+        retLengthArg = PROTECT(allocVector(INTSXP, iN)); // TODO: no need to allocate length at all when
         retLength = INTEGER(retLengthArg);                   // mult = "first" / "last"
         retIndexArg = PROTECT(allocVector(INTSXP, 0));
         retIndex = INTEGER(retIndexArg);
         protecti += 3;
     }
-    for (int j=0; j<anslen; j++) {
+    shared.retFirst = retFirst;
+    shared.retLength = retLength;
+    shared.retIndex = retIndex;
+    for (int j=0; j<iN; j++) {
         // defaults need to populated here as bmerge_r may well not touch many locations, say if the last row of i is before the first row of x.
         retFirst[j] = nomatch;   // default to no match for NA goto below
         // retLength[j] = 0;   // TO DO: do this to save the branch below and later branches at R level to set .N to 0
@@ -130,17 +185,15 @@ SEXP bmerge(SEXP iArg, SEXP xArg, SEXP icolsArg, SEXP xcolsArg, SEXP isorted, SE
 
     // allLen1Arg
     allLen1Arg = PROTECT(allocVector(LGLSXP, 1));
-    allLen1 = LOGICAL(allLen1Arg);
-    allLen1[0] = TRUE;  // All-0 and All-NA are considered all length 1 according to R code currently. Really, it means any(length>1).
+    shared.allLen1 = TRUE;  // All-0 and All-NA are considered all length 1 according to R code currently. Really, it means any(length>1).
 
     // allGrp1Arg, if TRUE, out of all nested group ids, only one of them matches 'x'. Might be rare, but helps to be more efficient in that case.
     allGrp1Arg = PROTECT(allocVector(LGLSXP, 1));
-    allGrp1 = LOGICAL(allGrp1Arg);
-    allGrp1[0] = TRUE;
+    shared.allGrp1 = TRUE;
     protecti += 2;
 
     // isorted arg
-    o = NULL;
+    int *o = NULL;
     if (!LOGICAL(isorted)[0]) {
         SEXP order = PROTECT(int_vec_init(length(icolsArg), 1)); // rep(1L, length(icolsArg))
         SEXP oSxp = PROTECT(forder(i, icolsArg, PROTECT(ScalarLogical(FALSE)),
@@ -149,32 +202,71 @@ SEXP bmerge(SEXP iArg, SEXP xArg, SEXP icolsArg, SEXP xcolsArg, SEXP isorted, SE
         protecti += 2;   // order and oSxp
         if (!LENGTH(oSxp)) o = NULL; else o = INTEGER(oSxp);
     }
+    shared.o = o;
 
     // xo arg
-    xo = NULL;
+    shared.xo = NULL;
     if (length(xoArg)) {
         if (!isInteger(xoArg)) error("Internal error: xoArg is not an integer vector");
-        xo = INTEGER(xoArg);
+        shared.xo = INTEGER(xoArg);
     }
 
-    // start bmerge
-    if (iN) {
-        // embarassingly parallel if we've storage space for nqmaxgrp*iN
-        for (int kk=0; kk<nqmaxgrp; kk++) {
-            bmerge_r(-1,xN,-1,iN,scols,kk+1,1,1);
+    // An equi join of an i comparable in size to x walks both together (bmerge_merge), rather than searching x from
+    // scratch for each group of i. A roll join always does : bmerge_r would search both sides of each row of i not in
+    // x, whereas the sweep has the neighbours at hand. Non-equi joins always go through bmerge_r.
+    Rboolean merge = alleq && nqmaxgrp == 1 && iN && (roll != 0.0 || xN/iN <= BMERGE_MERGERATIO);
+
+    // start bmerge : one contiguous range of the rows of i for each thread, each doing all the nested groups of its range.
+    // A non-equi join searches x once per nested group for each row of i, so a small i may still be worth splitting.
+    int nth = getDTthreads();
+    long long work = (long long)iN * nqmaxgrp;
+    if (nth > work/BMERGE_MINROWS) nth = work/BMERGE_MINROWS;
+    if (nth > iN) nth = iN;
+    if (nth < 1 || (anystr && !ranked)) nth = 1;  // ENC2UTF8 and StrCmp may call translateCharUTF8, which isn't thread safe
+    bmctx *ctx = (bmctx *)R_alloc(nth, sizeof(bmctx));
+    #pragma omp parallel for num_threads(nth) schedule(static)
+    for (int t=0; t<nth; t++) {
+        bmctx *c = ctx+t;
+        *c = shared;
+        int from = (int)((long long)iN*t/nth), to = (int)((long long)iN*(t+1)/nth);
+        if (from == to) continue;
+        if (merge) { bmerge_merge(c, from, to, xN); continue; }
+        for (int kk=0; kk<nqmaxgrp && !c->oom && !c->interr; kk++) {
+            bmerge_r(c, -1, xN, from-1, to, scols, kk+1, 1, 1);
         }
     }
-    ctr += iN;
-    if (nqmaxgrp > 1 && mult == ALL) {
+    int ctr = iN;
+    Rboolean oom = FALSE, interr = FALSE;
+    for (int t=0; t<nth; t++) {
+        shared.allLen1 &= ctx[t].allLen1;
+        shared.allGrp1 &= ctx[t].allGrp1;
+        oom |= ctx[t].oom;
+        interr |= ctx[t].interr;
+        ctr += ctx[t].exn;
+    }
+    if (nqmaxgrp > 1 && mult == ALL && !oom && !interr) {
         // memcpy ret* to SEXP
         retFirstArg = PROTECT(allocVector(INTSXP, ctr));
         retLengthArg = PROTECT(allocVector(INTSXP, ctr));
         retIndexArg = PROTECT(allocVector(INTSXP, ctr));
         protecti += 3;
-        memcpy(INTEGER(retFirstArg), retFirst, sizeof(int)*ctr);
-        memcpy(INTEGER(retLengthArg), retLength, sizeof(int)*ctr);
-        memcpy(INTEGER(retIndexArg), retIndex, sizeof(int)*ctr);
+        memcpy(INTEGER(retFirstArg), retFirst, sizeof(int)*iN);
+        memcpy(INTEGER(retLengthArg), retLength, sizeof(int)*iN);
+        memcpy(INTEGER(retIndexArg), retIndex, sizeof(int)*iN);
+        for (int t=0, k=iN; t<nth; k+=ctx[t].exn, t++) {
+            if (!ctx[t].exn) continue;
+            memcpy(INTEGER(retFirstArg)+k, ctx[t].exFirst, sizeof(int)*ctx[t].exn);
+            memcpy(INTEGER(retLengthArg)+k, ctx[t].exLength, sizeof(int)*ctx[t].exn);
+            memcpy(INTEGER(retIndexArg)+k, ctx[t].exIndex, sizeof(int)*ctx[t].exn);
+        }
     }
+    for (int t=0; t<nth; t++) {
+        free(ctx[t].exFirst); free(ctx[t].exLength); free(ctx[t].exIndex);
+    }
+    if (oom) error("Error in reallocating memory in non-equi joins.\n");
+    if (interr) error("Internal error: xlow!=xupp-1 || xlow<xlowIn || xupp>xuppIn");
+    LOGICAL(allLen1Arg)[0] = shared.allLen1;
+    LOGICAL(allGrp1Arg)[0] = shared.allGrp1;
     SEXP ans = PROTECT(allocVector(VECSXP, 5)); protecti++;
     SEXP ansnames = PROTECT(allocVector(STRSXP, 5)); protecti++;
     SET_VECTOR_ELT(ans, 0, retFirstArg);
@@ -188,26 +280,10 @@ SEXP bmerge(SEXP iArg, SEXP xArg, SEXP icolsArg, SEXP xcolsArg, SEXP isorted, SE
     SET_STRING_ELT(ansnames, 3, mkChar("allLen1"));
     SET_STRING_ELT(ansnames, 4, mkChar("allGrp1"));
     setAttrib(ans, R_NamesSymbol, ansnames);
-    if (nqmaxgrp > 1 && mult == ALL) {
-        Free(retFirst);
-        Free(retLength);
-        Free(retIndex);
-    }
     UNPROTECT(protecti);
     return (ans);
 }
 
-static union {
-  int i;
-  double d;
-  unsigned long long ull;
-  long long ll;
-  SEXP s;
-} ival, xval;
-
-static int mid, tmplow, tmpupp;  // global to save them being added to recursive stack. Maybe optimizer would do this anyway.
-static SEXP ic, xc;
-
 // If we find a non-ASCII, non-NA, non-UTF8 encoding, we try to convert it to UTF8. That is, marked non-ascii/non-UTF8 encodings will always be checked in UTF8 locale. This seems to be the best fix I could think of to put the encoding issues to rest..
 // Since the if-statement will fail with the first condition check in "normal" ASCII cases, there shouldn't be huge penalty issues for default setup.
 // Fix for #66, #69, #469 and #1293
@@ -218,27 +294,273 @@ SEXP ENC2UTF8(SEXP s) {
     return (s);
 }
 
-void bmerge_r(int xlowIn, int xuppIn, int ilowIn, int iuppIn, int col, int thisgrp, int lowmax, int uppmax)
+// x itself when all its strings are ASCII, UTF-8 or NA, else a copy (unprotected) with ENC2UTF8 applied to each. Either
+// way equal strings are then the same CHARSXP, without a call to ENC2UTF8 per comparison.
+SEXP ENC2UTF8vec(SEXP x) {
+    R_xlen_t n = xlength(x), i = 0;
+    const SEXP *xp = (const SEXP *)DATAPTR(x);
+    while (i<n && (IS_ASCII(xp[i]) || IS_UTF8(xp[i]) || xp[i]==NA_STRING)) i++;
+    if (i==n) return x;
+    SEXP ans = PROTECT(allocVector(STRSXP, n));
+    for (R_xlen_t j=0; j<n; j++) SET_STRING_ELT(ans, j, j<i ? xp[j] : ENC2UTF8(xp[j]));
+    UNPROTECT(1);
+    return ans;
+}
+
+static int strrankcmp(const void *a, const void *b) {
+    return strcmp(CHAR(*(const SEXP *)a), CHAR(*(const SEXP *)b));
+}
+
+// Ranks the strings of a character join column of x and of i together, into xr and ir, in the order StrCmp sorts them :
+// NA first (NA_INTEGER) then by strcmp, equal strings with equal rank. xs and is are from ENC2UTF8vec. The distinct
+// strings are collected into u (at least length(xs)+length(is)) using their TRUELENGTH, as chmatch does, and sorted.
+static void strrank(SEXP xs, SEXP is, int *xr, int *ir, SEXP *u) {
+    SEXP v[2] = {xs, is};
+    int *r[2] = {xr, ir}, nu = 0;
+    savetl_init();
+    for (int k=0; k<2; k++) {
+        const SEXP *sp = (const SEXP *)DATAPTR(v[k]);
+        for (int j=0; j<LENGTH(v[k]); j++) {
+            SEXP s = sp[j];
+            if (s == NA_STRING || TRUELENGTH(s) < 0) continue;
+            if (TRUELENGTH(s) > 0) savetl(s);
+            SET_TRUELENGTH(s, -1);
+            u[nu++] = s;
+        }
+    }
+    qsort(u, nu, sizeof(SEXP), strrankcmp);
+    for (int k=0, rank=0; k<nu; k++) {
+        if (!k || strrankcmp(u+k-1, u+k)) rank++;
+        SET_TRUELENGTH(u[k], -rank);
+    }
+    for (int k=0; k<2; k++) {
+        const SEXP *sp = (const SEXP *)DATAPTR(v[k]);
+        for (int j=0; j<LENGTH(v[k]); j++) r[k][j] = sp[j] == NA_STRING ? NA_INTEGER : -TRUELENGTH(sp[j]);
+    }
+    for (int k=0; k<nu; k++) SET_TRUELENGTH(u[k], 0);
+    savetl_end();
+}
+
+// A join column for bmerge_merge, with its data pointers looked up once
+typedef struct { int type; Rboolean i64; const void *x, *i; } bmcol;
+
+// The join columns of one row of i, as bmerge_r compares them : twiddled for double and integer64, in UTF-8 for character
+typedef union { int i; unsigned long long ull; SEXP s; } bmkey;
+
+static void bmkeyof(const bmcol *cols, int ncol, int ir, bmkey *key) {
+    for (int col=0; col<ncol; col++) {
+        const bmcol *bc = cols+col;
+        switch (bc->type) {
+        case LGLSXP : case INTSXP : key[col].i = ((const int *)bc->i)[ir]; break;
+        case REALSXP : key[col].ull = (bc->i64 ? i64twiddle : dtwiddle)((void *)bc->i, ir, 1); break;
+        case STRSXP : key[col].s = ENC2UTF8(((const SEXP *)bc->i)[ir]); break;
+        }
+    }
+}
+
+// x row xr against the key of a row of i : <0, 0 or >0 as x sorts before, with or after it
+static int bmcmp(const bmcol *cols, int ncol, int xr, const bmkey *key) {
+    for (int col=0; col<ncol; col++) {
+        const bmcol *bc = cols+col;
+        switch (bc->type) {
+        case LGLSXP : case INTSXP : {
+            int a = ((const int *)bc->x)[xr];
+            if (a != key[col].i) return a < key[col].i ? -1 : 1;
+        } break;
+        case REALSXP : {
+            unsigned long long a = (bc->i64 ? i64twiddle : dtwiddle)((void *)bc->x, xr, 1);
+            if (a != key[col].ull) return a < key[col].ull ? -1 : 1;
+        } break;
+        case STRSXP : {
+            int a = StrCmp(ENC2UTF8(((const SEXP *)bc->x)[xr]), key[col].s);
+            if (a) return a;
+        } break;
+        }
+    }
+    return 0;
+}
+
+// Roll of row ir of i whose value in the last join column is not in x but falls between x positions xlow and xupp
+// (xupp == xlow+1, in the order of xo) in the group of x matching it on the other columns. hasprev and hasnext are
+// whether xlow and xupp are in that group. Sets retFirst and retLength of ir when it rolls to either. Shared by the
+// search (bmerge_r) and the sweep (bmerge_merge).
+static void bmerge_roll(bmctx *c, int ir, int xlow, int xupp, Rboolean hasprev, Rboolean hasnext) {
+    SEXP ic = c->ic[c->ncol-1], xc = c->xc[c->ncol-1];
+    const int *rollends = c->rollends;
+    const double roll = c->roll, rollabs = c->rollabs;
+    const Rboolean isInt64 = c->isi64[c->ncol-1];
+    int *retFirst = c->retFirst, *retLength = c->retLength;
+    union { double d; long long ll; } ival, xval;
+    if (c->rollToNearest) {   // value of roll ignored currently when nearest
+        if (hasprev && hasnext) {
+            if (  ( TYPEOF(ic)==REALSXP && REAL(ic)[ir]-REAL(xc)[XIND(xlow)] <= REAL(xc)[XIND(xupp)]-REAL(ic)[ir] )
+               || ( TYPEOF(ic)<=INTSXP && INTEGER(ic)[ir]-INTEGER(xc)[XIND(xlow)] <= INTEGER(xc)[XIND(xupp)]-INTEGER(ic)[ir] )) {
+                retFirst[ir] = xlow+1;
+                retLength[ir] = 1;
+            } else {
+                retFirst[ir] = xupp+1;
+                retLength[ir] = 1;
+            }
+        } else if (!hasnext && rollends[1]) {
+            retFirst[ir] = xlow+1;
+            retLength[ir] = 1;
+        } else if (!hasprev && rollends[0]) {
+            retFirst[ir] = xupp+1;
+            retLength[ir] = 1;
+        }
+    } else {
+        // Regular roll=TRUE|+ve|-ve
+        // Fixed issues: #1405, #1650, #1007
+        // TODO: incorporate the twiddle logic for roll as well instead of tolerance?  
+        if ( (   (roll>0.0 && hasprev && (hasnext || rollends[1]))
+              || (roll<0.0 && !hasnext && rollends[1]) )
+          && (   (TYPEOF(ic)==REALSXP &&
+                  (ival.d = REAL(ic)[ir], xval.d = REAL(xc)[XIND(xlow)], 1) &&
+                 (( !isInt64 &&
+                    (ival.d-xval.d-rollabs < 1e-6 || 
+                     ival.d-xval.d == rollabs /*#1007*/))
+               || ( isInt64 &&
+                    (double)(ival.ll-xval.ll)-rollabs < 1e-6 ) ))  // cast to double for when rollabs==Inf
+              || (TYPEOF(ic)<=INTSXP && (double)(INTEGER(ic)[ir]-INTEGER(xc)[XIND(xlow)])-rollabs < 1e-6 )
+              || (TYPEOF(ic)==STRSXP)   )) {
+            retFirst[ir] = xlow+1;
+            retLength[ir] = 1;
+        } else if
+           (  (  (roll<0.0 && hasnext && (hasprev || rollends[0]))
+              || (roll>0.0 && !hasprev && rollends[0]) )
+          && (   (TYPEOF(ic)==REALSXP &&
+                  (ival.d = REAL(ic)[ir], xval.d = REAL(xc)[XIND(xupp)], 1) &&
+                 (( !isInt64 &&
+                    (xval.d-ival.d-rollabs < 1e-6 || 
+                     xval.d-ival.d == rollabs /*#1007*/))
+               || ( isInt64 &&
+                    (double)(xval.ll-ival.ll)-rollabs < 1e-6 ) ))
+              || (TYPEOF(ic)<=INTSXP && (double)(INTEGER(xc)[XIND(xupp)]-INTEGER(ic)[ir])-rollabs < 1e-6 )
+              || (TYPEOF(ic)==STRSXP)   )) {
+            retFirst[ir] = xupp+1;   // == xlow+2
+            retLength[ir] = 1;
+        }
+    }
+}
+
+// Two keys equal on their first n columns
+static Rboolean bmkeyeq(const bmcol *cols, int n, const bmkey *a, const bmkey *b) {
+    for (int col=0; col<n; col++) {
+        switch (cols[col].type) {
+        case LGLSXP : case INTSXP : if (a[col].i != b[col].i) return FALSE; break;
+        case REALSXP : if (a[col].ull != b[col].ull) return FALSE; break;
+        case STRSXP : if (a[col].s != b[col].s) return FALSE; break;  // both in UTF-8 so the same string is the same CHARSXP
+        }
+    }
+    return TRUE;
+}
+
+// The first x position in [from, to) that sorts at or after key on the n columns cols (after key when upper), else to.
+// Gallops forwards from 'from' (exponential then binary search), so it costs O(log(distance)) comparisons.
+static int bmgallop(const bmctx *c, const bmcol *cols, int n, const bmkey *key, int from, int to, Rboolean upper) {
+    int lo = from-1, hi = from, step = 1, past = upper ? 1 : 0;  // Rboolean may be unsigned
+    while (hi < to && bmcmp(cols, n, XIND(hi), key) < past) { lo = hi; hi += step; step <<= 1; }
+    if (hi > to) hi = to;
+    while (lo < hi-1) {
+        int mid = lo + (hi-lo)/2;
+        if (bmcmp(cols, n, XIND(mid), key) < past) lo = mid; else hi = mid;
+    }
+    return hi;
+}
+
+// Equi join of the sorted rows [from, to) of i by a merge with x. Both are walked forwards, one group at a time : the
+// group is the x rows equal to the i row on all join columns but the last, and is found when the i rows move on to
+// a new one. Within it, the x rows of each i row are found on the last column alone by galloping from the end of the
+// previous i row's, so the whole range costs O(n log(|x|/n)) comparisons and reads x in order. A row of i not in x
+// is rolled (as-of join) to the row of its group just before or after it, which the sweep is at already. Sets the
+// same retFirst, retLength and allLen1 as bmerge_r does for an equi join.
+static void bmerge_merge(bmctx *c, int from, int to, int xN) {
+    const int *o = c->o, ncol = c->ncol, np = ncol-1;  // the group is on the np columns before the last
+    bmcol *cols = (bmcol *)malloc(ncol * sizeof(bmcol));
+    bmkey *key = (bmkey *)malloc(2 * ncol * sizeof(bmkey)), *gkey = key+ncol;  // gkey : the key of the current group
+    if (!cols || !key) { free(cols); free(key); c->oom = TRUE; return; }
+    for (int col=0; col<ncol; col++) {
+        cols[col] = c->xrank[col] ? (bmcol){INTSXP, FALSE, c->xrank[col], c->irank[col]}
+                                  : (bmcol){TYPEOF(c->xc[col]), c->isi64[col], DATAPTR(c->xc[col]), DATAPTR(c->ic[col])};
+    }
+    const bmcol *lc = cols+np;
+    const bmkey *lkey = key+np;
+    // [gs, ge) is the group, x[gs..xp) sorts before the current i row, [lb, ub) matched the previous one
+    int gs = 0, ge = 0, xp = 0, lb = 0, ub = 0, len = 0;
+    Rboolean ingrp = FALSE;
+    for (int j=from; j<to; j++) {
+        int ir = o ? o[j]-1 : j;
+        bmkeyof(cols, ncol, ir, key);
+        if (!ingrp || !bmkeyeq(cols, np, key, gkey)) {
+            // a later group than the previous one (all of x when joining on one column)
+            gs = np ? bmgallop(c, cols, np, key, ge, xN, FALSE) : 0;
+            ge = np ? bmgallop(c, cols, np, key, gs, xN, TRUE) : xN;
+            memcpy(gkey, key, np * sizeof(bmkey));
+            ingrp = TRUE;
+            xp = gs; len = 0;
+        } else if (len && bmcmp(lc, 1, XIND(lb), lkey) == 0) {
+            // the same key as the previous i row
+        } else len = 0;
+        if (!len) {
+            lb = xp = bmgallop(c, lc, 1, lkey, xp, ge, FALSE);
+            if (lb == ge || bmcmp(lc, 1, XIND(lb), lkey)) {
+                if (c->roll != 0.0 && gs < ge) bmerge_roll(c, ir, lb-1, lb, lb > gs, lb < ge);
+                continue;
+            }
+            if (c->mult == FIRST) {
+                len = 1;  // only the first match is needed, so no upper bound : the next i row gallops on from lb
+            } else {
+                ub = xp = bmgallop(c, lc, 1, lkey, lb+1, ge, TRUE);
+                len = ub-lb;
+            }
+        }
+        if (c->mult == ALL && len > 1) c->allLen1 = FALSE;
+        c->retFirst[ir] = c->mult != LAST ? lb+1 : ub;  // 1-based
+        c->retLength[ir] = c->mult == ALL ? len : 1;
+    }
+    free(cols); free(key);
+}
+
+static void bmerge_r(bmctx *c, int xlowIn, int xuppIn, int ilowIn, int iuppIn, int col, int thisgrp, int lowmax, int uppmax)
 // col is >0 and <=ncol-1 if this range of [xlow,xupp] and [ilow,iupp] match up to but not including that column
 // lowmax=1 if xlowIn is the lower bound of this group (needed for roll)
 // uppmax=1 if xuppIn is the upper bound of this group (needed for roll)
 // new: col starts with -1 for non-equi joins, which gathers rows from nested id group counter 'thisgrp'
+// Runs in parallel (see bmerge) so it doesn't error() or call R; anything it can't do is flagged in c.
 {
-    int xlow=xlowIn, xupp=xuppIn, ilow=ilowIn, iupp=iuppIn, j, k, ir, lir, tmp;
+    int xlow=xlowIn, xupp=xuppIn, ilow=ilowIn, iupp=iuppIn, j, k, ir, lir, tmp, mid, tmplow, tmpupp;
+    const int *o = c->o, *op = c->op, ncol = c->ncol, nomatch = c->nomatch;
+    const enum bmmult mult = c->mult;
+    const double roll = c->roll;
+    int *retFirst = c->retFirst, *retLength = c->retLength;
+    union {
+      int i;
+      double d;
+      unsigned long long ull;
+      long long ll;
+      SEXP s;
+    } ival, xval;
+    unsigned long long (*twiddle)(void *, int, int);  // not the global one in forder.c, which isn't thread safe
+    SEXP ic = R_NilValue, xc;
     Rboolean isInt64=FALSE;
     ir = lir = ilow + (iupp-ilow)/2;           // lir = logical i row.
     if (o) ir = o[lir]-1;                      // ir = the actual i row if i were ordered
     if (col>-1) {
-        ic = VECTOR_ELT(i,icols[col]-1);  // ic = i column
-        xc = VECTOR_ELT(x,xcols[col]-1);  // xc = x column
+        ic = VECTOR_ELT(c->i,c->icols[col]-1);  // ic = i column
+        xc = VECTOR_ELT(c->x,c->xcols[col]-1);  // xc = x column
     // it was checked in bmerge() that the types are equal
-    } else xc = nqgrp;
-    switch (TYPEOF(xc)) {
-    case LGLSXP : case INTSXP :   // including factors
-        ival.i = (col>-1) ? INTEGER(ic)[ir] : thisgrp;
+    } else xc = c->nqgrp;
+    // the values searched by the integer case : the column itself, or the ranks of a ranked character column
+    const int *ivi = NULL, *xvi = NULL;
+    int type = TYPEOF(xc);
+    if (col>-1 && c->xrank[col]) { type = INTSXP; ivi = c->irank[col]; xvi = c->xrank[col]; }
+    else if (type == LGLSXP || type == INTSXP) { xvi = INTEGER(xc); if (col>-1) ivi = INTEGER(ic); }
+    switch (type) {
+    case LGLSXP : case INTSXP :   // including factors and ranked character
+        ival.i = (col>-1) ? ivi[ir] : thisgrp;
         while(xlow < xupp-1) {
             mid = xlow + (xupp-xlow)/2;   // Same as (xlow+xupp)/2 but without risk of overflow
-            xval.i = INTEGER(xc)[XIND(mid)];
+            xval.i = xvi[XIND(mid)];
             if (xval.i<ival.i) {          // relies on NA_INTEGER == INT_MIN, tested in init.c
                 xlow=mid;
             } else if (xval.i>ival.i) {   // TO DO: is *(&xlow, &xupp)[0|1]=mid more efficient than branch?
@@ -251,12 +573,12 @@ void bmerge_r(int xlowIn, int xuppIn, int ilowIn, int iuppIn, int col, int thisg
                 tmpupp = mid;
                 while(tmplow<xupp-1) {
                     mid = tmplow + (xupp-tmplow)/2;
-                    xval.i = INTEGER(xc)[XIND(mid)];
+                    xval.i = xvi[XIND(mid)];
                     if (xval.i == ival.i) tmplow=mid; else xupp=mid;
                 }
                 while(xlow<tmpupp-1) {
                     mid = xlow + (tmpupp-xlow)/2;
-                    xval.i = INTEGER(xc)[XIND(mid)];
+                    xval.i = xvi[XIND(mid)];
                     if (xval.i == ival.i) tmpupp=mid; else xlow=mid;
                 }
                 // xlow and xupp now surround the group in xc, we only need this range for the next column
@@ -271,11 +593,11 @@ void bmerge_r(int xlowIn, int xuppIn, int ilowIn, int iuppIn, int col, int thisg
                 case GT : xlow = xupp - 1; if (ival.i != NA_INTEGER) xupp = xuppIn; break;
             }
             // for LE/LT cases, we need to ensure xlow excludes NA indices, != EQ is checked above already
-            if (op[col] <= 3 && xlow<xupp-1 && ival.i != NA_INTEGER && INTEGER(xc)[XIND(xlow+1)] == NA_INTEGER) {
+            if (op[col] <= 3 && xlow<xupp-1 && ival.i != NA_INTEGER && xvi[XIND(xlow+1)] == NA_INTEGER) {
                 tmplow = xlow; tmpupp = xupp;
                 while (tmplow < tmpupp-1) {
                     mid = tmplow + (tmpupp-tmplow)/2;
-                    xval.i = INTEGER(xc)[XIND(mid)];
+                    xval.i = xvi[XIND(mid)];
                     if (xval.i == NA_INTEGER) tmplow = mid; else tmpupp = mid;
                 }
                 xlow = tmplow; // tmplow is the index of last NA value
@@ -286,20 +608,20 @@ void bmerge_r(int xlowIn, int xuppIn, int ilowIn, int iuppIn, int col, int thisg
         if (col>-1) {
             while(tmplow<iupp-1) {   // TO DO: could double up from lir rather than halving from iupp
                 mid = tmplow + (iupp-tmplow)/2;
-                xval.i = INTEGER(ic)[ o ? o[mid]-1 : mid ];   // reuse xval to search in i
+                xval.i = ivi[ o ? o[mid]-1 : mid ];   // reuse xval to search in i
                 if (xval.i == ival.i) tmplow=mid; else iupp=mid;
                 // if we could guarantee ivals to be *always* sorted for all columns independently (= max(nestedid) = 1), then we can speed this up by 2x by adding checks for GE,GT,LE,LT separately.
             }
             while(ilow<tmpupp-1) {
                 mid = ilow + (tmpupp-ilow)/2;
-                xval.i = INTEGER(ic)[ o ? o[mid]-1 : mid ];
+                xval.i = ivi[ o ? o[mid]-1 : mid ];
                 if (xval.i == ival.i) tmpupp=mid; else ilow=mid;
             }
         }
         // ilow and iupp now surround the group in ic, too
         break;
     case STRSXP :
-        if (op[col] != EQ) error("Only '==' operator is supported for columns of type %s.", type2char(TYPEOF(xc)));
+        // op[col] == EQ, checked in bmerge()
         ival.s = ENC2UTF8(STRING_ELT(ic,ir));
         while(xlow < xupp-1) {
             mid = xlow + (xupp-xlow)/2;
@@ -339,7 +661,7 @@ void bmerge_r(int xlowIn, int xuppIn, int ilowIn, int iuppIn, int col, int thisg
         }
         break;
     case REALSXP :
-        isInt64 = INHERITS(xc, char_integer64);
+        isInt64 = c->isi64[col];
         twiddle = isInt64 ? &i64twiddle : &dtwiddle;
         ival.ull = twiddle(DATAPTR(ic), ir, 1);
         while(xlow < xupp-1) {
@@ -400,17 +722,16 @@ void bmerge_r(int xlowIn, int xuppIn, int ilowIn, int iuppIn, int col, int thisg
         }
         // ilow and iupp now surround the group in ic, too
         break;
-    default:
-        error("Type '%s' not supported as key column", type2char(TYPEOF(xc)));
+    // other types are rejected by bmerge()
     }
     if (xlow<xupp-1) { // if value found, low and upp surround it, unlike standard binary search where low falls on it
         if (col<ncol-1) {
-            bmerge_r(xlow, xupp, ilow, iupp, col+1, thisgrp, 1, 1);
+            bmerge_r(c, xlow, xupp, ilow, iupp, col+1, thisgrp, 1, 1);
             // final two 1's are lowmax and uppmax
         } else {
             int len = xupp-xlow-1;
-            if (mult==ALL && len>1) allLen1[0] = FALSE;
-            if (nqmaxgrp == 1) {
+            if (mult==ALL && len>1) c->allLen1 = FALSE;
+            if (c->nqmaxgrp == 1) {
                 for (j=ilow+1; j<iupp; j++) {   // usually iterates once only for j=ir
                     k = o ? o[j]-1 : j;
                     retFirst[k] = (mult != LAST) ? xlow+2 : xupp; // extra +1 for 1-based indexing at R level
@@ -424,23 +745,21 @@ void bmerge_r(int xlowIn, int xuppIn, int ilowIn, int iuppIn, int col, int thisg
                     if (retFirst[k] != nomatch) {
                         if (mult == ALL) {
                             // for this irow, we've matches on more than one group
-                            allGrp1[0] = FALSE;
-                            retFirst[ctr+ilen] = xlow+2;
-                            retLength[ctr+ilen] = len;
-                            retIndex[ctr+ilen] = k+1;
-                            ++ctr;
-                            if (ctr+ilen >= anslen) {
-                                anslen = 1.1*anslen;
-                                tmpptr = Realloc(retFirst, anslen, int);
-                                if (tmpptr != NULL) retFirst = tmpptr; 
-                                else error("Error in reallocating memory in non-equi joins.\n");
-                                tmpptr = Realloc(retLength, anslen, int);
-                                if (tmpptr != NULL) retLength = tmpptr; 
-                                else error("Error in reallocating memory in non-equi joins.\n");
-                                tmpptr = Realloc(retIndex, anslen, int);
-                                if (tmpptr != NULL) retIndex = tmpptr; 
-                                else error("Error in reallocating memory in non-equi joins.\n");
+                            c->allGrp1 = FALSE;
+                            if (c->exn == c->exalloc) {
+                                int newalloc = 1.1*c->exalloc + 1000, *tmpptr;
+                                tmpptr = realloc(c->exFirst, newalloc*sizeof(int));
+                                if (tmpptr != NULL) c->exFirst = tmpptr; else { c->oom = TRUE; return; }
+                                tmpptr = realloc(c->exLength, newalloc*sizeof(int));
+                                if (tmpptr != NULL) c->exLength = tmpptr; else { c->oom = TRUE; return; }
+                                tmpptr = realloc(c->exIndex, newalloc*sizeof(int));
+                                if (tmpptr != NULL) c->exIndex = tmpptr; else { c->oom = TRUE; return; }
+                                c->exalloc = newalloc;
                             }
+                            c->exFirst[c->exn] = xlow+2;
+                            c->exLength[c->exn] = len;
+                            c->exIndex[c->exn] = k+1;
+                            c->exn++;
                         } else if (mult == FIRST) {
                             retFirst[k] = (XIND(retFirst[k]-1) > XIND(xlow+1)) ? xlow+2 : retFirst[k];
                             retLength[k] = 1;
@@ -453,7 +772,7 @@ void bmerge_r(int xlowIn, int xuppIn, int ilowIn, int iuppIn, int col, int thisg
                         if (mult == ALL) {
                             retFirst[k] = xlow+2;
                             retLength[k] = len;
-                            retIndex[k] = k+1;
+                            c->retIndex[k] = k+1;
                             // no need to increment ctr of course
                         } else {
                             retFirst[k] = (mult == FIRST) ? xlow+2 : xupp;
@@ -465,57 +784,8 @@ void bmerge_r(int xlowIn, int xuppIn, int ilowIn, int iuppIn, int col, int thisg
         }
     } else if (roll!=0.0 && col==ncol-1) {
         // runs once per i row (not each search test), so not hugely time critical
-        if (xlow != xupp-1 || xlow<xlowIn || xupp>xuppIn) error("Internal error: xlow!=xupp-1 || xlow<xlowIn || xupp>xuppIn");
-        if (rollToNearest) {   // value of roll ignored currently when nearest
-            if ( (!lowmax || xlow>xlowIn) && (!uppmax || xupp<xuppIn) ) {
-                if (  ( TYPEOF(ic)==REALSXP && REAL(ic)[ir]-REAL(xc)[XIND(xlow)] <= REAL(xc)[XIND(xupp)]-REAL(ic)[ir] )
-                   || ( TYPEOF(ic)<=INTSXP && INTEGER(ic)[ir]-INTEGER(xc)[XIND(xlow)] <= INTEGER(xc)[XIND(xupp)]-INTEGER(ic)[ir] )) {
-                    retFirst[ir] = xlow+1;
-                    retLength[ir] = 1;
-                } else {
-                    retFirst[ir] = xupp+1;
-                    retLength[ir] = 1;
-                }
-            } else if (uppmax && xupp==xuppIn && rollends[1]) {
-                retFirst[ir] = xlow+1;
-                retLength[ir] = 1;
-            } else if (lowmax && xlow==xlowIn && rollends[0]) {
-                retFirst[ir] = xupp+1;
-                retLength[ir] = 1;
-            }
-        } else {
-            // Regular roll=TRUE|+ve|-ve
-            // Fixed issues: #1405, #1650, #1007
-            // TODO: incorporate the twiddle logic for roll as well instead of tolerance?  
-            if ( (   (roll>0.0 && (!lowmax || xlow>xlowIn) && (xupp<xuppIn || !uppmax || rollends[1]))
-                  || (roll<0.0 && xupp==xuppIn && uppmax && rollends[1]) )
-              && (   (TYPEOF(ic)==REALSXP &&
-                      (ival.d = REAL(ic)[ir], xval.d = REAL(xc)[XIND(xlow)], 1) &&
-                     (( !isInt64 &&
-                        (ival.d-xval.d-rollabs < 1e-6 || 
-                         ival.d-xval.d == rollabs /*#1007*/))
-                   || ( isInt64 &&
-                        (double)(ival.ll-xval.ll)-rollabs < 1e-6 ) ))  // cast to double for when rollabs==Inf
-                  || (TYPEOF(ic)<=INTSXP && (double)(INTEGER(ic)[ir]-INTEGER(xc)[XIND(xlow)])-rollabs < 1e-6 )
-                  || (TYPEOF(ic)==STRSXP)   )) {
-                retFirst[ir] = xlow+1;
-                retLength[ir] = 1;
-            } else if
-               (  (  (roll<0.0 && (!uppmax || xupp<xuppIn) && (xlow>xlowIn || !lowmax || rollends[0]))
-                  || (roll>0.0 && xlow==xlowIn && lowmax && rollends[0]) )
-              && (   (TYPEOF(ic)==REALSXP &&
-                      (ival.d = REAL(ic)[ir], xval.d = REAL(xc)[XIND(xupp)], 1) &&
-                     (( !isInt64 &&
-                        (xval.d-ival.d-rollabs < 1e-6 || 
-                         xval.d-ival.d == rollabs /*#1007*/))
-                   || ( isInt64 &&
-                        (double)(xval.ll-ival.ll)-rollabs < 1e-6 ) ))
-                  || (TYPEOF(ic)<=INTSXP && (double)(INTEGER(xc)[XIND(xupp)]-INTEGER(ic)[ir])-rollabs < 1e-6 )
-                  || (TYPEOF(ic)==STRSXP)   )) {
-                retFirst[ir] = xupp+1;   // == xlow+2
-                retLength[ir] = 1;
-            }
-        }
+        if (xlow != xupp-1 || xlow<xlowIn || xupp>xuppIn) { c->interr = TRUE; return; }
+        bmerge_roll(c, ir, xlow, xupp, !lowmax || xlow>xlowIn, !uppmax || xupp<xuppIn);
         if (iupp-ilow > 2 && retFirst[ir]!=NA_INTEGER) {
             // >=2 equal values in the last column being rolling to the same point.  
             for (j=ilow+1; j<iupp; j++) {
@@ -526,26 +796,26 @@ void bmerge_r(int xlowIn, int xuppIn, int ilowIn, int iuppIn, int col, int thisg
             }
         }
     }
-    switch (op[col]) {
+    if (col>-1) switch (op[col]) {   // at col -1 the range of i isn't split, so there's nothing to recurse into
     case EQ:
         if (ilow>ilowIn && (xlow>xlowIn || ((roll!=0.0 || op[col] != EQ) && col==ncol-1)))
-            bmerge_r(xlowIn, xlow+1, ilowIn, ilow+1, col, 1, lowmax, uppmax && xlow+1==xuppIn);
+            bmerge_r(c, xlowIn, xlow+1, ilowIn, ilow+1, col, 1, lowmax, uppmax && xlow+1==xuppIn);
         if (iupp<iuppIn && (xupp<xuppIn || ((roll!=0.0 || op[col] != EQ) && col==ncol-1)))
-            bmerge_r(xupp-1, xuppIn, iupp-1, iuppIn, col, 1, lowmax && xupp-1==xlowIn, uppmax);
+            bmerge_r(c, xupp-1, xuppIn, iupp-1, iuppIn, col, 1, lowmax && xupp-1==xlowIn, uppmax);
     break;
     case LE: case LT:
         // roll is not yet implemented
         if (ilow>ilowIn)
-            bmerge_r(xlowIn, xuppIn, ilowIn, ilow+1, col, 1, lowmax, uppmax && xlow+1==xuppIn);
+            bmerge_r(c, xlowIn, xuppIn, ilowIn, ilow+1, col, 1, lowmax, uppmax && xlow+1==xuppIn);
         if (iupp<iuppIn)
-            bmerge_r(xlowIn, xuppIn, iupp-1, iuppIn, col, 1, lowmax && xupp-1==xlowIn, uppmax);
+            bmerge_r(c, xlowIn, xuppIn, iupp-1, iuppIn, col, 1, lowmax && xupp-1==xlowIn, uppmax);
     break;
     case GE: case GT:
         // roll is not yet implemented
         if (ilow>ilowIn)
-            bmerge_r(xlowIn, xuppIn, ilowIn, ilow+1, col, 1, lowmax, uppmax && xlow+1==xuppIn);
+            bmerge_r(c, xlowIn, xuppIn, ilowIn, ilow+1, col, 1, lowmax, uppmax && xlow+1==xuppIn);
         if (iupp<iuppIn)
-            bmerge_r(xlowIn, xuppIn, iupp-1, iuppIn, col, 1, lowmax && xupp-1==xlowIn, uppmax);
+            bmerge_r(c, xlowIn, xuppIn, iupp-1, iuppIn, col, 1, lowmax && xupp-1==xlowIn, uppmax);
     break;
     }
 }
@@ -63,6 +63,8 @@ unsigned long long dtwiddle(void *p, int i, int order);
 unsigned long long i64twiddle(void *p, int i, int order);
 unsigned long long (*twiddle)(void *, int, int);
 SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP naArg);
+void forderStatsFsort(Rboolean sorted);
+SEXP getNumericRounding();
 
 // reorder.c
 SEXP reorder(SEXP x, SEXP order);
@@ -72,6 +74,7 @@ SEXP int_vec_init(R_len_t n, int val);
 
 // vecseq.c
 SEXP vecseq(SEXP x, SEXP len, SEXP clamp);
+SEXP notjoinrows(SEXP starts, SEXP lens, SEXP xo, SEXP nrowArg);
 
 // uniqlist.c
 SEXP uniqlist(SEXP l, SEXP order);
@@ -90,6 +93,7 @@ SEXP which(SEXP x, Rboolean bool);
 
 // frank.c
 SEXP dt_na(SEXP x, SEXP cols);
+SEXP frank(SEXP xorderArg, SEXP xstartArg, SEXP xlenArg, SEXP ties_method, SEXP grpArg);
 
 // assign.c
 SEXP alloccol(SEXP dt, R_len_t n, Rboolean verbose);
@@ -106,10 +110,28 @@ SEXP bmerge(SEXP iArg, SEXP xArg, SEXP icolsArg, SEXP xcolsArg, SEXP isorted,
                 SEXP xoArg, SEXP rollarg, SEXP rollendsArg, SEXP nomatchArg, 
                 SEXP multArg, SEXP opArg, SEXP nqgrpArg, SEXP nqmaxgrpArg);
 SEXP ENC2UTF8(SEXP s);
+SEXP ENC2UTF8vec(SEXP x);
 
 // rbindlist.c
 SEXP combineFactorLevels(SEXP factorLevels, int *factorType, Rboolean *isRowOrdered);
 
+// fastmean.c
+// summation modes for gsum, gmean and fastmean of double, getOption("datatable.summation")
+#define SUM_LONG   0   // long double accumulator, like base R (default)
+#define SUM_DOUBLE 1   // plain double, fastest
+#define SUM_KAHAN  2   // Neumaier compensated double
+#define SUM_EXACT  3   // exact, correctly rounded once at the end
+int sumMode(SEXP modeArg);
+#define XSUM_DIGITS 68 // 32 bit digits from 2^-1074 up : all doubles and 2^31 more for carries
+typedef struct {
+    long long d[XSUM_DIGITS];  // digit i is worth d[i]*2^(32*i-1074), see xsumAdd
+    int nadd;
+    Rboolean na, nan, posinf, neginf;
+} xsum;
+void xsumInit(xsum *a);
+void xsumAdd(xsum *a, double v);
+double xsumRound(xsum *a);
+
 // quickselect
 double dquickselect(double *x, int n, int k);
 double iquickselect(int *x, int n, int k);
@@ -26,12 +26,150 @@ tests run under R CMD check and run on all CRAN platforms daily to catch
 if we become out of line to base R (say if base R changed its mean).
 */
 
+/*
+Summation modes, getOption("datatable.summation"), for gsum, gmean and fastmean of double columns.
+The default "long" accumulates in long double as base R does. That is 80 bit on x86 but 128 bit
+(or just 64 bit) on other platforms, so the last bits of the answer depend on the platform, and it
+is slow where long double is done in software. The other modes only use double arithmetic so give
+the same answer everywhere :
+  "double"  plain double sums, the fastest.
+  "kahan"   Neumaier's variant of Kahan compensated summation; about as accurate as long double.
+  "exact"   the exact sum, rounded to the nearest double once at the end. The result doesn't depend
+            on the order of the values either, so e.g. not on the number of threads.
+The exact sum is a fixed point superaccumulator (as in Neal 2015, "Fast exact summation using small
+and large superaccumulators") of 32 bit digits in 64 bit integers. Each double adds its 53 bit
+mantissa to (at most) 3 adjacent digits, so there is room for 2^30 additions before the carries must
+be propagated.
+*/
+
+int sumMode(SEXP modeArg)
+{
+    if (isNull(modeArg)) return SUM_LONG;
+    if (!isString(modeArg) || LENGTH(modeArg)!=1 || STRING_ELT(modeArg, 0)==NA_STRING)
+        error("getOption('datatable.summation') must be a single string: 'long', 'double', 'kahan' or 'exact'");
+    const char *m = CHAR(STRING_ELT(modeArg, 0));
+    if (!strcmp(m, "long")) return SUM_LONG;
+    if (!strcmp(m, "double")) return SUM_DOUBLE;
+    if (!strcmp(m, "kahan")) return SUM_KAHAN;
+    if (!strcmp(m, "exact")) return SUM_EXACT;
+    error("getOption('datatable.summation') is '%s' but must be 'long', 'double', 'kahan' or 'exact'", m);
+    return SUM_LONG;  // # nocov
+}
+
+void xsumInit(xsum *a)
+{
+    memset(a, 0, sizeof(xsum));
+}
+
+// propagate the carries so that all digits but the top one are in [0, 2^32)
+static void xsumCarry(long long *d)
+{
+    for (int i=0; i<XSUM_DIGITS-1; i++) {
+        long long lo = d[i] & 0xffffffffLL;
+        d[i+1] += (d[i] - lo) / 4294967296LL;  // exact, and no reliance on >> of negatives
+        d[i] = lo;
+    }
+}
+
+void xsumAdd(xsum *a, double v)
+{
+    if (ISNAN(v)) { if (ISNA(v)) a->na = TRUE; else a->nan = TRUE; return; }
+    if (!R_FINITE(v)) { if (v>0) a->posinf = TRUE; else a->neginf = TRUE; return; }
+    unsigned long long u, m;
+    memcpy(&u, &v, 8);
+    int e = (int)((u >> 52) & 0x7ff), shift;
+    m = u & 0xfffffffffffffULL;
+    if (e) { m |= 1ULL << 52; shift = e-1; }  // |v| = m * 2^(e-1075) so m's lowest bit is bit e-1 from 2^-1074
+    else shift = 0;                           // subnormal : m * 2^-1074
+    if (!m) return;
+    int k = shift >> 5, off = shift & 31;
+    long long d0 = (long long)((m << off) & 0xffffffffULL);
+    long long d1 = (long long)((off ? m >> (32-off) : m >> 32) & 0xffffffffULL);
+    long long d2 = (long long)(off ? m >> (64-off) : 0);
+    if (u >> 63) { a->d[k] -= d0; a->d[k+1] -= d1; a->d[k+2] -= d2; }
+    else         { a->d[k] += d0; a->d[k+1] += d1; a->d[k+2] += d2; }
+    if (++a->nadd == 1<<30) { xsumCarry(a->d); a->nadd = 0; }
+}
+
+double xsumRound(xsum *a)
+{
+    if (a->na) return NA_REAL;
+    if (a->nan || (a->posinf && a->neginf)) return R_NaN;
+    if (a->posinf) return R_PosInf;
+    if (a->neginf) return R_NegInf;
+    long long d[XSUM_DIGITS];
+    memcpy(d, a->d, sizeof(d));
+    xsumCarry(d);
+    Rboolean neg = d[XSUM_DIGITS-1] < 0;
+    if (neg) {
+        for (int i=0; i<XSUM_DIGITS; i++) d[i] = -d[i];
+        xsumCarry(d);
+    }
+    int t = XSUM_DIGITS-1;
+    while (t>=0 && d[t]==0) t--;
+    if (t<0) return 0.0;
+    int hb = 63;
+    while (!((unsigned long long)d[t] >> hb)) hb--;
+    int top = 32*t + hb;                     // the highest bit set
+    int low = top-52 > 0 ? top-52 : 0;                                  // the lowest bit a double can hold
+    #define XBIT(b) ((d[(b)>>5] >> ((b)&31)) & 1)
+    unsigned long long m = 0;
+    for (int b=top; b>=low; b--) m = (m << 1) | XBIT(b);
+    if (low>0 && XBIT(low-1)) {  // round half to even
+        Rboolean sticky = FALSE;
+        int b = low-1;           // any bit below b
+        for (int i=0; i<(b>>5) && !sticky; i++) sticky = d[i]!=0;
+        if (b & 31) sticky |= (d[b>>5] & ((1LL << (b&31))-1)) != 0;
+        if (sticky || (m & 1)) m++;
+    }
+    #undef XBIT
+    double ans = ldexp((double)m, low-1074);
+    return neg ? -ans : ans;
+}
+
+// The sum of x-m for the non-NA x (all x when !narm) in the given mode, with their count in *n
+static double dsum(const double *x, R_len_t l, Rboolean narm, int mode, double m, R_len_t *n)
+{
+    double s = 0., c = 0.;
+    xsum xs;
+    if (mode==SUM_EXACT) xsumInit(&xs);
+    *n = 0;
+    for (R_len_t i=0; i<l; i++) {
+        if (narm && ISNAN(x[i])) continue;
+        double v = x[i] - m;
+        (*n)++;
+        switch(mode) {
+        case SUM_DOUBLE :
+            s += v;
+            break;
+        case SUM_KAHAN : {
+            double t = s + v;
+            c += fabs(s) >= fabs(v) ? (s - t) + v : (v - t) + s;
+            s = t;
+        } break;
+        default :
+            xsumAdd(&xs, v);
+        }
+    }
+    if (mode==SUM_EXACT) return xsumRound(&xs);
+    return R_FINITE(s) ? s + c : s;
+}
+
+// NA if x has any NA, else NaN if it has any NaN, else 0 : the mean of x when !narm and not 0
+static double nanmean(const double *x, R_len_t l)
+{
+    double ans = 0.;
+    for (R_len_t i=0; i<l; i++) if (ISNAN(x[i])) { if (R_IsNA(x[i])) return NA_REAL; ans = R_NaN; }
+    return ans;
+}
+
 SEXP fastmean(SEXP args)
 {
   	long double s = 0., t = 0.;
 	R_len_t i, l = 0, n = 0;
 	SEXP x, ans, tmp;
 	Rboolean narm=FALSE;
+	int mode = SUM_LONG;
 	x=CADR(args);
 	if (length(args)>2) {
 	    tmp = CADDR(args);
@@ -39,6 +177,7 @@ SEXP fastmean(SEXP args)
             error("narm should be TRUE or FALSE");
 	    narm=LOGICAL(tmp)[0];
 	}
+	if (length(args)>3) mode = sumMode(CADDDR(args));
 	PROTECT(ans = allocNAVector(REALSXP, 1));
 	if (!isInteger(x) && !isReal(x) && !isLogical(x)) {
         warning("argument is not numeric or logical: returning NA");
@@ -46,6 +185,36 @@ SEXP fastmean(SEXP args)
         return(ans);
     }
     l = LENGTH(x);
+    if (mode != SUM_LONG) {
+        // the same two passes as below but without long double. Integers are summed exactly in 64 bit.
+        if (TYPEOF(x) == REALSXP) {
+            const double *xd = REAL(x);
+            if (!narm && ISNAN(REAL(ans)[0] = nanmean(xd, l))) { UNPROTECT(1); return(ans); }
+            double m = dsum(xd, l, narm, mode, 0., &n);
+            if (n==0) m = R_NaN;
+            else {
+                m /= n;
+                // the second pass would round each x-m first, so it can only lose what "exact" already has
+                if (R_FINITE(m) && mode != SUM_EXACT) m += dsum(xd, l, narm, mode, m, &n)/n;
+            }
+            REAL(ans)[0] = m;
+        } else {
+            long long is = 0;
+            const int *xi = INTEGER(x);
+            for (i=0; i<l; i++) {
+                if (xi[i] == NA_INTEGER) {
+                    if (!narm) { UNPROTECT(1); return(ans); }
+                    continue;
+                }
+                is += xi[i];
+                n++;
+            }
+            REAL(ans)[0] = n ? (double)is/n : R_NaN;
+        }
+        copyMostAttrib(x, ans);
+        UNPROTECT(1);
+        return(ans);
+    }
 	if (narm) {
 	    switch(TYPEOF(x)) {
 	    case LGLSXP:
@@ -94,10 +263,8 @@ SEXP fastmean(SEXP args)
 		    REAL(ans)[0] = (double) (s/l);
 	        break;
 	    case REALSXP:
-	        for (i = 0; i<l; i++) {
-	            if(ISNAN(REAL(x)[i])) {UNPROTECT(1); return(ans);}
-	            s += REAL(x)[i];
-	        }
+	        if (ISNAN(REAL(ans)[0] = nanmean(REAL(x), l))) {UNPROTECT(1); return(ans);}
+	        for (i = 0; i<l; i++) s += REAL(x)[i];
 	        s /= l;
 	        if(R_FINITE((double)s)) {
 		        for (i = 0; i<l; i++) {
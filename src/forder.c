@@ -1,5 +1,5 @@
 #include "data.table.h"
-// #define TIMING_ON
+#include <time.h>
 
 /* 
     - Only forder() and *twiddle() functions are meant for use by other C code in data.table, hence all other functions here except forder and *twiddle are static.
@@ -69,19 +69,39 @@ static void gsfree() {
     gsmaxalloc = 0;
 }
 
-#ifdef TIMING_ON
-  // many calls to clock() can be expensive, hence compiled out rather than switch(verbose)
-  #include <time.h>
-  #define NBLOCK 20  
-  static clock_t tblock[NBLOCK], tstart;
-  static int nblock[NBLOCK];
-  #define TBEG() tstart = clock();
-  #define TEND(i) tblock[i] += clock()-tstart; nblock[i]++; tstart = clock();
-#else
-  #define TBEG()
-  #define TEND(i)
-#endif
-
+/* Instrumentation of the most recent call to forder, returned by forderStats() below. Always compiled in. The counters
+   are cheap so are always kept. Many calls to clock() can be expensive (once per group for the 2nd column onwards) so
+   the phase timings are only taken when switched on by forderStats(TRUE); otherwise TBEG/TEND are a single branch. */
+#define NBLOCK 7
+static const char *blockNames[NBLOCK] = {"firstColumn", "alloc", "gather", "isSorted", "reverse", "sort", "reorder"};
+static Rboolean timing = FALSE;
+static clock_t tblock[NBLOCK], tstart;
+static int nblock[NBLOCK];
+#define TBEG() if (timing) tstart = clock();
+#define TEND(i) if (timing) { tblock[i] += clock()-tstart; nblock[i]++; tstart = clock(); }
+#define NBUCKET 32
+static int stat_nradix, stat_nskip, stat_ninsert, stat_ncount;  // radix passes, radix bytes skipped, insert sorts, counting sorts
+static int stat_bucket[NBUCKET];                                  // radix bucket sizes in powers of 2: 1, 2-3, 4-7, ...
+static int stat_first, stat_prefix, stat_ngrp, stat_maxgrpn;     // [i|d|c]sorted on the first column, psort's prefix, groups
+static Rboolean stat_sorted, stat_fsort;                           // stat_fsort : the order came from fsort (fsort.c)
+static void statreset() {
+    memset(tblock, 0, NBLOCK*sizeof(clock_t));
+    memset(nblock, 0, NBLOCK*sizeof(int));
+    memset(stat_bucket, 0, NBUCKET*sizeof(int));
+    stat_nradix = stat_nskip = stat_ninsert = stat_ncount = stat_prefix = stat_ngrp = stat_maxgrpn = 0;
+    stat_first = 0; stat_sorted = stat_fsort = FALSE;
+}
+// fsort's parallel sort of a single column stands in for forder (see forderv), so it is the last call too
+void forderStatsFsort(Rboolean sorted) {
+    statreset();
+    stat_fsort = TRUE;
+    stat_first = stat_sorted = sorted;
+}
+static void statbucket(int n) {
+    int b = 0;
+    while (n >>= 1) b++;
+    stat_bucket[b]++;
+}
 
 /* 
    icount originally copied from do_radixsort in src/main/sort.c @ rev 51389. Then reworked here again in forder.c in v1.8.11
@@ -139,6 +159,7 @@ static void icount(int *x, int *o, int n)
     tiny. We'll only use the front part of it, as large as range. So it's 
     just reserving space, not using it. Have defined N_RANGE to be 100000.*/
     if (range > N_RANGE) Error("Internal error: range = %d; isorted can't handle range > %d", range, N_RANGE);
+    stat_ncount++;
     for(i=0; i<n; i++) {
         if (x[i] == NA_INTEGER) counts[napos]++;             // For nalast=NA case, we won't remove/skip NAs, rather set 'o' indices
         else counts[x[i]-xmin]++;                            // to 0. subset will skip them. We can't know how many NAs to skip 
@@ -196,6 +217,7 @@ static void iinsert(int *x, int *o, int n)
     for x[.]=NA is already taken care of */
 {
     int i, j, xtmp, otmp, tt;
+    stat_ninsert++;
     for (i=1; i<n; i++) {
         xtmp = x[i];
         if (xtmp < x[i-1]) {
@@ -294,6 +316,7 @@ static void iradix(int *x, int *o, int n)
         i = thisx >> (radix*8) & 0xFF;
         skip[radix] = radixcounts[radix][i] == n;
         if (skip[radix]) radixcounts[radix][i] = 0;                         // clear it now, the other counts must be 0 already
+        stat_nskip += skip[radix];
     }
     
     radix = 3;  // MSD
@@ -313,6 +336,7 @@ static void iradix(int *x, int *o, int n)
     }
     thiscounts = radixcounts[radix];
     shift = radix * 8;
+    stat_nradix++;
     
     itmp = thiscounts[0];
     maxgrpn = itmp;
@@ -348,6 +372,7 @@ static void iradix(int *x, int *o, int n)
     for (i=1; itmp<n && i<=256; i++) {
         if (thiscounts[i] == 0) continue;
         thisgrpn = thiscounts[i] - itmp;                                    // undo cumulate; i.e. diff
+        statbucket(thisgrpn);
         if (thisgrpn == 1 || nextradix==-1) {
             push(thisgrpn);
         } else {
@@ -380,6 +405,7 @@ static void iradix_r(int *xsub, int *osub, int n, int radix)
     
     shift = radix*8;
     thiscounts = radixcounts[radix];
+    stat_nradix++;
     
     for (i=0; i<n; i++) {
         thisx = (unsigned int)xsub[i] - INT_MIN;                                // sequential in xsub
@@ -408,6 +434,7 @@ static void iradix_r(int *xsub, int *osub, int n, int radix)
     for (i=1; itmp<n && i<=256; i++) {
         if (thiscounts[i] == 0) continue;
         thisgrpn = thiscounts[i] - itmp;  // undo cummulate; i.e. diff
+        statbucket(thisgrpn);
         if (thisgrpn == 1 || nextradix==-1) {
             push(thisgrpn);
         } else {
@@ -443,13 +470,17 @@ SEXP getNumericRounding()
     return ScalarInteger(dround);
 }
 
-static union {double d;
-              unsigned long long ull;} u;
+union dull {double d;
+            unsigned long long ull;};
+static union dull u;
             //  int i;
             //  unsigned int ui;} u;
 
+// The twiddles below use their own local u (not the static one above) so that bmerge can call them from several threads.
+
 unsigned long long dtwiddle(void *p, int i, int order)
 {
+    union dull u;
     u.d = order*((double *)p)[i];                               // take care of 'order' right at the beginning
     if (R_FINITE(u.d)) {
         u.ull = (u.d) ? u.ull + ((u.ull & dmask1) << 1) : 0;    // handle 0, -0 case. Fix for issues/743.
@@ -476,6 +507,7 @@ unsigned long long i64twiddle(void *p, int i, int order)
 // case (setkey) will not be affected much because nalast != 1 and order == 1 are 
 // defaults. 
 {
+    union dull u;
     u.d = ((double *)p)[i];
     u.ull ^= 0x8000000000000000;
     if (nalast != 1) {
@@ -494,11 +526,13 @@ unsigned long long i64twiddle(void *p, int i, int order)
 }
 
 Rboolean dnan(void *p, int i) {
+    union dull u;
     u.d = ((double *)p)[i];
     return (ISNAN(u.d));
 }
 
 Rboolean i64nan(void *p, int i) {
+    union dull u;
     u.d = ((double *)p)[i];
     return ((u.ull ^ 0x8000000000000000) == 0);
 }
@@ -547,6 +581,7 @@ static void dradix(unsigned char *x, int *o, int n)
         i = ((unsigned char *)&thisx)[RADIX_BYTE];                           // thisx is the last x after loop above
         skip[radix] = radixcounts[radix][i] == n;
         if (skip[radix]) radixcounts[radix][i] = 0;                     // clear it now, the other counts must be 0 already
+        stat_nskip += skip[radix];
     }
     radix = colSize-1;  // MSD
     while (radix>=0 && skip[radix]) radix--;
@@ -561,6 +596,7 @@ static void dradix(unsigned char *x, int *o, int n)
         if (!skip[i]) memset(radixcounts[i], 0, 257*sizeof(unsigned int));
     }
     thiscounts = radixcounts[radix];
+    stat_nradix++;
     itmp = thiscounts[0];
     maxgrpn = itmp;
     for (i=1; itmp<n && i<256; i++) {
@@ -595,6 +631,7 @@ static void dradix(unsigned char *x, int *o, int n)
     for (i=1; itmp<n && i<=256; i++) {
         if (thiscounts[i] == 0) continue;
         thisgrpn = thiscounts[i] - itmp;  // undo cummulate; i.e. diff
+        statbucket(thisgrpn);
         if (thisgrpn == 1 || nextradix==-1) {
             push(thisgrpn);
         } else {
@@ -621,6 +658,7 @@ static void dinsert(unsigned long long *x, int *o, int n)
 {
     int i, j, otmp, tt;
     unsigned long long xtmp;
+    stat_ninsert++;
     for (i=1; i<n; i++) {
         xtmp = x[i];
         if (xtmp < x[i-1]) {
@@ -652,6 +690,7 @@ static void dradix_r(unsigned char *xsub, int *osub, int n, int radix)
         return;
     }
     thiscounts = radixcounts[radix];
+    stat_nradix++;
     p = xsub + RADIX_BYTE;
     for (i=0; i<n; i++) {
         thiscounts[*p]++;
@@ -690,6 +729,7 @@ static void dradix_r(unsigned char *xsub, int *osub, int n, int radix)
     for (i=1; itmp<n && i<=256; i++) {
         if (thiscounts[i] == 0) continue;
         thisgrpn = thiscounts[i] - itmp;  // undo cummulate; i.e. diff
+        statbucket(thisgrpn);
         if (thisgrpn == 1 || nextradix==-1) {
             push(thisgrpn);
         } else {
@@ -940,13 +980,17 @@ static void csort_pre(SEXP *x, int n)
 // We also return -1 if x is sorted in _strictly_ reverse order; a common case we optimize in forder.
 // If a vector is in decreasing order *with ties*, then an in-place reverse (no sort) would result in instability of ties (TO DO).
 // For use by forder only, which now returns NULL if already sorted (hence no need for separate is.sorted).
-// TO DO: test in big steps first to return faster if unsortedness is at the end (a common case of rbind'ing data to end)
+// When 0 is returned (unsorted), sortedPrefix is left as the length of the leading run that is in order, so forder can
+// take the psort path below when only a tail is out of order; a common case of rbind'ing data to the end of a keyed table.
 // These are all sequential access to x, so very quick and cache efficient.
 
+static int sortedPrefix = 0;                                // set by [i|d|c]sorted, used by psort
+
 static int isorted(int *x, int n)                           // order = 1 is ascending and order=-1 is descending
 {                                                           // also takes care of na.last argument with check through 'icheck'
                                                             // Relies on NA_INTEGER==INT_MIN, checked in init.c
     int i=1,j=0;
+    sortedPrefix = 0;
     if (nalast == 0) {                                      // when nalast = NA, 
         for (int k=0; k<n; k++) if (x[k] != NA_INTEGER) j++;
         if (j == 0) { push(n); return(-2); }                // all NAs ? return special value to replace all o's values with '0'
@@ -963,7 +1007,7 @@ static int isorted(int *x, int n)                           // order = 1 is asce
     int old = gsngrp[flip];
     int tt = 1;
     for (i=1; i<n; i++) {
-        if (icheck(x[i]) < icheck(x[i-1])) { gsngrp[flip] = old; return(0); }
+        if (icheck(x[i]) < icheck(x[i-1])) { gsngrp[flip] = old; sortedPrefix = i; return(0); }
         if (x[i]==x[i-1]) tt++; else { push(tt); tt=1; }
     }
     push(tt);
@@ -974,6 +1018,7 @@ static int dsorted(double *x, int n)                        // order=1 is ascend
 {                                                           // also accounts for nalast=0 (=NA), =1 (TRUE), -1 (FALSE) (in twiddle)
     int i=1,j=0;
     unsigned long long prev, this;
+    sortedPrefix = 0;
     if (nalast == 0) {                                      // when nalast = NA, 
         for (int k=0; k<n; k++) if (!is_nan(x, k)) j++;
         if (j == 0) { push(n); return(-2); }                // all NAs ? return special value to replace all o's values with '0'
@@ -995,7 +1040,7 @@ static int dsorted(double *x, int n)                        // order=1 is ascend
     for (i=1; i<n; i++) {
         this = twiddle(x,i,order);                          // TO DO: once we get past -Inf, NA and NaN at the bottom,  and +Inf at the top, 
                                                             //        the middle only need be twiddled for tolerance (worth it?)
-        if (this < prev) { gsngrp[flip] = old; return(0); }
+        if (this < prev) { gsngrp[flip] = old; sortedPrefix = i; return(0); }
         if (this==prev) tt++; else { push(tt); tt=1; }
         prev = this;
     }
@@ -1006,6 +1051,7 @@ static int dsorted(double *x, int n)                        // order=1 is ascend
 static int csorted(SEXP *x, int n)                          // order=1 is ascending and -1 is descending
 {                                                           // also accounts for nalast=0 (=NA), =1 (TRUE), -1 (FALSE)
     int i=1, j=0, tmp;
+    sortedPrefix = 0;
     if (nalast == 0) {                                      // when nalast = NA, 
         for (int k=0; k<n; k++) if (x[k] != NA_STRING) j++;
         if (j == 0) { push(n); return(-2); }                // all NAs ? return special value to replace all o's values with '0'
@@ -1023,7 +1069,7 @@ static int csorted(SEXP *x, int n)                          // order=1 is ascend
     int tt = 1;
     for (i=1; i<n; i++) {
         tmp = StrCmp2(x[i],x[i-1]);
-        if (tmp < 0) { gsngrp[flip] = old; return(0); }
+        if (tmp < 0) { gsngrp[flip] = old; sortedPrefix = i; return(0); }
         if (tmp == 0) tt++; else { push(tt); tt=1; }
     }
     push(tt);
@@ -1080,6 +1126,87 @@ static void dsort(double *x, int *o, int n)
     }
 }
 
+static int ptype;                                            // TYPEOF the column psort is working on, for pkey
+static unsigned long long pkey(void *x, int i)
+// The sort key of x[i] as an unsigned 64bit integer; the same ordering [i|d|c]sort use (incl. order and nalast)
+{
+    switch(ptype) {
+    case INTSXP : case LGLSXP :
+        return (unsigned int)icheck(((int *)x)[i]) - INT_MIN;
+    case REALSXP :
+        return twiddle(x, i, order);
+    default :                                               // STRSXP, ranked by csort_pre
+        return (unsigned int)icheck(((SEXP *)x)[i]==NA_STRING ? NA_INTEGER : -TRUELENGTH(((SEXP *)x)[i])) - INT_MIN;
+    }
+}
+
+static Rboolean psort(SEXP x, int *o, int n)
+// First column only. x is in order up to sortedPrefix (as left by [i|d|c]sorted) but not after it; e.g. new rows
+// appended to a keyed table. Rather than sort all of x, sort just the tail using the usual [i|d|c]sort, then merge it with
+// the prefix (whose order is simply 1:p) and push the merged group sizes. Close to O(n) plus the cost of sorting the tail.
+// Returns FALSE (having done nothing) if the prefix isn't at least half of x, leaving the full sort to forder.
+{
+    int p = sortedPrefix, m = n-p, i, j, k, tt;
+    if (nalast == 0 || p < n/2) return FALSE;              // nalast=NA sets o to 0 for NAs, which can't be merged
+    if (TYPEOF(x)==STRSXP && !sortStr) return FALSE;        // cgroup's first appearance order isn't a sort; nothing to merge
+    ptype = TYPEOF(x);
+    void *xd = DATAPTR(x);
+    if (ptype==STRSXP) csort_pre(xd, n);                    // ranks for all of x since the merge compares prefix to tail
+    int *t = (int *)malloc(m * sizeof(int));
+    if (t==NULL) Error("Failed to allocate working memory for psort. Requested %d * %d bytes", m, (int)sizeof(int));
+    if (m < N_SMALL) {
+        // [i|d]sort's small-n path sorts x in-place, which can't be done on the column itself, so insert on the keys here
+        unsigned long long *kt = (unsigned long long *)malloc(m * sizeof(unsigned long long)), ktmp;
+        if (kt==NULL) { free(t); Error("Failed to allocate working memory for psort. Requested %d * %d bytes", m, (int)sizeof(unsigned long long)); }
+        for (j=0; j<m; j++) { t[j] = p+j+1; kt[j] = pkey(xd, p+j); }
+        for (j=1; j<m; j++) {
+            ktmp = kt[j]; tt = t[j];
+            for (k=j-1; k>=0 && ktmp < kt[k]; k--) { kt[k+1] = kt[k]; t[k+1] = t[k]; }
+            kt[k+1] = ktmp; t[k+1] = tt;
+        }
+        free(kt);
+    } else {
+        int old = gsngrp[flip];
+        o[p] = -1;                                          // as forder, so the tail's order is written to o+p directly
+        switch(ptype) {
+        case INTSXP : case LGLSXP :
+            isort((int *)xd+p, o+p, m); break;
+        case REALSXP :
+            dsort((double *)xd+p, o+p, m); break;
+        case STRSXP :
+            alloc_csort_otmp(m); csort((SEXP *)xd+p, o+p, m); break;
+        default :
+            free(t); Error("Internal error: psort passed type '%s'", type2char(ptype));
+        }
+        gsngrp[flip] = old;                                 // discard the tail's groups; pushed again below once merged
+        for (j=0; j<m; j++) t[j] = o[p+j]+p;                // 1-based positions in x
+    }
+    // prefix items up to the first one greater than the smallest tail item stay where they are; binary search for it.
+    // Ties go to the prefix first since it's earlier in x; i.e. stable.
+    unsigned long long tmin = pkey(xd, t[0]-1);
+    int lo=0, hi=p;
+    while (lo<hi) { k = lo+(hi-lo)/2; if (pkey(xd, k) <= tmin) lo=k+1; else hi=k; }
+    for (i=0; i<lo; i++) o[i] = i+1;
+    // merge the rest backwards from the end; the prefix is just positions so o can be written over freely
+    i = p-1; j = m-1;
+    for (k=n-1; k>=lo; k--) {
+        if (j<0 || (i>=lo && pkey(xd, i) > pkey(xd, t[j]-1))) { o[k] = i+1; i--; }
+        else { o[k] = t[j]; j--; }
+    }
+    free(t);
+    if (stackgrps) {
+        unsigned long long prev = pkey(xd, o[0]-1), this;
+        tt = 1;
+        for (k=1; k<n; k++) {
+            this = pkey(xd, o[k]-1);
+            if (this==prev) tt++; else { push(tt); tt=1; }
+            prev = this;
+        }
+        push(tt);
+    }
+    return TRUE;
+}
+
 SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP naArg)
 // sortStr TRUE from setkey, FALSE from by=
 {
@@ -1087,13 +1214,11 @@ SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP
     Rboolean isSorted = TRUE;
     SEXP x, class;
     void *xd;
-#ifdef TIMING_ON
-    memset(tblock, 0, NBLOCK*sizeof(clock_t));
-    memset(nblock, 0, NBLOCK*sizeof(int));
-    clock_t tstart;  // local variable to mask the global tstart for ease when timing sub funs
-#endif
+    statreset();
     TBEG()
     
+    if (xlength(isNewList(DT) && length(DT) ? VECTOR_ELT(DT,0) : DT) > INT_MAX)
+        error("forder does not yet support long vectors (more than 2^31-1 rows) as its order and group sizes are int. A single column with na.last=FALSE is ordered by fsort instead; see forderv.");
     if (isNewList(DT)) {
         if (!length(DT)) error("DT is an empty list() of 0 columns");
         if (!isInteger(by) || !length(by)) error("DT has %d columns but 'by' is either not integer or length 0", length(DT));  // seq_along(x) at R level
@@ -1147,6 +1272,7 @@ SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP
     default :
         Error("First column being ordered is type '%s', not yet supported", type2char(TYPEOF(x)));
     }
+    stat_first = tmp;
     if (tmp) {                                  // -1 or 1. NEW: or -2 in case of nalast == 0 and all NAs
         if (tmp == 1) {                         // same as expected in 'order' (1 = increasing, -1 = decreasing)
             isSorted = TRUE;
@@ -1158,6 +1284,9 @@ SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP
             isSorted = FALSE;
             for (i=0; i<n; i++) o[i] = 0;
         }
+    } else if (psort(x, o, n)) {                // sorted except for a tail, e.g. rows appended to a keyed table
+        isSorted = FALSE;
+        stat_prefix = sortedPrefix;
     } else {
         isSorted = FALSE;
         switch(TYPEOF(x)) {
@@ -1283,13 +1412,9 @@ SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP
             TEND(6)
         }
     }
-#ifdef TIMING_ON
-    for (i=0; i<NBLOCK; i++) {
-        Rprintf("Timing block %d = %8.3f   %8d\n", i, 1.0*tblock[i]/CLOCKS_PER_SEC, nblock[i]);
-        if (i==12) Rprintf("\n");
-    }
-    Rprintf("Found %d groups and maxgrpn=%d\n", gsngrp[flip], gsmax[flip]);
-#endif
+    stat_ngrp = gsngrp[flip];      // only complete when groups were stacked; i.e. retGrp or more than one column
+    stat_maxgrpn = gsmax[flip];
+    stat_sorted = isSorted;
     
     if (!sortStr && ustr_n!=0) Error("Internal error: at the end of forder sortStr==FALSE but ustr_n!=0 [%d]", ustr_n);
     for(int i=0; i<ustr_n; i++)
@@ -1331,6 +1456,64 @@ SEXP forder(SEXP DT, SEXP by, SEXP retGrp, SEXP sortStrArg, SEXP orderArg, SEXP
     return( ans );
 }
 
+SEXP forderStats(SEXP timingArg)
+// Returns the instrumentation of the most recent call to forder (which may have been internal; e.g. from bmerge, or
+// fsort standing in for it, when $fsort is TRUE and only $isSorted is filled in) to diagnose slow keys without
+// rebuilding. timingArg=TRUE|FALSE switches the phase timings on|off for subsequent calls, NULL leaves it as it is.
+// The counters are always kept. $timing is the setting the last call ran with, so
+// old = forderStats(TRUE)$timing; ...; forderStats(old) restores it.
+{
+    Rboolean newtiming = timing;
+    if (!isNull(timingArg)) {
+        if (!isLogical(timingArg) || LENGTH(timingArg)!=1 || LOGICAL(timingArg)[0]==NA_LOGICAL)
+            error("timing must be TRUE, FALSE or NULL");
+        newtiming = LOGICAL(timingArg)[0];
+    }
+    const char *names[] = {"timing", "seconds", "calls", "isSorted", "firstColumn", "sortedPrefix", "ngrp", "maxgrpn",
+                           "radixPasses", "radixSkipped", "insertSorts", "countingSorts", "bucketSizes", "fsort"};
+    int nans = sizeof(names)/sizeof(char *);
+    SEXP ans = PROTECT(allocVector(VECSXP, nans)), nms = PROTECT(allocVector(STRSXP, nans)), tt, tn;
+    for (int i=0; i<nans; i++) SET_STRING_ELT(nms, i, mkChar(names[i]));
+    setAttrib(ans, R_NamesSymbol, nms);
+    SET_VECTOR_ELT(ans, 0, ScalarLogical(timing));
+    SET_VECTOR_ELT(ans, 1, tt = allocVector(REALSXP, NBLOCK));
+    SET_VECTOR_ELT(ans, 2, tn = allocVector(INTSXP, NBLOCK));
+    SEXP bnms = PROTECT(allocVector(STRSXP, NBLOCK));
+    for (int i=0; i<NBLOCK; i++) {
+        REAL(tt)[i] = 1.0*tblock[i]/CLOCKS_PER_SEC;
+        INTEGER(tn)[i] = nblock[i];
+        SET_STRING_ELT(bnms, i, mkChar(blockNames[i]));
+    }
+    setAttrib(tt, R_NamesSymbol, bnms);
+    setAttrib(tn, R_NamesSymbol, bnms);
+    SET_VECTOR_ELT(ans, 3, ScalarLogical(stat_sorted));
+    // as returned by [i|d|c]sorted: 1=already sorted, -1=strictly reverse sorted, 0=not sorted, -2=all NA with na.last=NA
+    SET_VECTOR_ELT(ans, 4, ScalarInteger(stat_first));
+    SET_VECTOR_ELT(ans, 5, ScalarInteger(stat_prefix));
+    SET_VECTOR_ELT(ans, 6, ScalarInteger(stat_ngrp));
+    SET_VECTOR_ELT(ans, 7, ScalarInteger(stat_maxgrpn));
+    SET_VECTOR_ELT(ans, 8, ScalarInteger(stat_nradix));
+    SET_VECTOR_ELT(ans, 9, ScalarInteger(stat_nskip));
+    SET_VECTOR_ELT(ans, 10, ScalarInteger(stat_ninsert));
+    SET_VECTOR_ELT(ans, 11, ScalarInteger(stat_ncount));
+    int nb = NBUCKET;
+    while (nb>0 && stat_bucket[nb-1]==0) nb--;
+    SET_VECTOR_ELT(ans, 12, tt = allocVector(INTSXP, nb));
+    SEXP nbnms = PROTECT(allocVector(STRSXP, nb));
+    char buff[32];
+    for (int i=0; i<nb; i++) {
+        INTEGER(tt)[i] = stat_bucket[i];
+        if (i==0) snprintf(buff, 32, "1");
+        else snprintf(buff, 32, "%u-%u", 1u<<i, (2u<<i)-1);  // bucket sizes [2^i, 2^(i+1))
+        SET_STRING_ELT(nbnms, i, mkChar(buff));
+    }
+    setAttrib(tt, R_NamesSymbol, nbnms);
+    SET_VECTOR_ELT(ans, 13, ScalarLogical(stat_fsort));
+    timing = newtiming;
+    UNPROTECT(4);
+    return(ans);
+}
+
 // TODO: implement 'order' argument to 'fsorted'
 // Not touching 'fsorted' for now for "decreasing order". Passing '1' as the value of 'order' argument (checks only ascending order as before).
 SEXP fsorted(SEXP x)
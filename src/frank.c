@@ -68,10 +68,13 @@ SEXP dt_na(SEXP x, SEXP cols) {
     return(ans);
 }
 
-SEXP frank(SEXP xorderArg, SEXP xstartArg, SEXP xlenArg, SEXP ties_method) {
-    int i=0, j=0, k=0, n;
+// grpArg, when not NULL, is the group of each item of x (see gfrank in gsumm.c). x is then ordered by the
+// group first, so no run of ties spans two groups, and the ranks restart at 1 at the first run of each group.
+SEXP frank(SEXP xorderArg, SEXP xstartArg, SEXP xlenArg, SEXP ties_method, SEXP grpArg) {
+    int i=0, j=0, k=0, n, off=0, thisgrp=0;
     int *xstart = INTEGER(xstartArg), *xlen = INTEGER(xlenArg), *xorder = INTEGER(xorderArg);
-    enum {MEAN, MAX, MIN, DENSE, SEQUENCE} ties = MEAN; // RUNLENGTH
+    int *grp = isNull(grpArg) ? NULL : INTEGER(grpArg);
+    enum {MEAN, MAX, MIN, DENSE, SEQUENCE, FIRST} ties = MEAN; // RUNLENGTH
     SEXP ans;
 
     if (!strcmp(CHAR(STRING_ELT(ties_method, 0)), "average"))  ties = MEAN;
@@ -79,52 +82,52 @@ SEXP frank(SEXP xorderArg, SEXP xstartArg, SEXP xlenArg, SEXP ties_method) {
     else if (!strcmp(CHAR(STRING_ELT(ties_method, 0)), "min")) ties = MIN;
     else if (!strcmp(CHAR(STRING_ELT(ties_method, 0)), "dense")) ties = DENSE;
     else if (!strcmp(CHAR(STRING_ELT(ties_method, 0)), "sequence")) ties = SEQUENCE;
+    else if (!strcmp(CHAR(STRING_ELT(ties_method, 0)), "first")) ties = FIRST;
     // else if (!strcmp(CHAR(STRING_ELT(ties_method, 0)), "runlength")) ties = RUNLENGTH;
     else error("Internal error: invalid ties.method for frankv(), should have been caught before. Please report to datatable-help");
     n = length(xorderArg);
     ans = (ties == MEAN) ? PROTECT(allocVector(REALSXP, n)) : PROTECT(allocVector(INTSXP, n));
     if (n > 0) {
-        switch (ties) {
-            case MEAN : 
-            for (i = 0; i < length(xstartArg); i++) {
-                for (j = xstart[i]-1; j < xstart[i]+xlen[i]-1; j++)
-                    REAL(ans)[xorder[j]-1] = (2*xstart[i]+xlen[i]-1)/2.0;
+        k=1;
+        for (i = 0; i < length(xstartArg); i++) {
+            if (grp && (i == 0 || grp[xorder[xstart[i]-1]-1] != thisgrp)) {
+                thisgrp = grp[xorder[xstart[i]-1]-1];
+                off = xstart[i]-1;
+                k = 1;
             }
-            break;
-            case MAX :
-            for (i = 0; i < length(xstartArg); i++) {
+            switch (ties) {
+                case MEAN :
                 for (j = xstart[i]-1; j < xstart[i]+xlen[i]-1; j++)
-                    INTEGER(ans)[xorder[j]-1] = xstart[i]+xlen[i]-1;
-            }
-            break;
-            case MIN :
-            for (i = 0; i < length(xstartArg); i++) {
+                    REAL(ans)[xorder[j]-1] = (2*(xstart[i]-off)+xlen[i]-1)/2.0;
+                break;
+                case MAX :
                 for (j = xstart[i]-1; j < xstart[i]+xlen[i]-1; j++)
-                    INTEGER(ans)[xorder[j]-1] = xstart[i];
-            }
-            break;
-            case DENSE :
-            k=1;
-            for (i = 0; i < length(xstartArg); i++) {
+                    INTEGER(ans)[xorder[j]-1] = xstart[i]-off+xlen[i]-1;
+                break;
+                case MIN :
+                for (j = xstart[i]-1; j < xstart[i]+xlen[i]-1; j++)
+                    INTEGER(ans)[xorder[j]-1] = xstart[i]-off;
+                break;
+                case DENSE :
                 for (j = xstart[i]-1; j < xstart[i]+xlen[i]-1; j++)
                     INTEGER(ans)[xorder[j]-1] = k;
                 k++;
-            }
-            break;
-            case SEQUENCE :
-            for (i = 0; i < length(xstartArg); i++) {
+                break;
+                case SEQUENCE :
                 k=1;
                 for (j = xstart[i]-1; j < xstart[i]+xlen[i]-1; j++)
                     INTEGER(ans)[xorder[j]-1] = k++;
+                break;
+                case FIRST :
+                for (j = xstart[i]-1; j < xstart[i]+xlen[i]-1; j++)
+                    INTEGER(ans)[xorder[j]-1] = j+1-off;
+                break;
+                // case RUNLENGTH :
+                // k=1;
+                // for (j = xstart[i]-1; j < xstart[i]+xlen[i]-1; j++)
+                //     INTEGER(ans)[xorder[j]-1] = k++;
+                // break;
             }
-            break;
-            // case RUNLENGTH :
-            // for (i = 0; i < length(xstartArg); i++) {
-            //     k=1;
-            //     for (j = xstart[i]-1; j < xstart[i]+xlen[i]-1; j++)
-            //         INTEGER(ans)[xorder[j]-1] = k++;
-            // }
-            break;
         }
     }
     UNPROTECT(1);
@@ -0,0 +1,191 @@
+#include "data.table.h"
+
+// Rolling window aggregates, see ?froll. x is a list of double columns. Windows never cross a group:
+// o is the order from forderv(by, sort=FALSE, retGrp=TRUE) (integer(0) when the groups are already
+// contiguous) and starts its 1-based group starts; no by= is one group. A fixed window is slid along
+// each group keeping a running state, so sum, mean and count are O(1) per row and min and max use a
+// monotonic deque (amortised O(1)). An adaptive window (one width per row, align right) uses prefix
+// sums of the group instead. The running and prefix sums are compensated (Neumaier): the rounding
+// error of each addition is kept in c, so a large value that has left the window (as in
+// frollsum(c(1e20,1,1), 2)) does not swamp the small ones that follow. Columns, widths, groups and pieces of long groups are tasks run in
+// parallel; each task starts its window afresh so the result does not depend on the number of threads.
+
+#define FROLLCHUNK 65536
+
+enum { FSUM, FMEAN, FMIN, FMAX, FCOUNT };
+
+// row of position p of the group starting at gs, and the value of x there
+#define ROW(p) (o ? o[gs+(p)]-1 : gs+(p))
+#define VAL(p) x[ROW(p)]
+
+// the state of a window : sum s+c of its finite values and counts of its NA, Inf, -Inf and non-NA values
+typedef struct { long double s, c; int nna, npinf, nninf, cnt; } rstate;
+
+static inline void radd(rstate *st, double v, int sign) {
+    if (ISNAN(v)) st->nna += sign;
+    else {
+        st->cnt += sign;
+        if (v==R_PosInf) st->npinf += sign;
+        else if (v==R_NegInf) st->nninf += sign;
+        else {
+            long double w = sign>0 ? (long double)v : -(long double)v, t = st->s + w;
+            st->c += fabsl(st->s) >= fabsl(w) ? (st->s - t) + w : (w - t) + st->s;
+            st->s = t;
+        }
+    }
+}
+
+static inline double rvalue(const rstate *st, int fun, Rboolean narm) {
+    if (fun==FCOUNT) return (double)st->cnt;
+    if (st->nna && !narm) return NA_REAL;
+    long double sum = st->s + st->c;
+    double s = st->npinf ? (st->nninf ? R_NaN : R_PosInf) : st->nninf ? R_NegInf : (double)sum;
+    if (fun==FSUM) return st->cnt ? s : 0.0;
+    return st->cnt ? (st->npinf || st->nninf ? s : (double)(sum / st->cnt)) : R_NaN;
+}
+
+// one task : rows [from, to) of a group of length len starting at gs in o
+static void rollfixed(int fun, const double *x, double *ans, int n, int off, double fill, Rboolean narm,
+                      const int *o, int gs, int len, int from, int to, int *dq) {
+    Rboolean init = FALSE;
+    rstate st = {0.0L, 0.0L, 0, 0, 0, 0};
+    int head=0, tail=0, nna=0;  // deque of positions dq[head..tail), values increasing for min (decreasing for max)
+    Rboolean ismax = fun==FMAX;
+    for (int p=from; p<to; p++) {
+        int ws = p-off, we = ws+n-1;
+        if (ws<0 || we>=len) { ans[ROW(p)] = fill; continue; }
+        if (fun==FMIN || fun==FMAX) {
+            int q = init ? we : ws;
+            if (init) {
+                if (ISNAN(VAL(ws-1))) nna--;
+                if (head<tail && dq[head]==ws-1) head++;
+            }
+            for (; q<=we; q++) {
+                double v = VAL(q);
+                if (ISNAN(v)) { nna++; continue; }
+                while (head<tail && (ismax ? VAL(dq[tail-1])<=v : VAL(dq[tail-1])>=v)) tail--;
+                dq[tail++] = q;
+            }
+            init = TRUE;
+            ans[ROW(p)] = nna && !narm ? NA_REAL : head<tail ? VAL(dq[head]) : (ismax ? R_NegInf : R_PosInf);
+        } else {
+            if (!init) { for (int q=ws; q<=we; q++) radd(&st, VAL(q), 1); init = TRUE; }
+            else { radd(&st, VAL(ws-1), -1); radd(&st, VAL(we), 1); }
+            ans[ROW(p)] = rvalue(&st, fun, narm);
+        }
+    }
+}
+
+// adaptive window of nv[row] rows ending at each row of a whole group; ps is len+1 prefix states
+static void rolladaptive(int fun, const double *x, double *ans, const int *nv, double fill, Rboolean narm,
+                         const int *o, int gs, int len, rstate *ps) {
+    if (fun==FMIN || fun==FMAX) {
+        Rboolean ismax = fun==FMAX;
+        for (int p=0; p<len; p++) {
+            int n = nv[ROW(p)];
+            if (n>p+1) { ans[ROW(p)] = fill; continue; }
+            double m = ismax ? R_NegInf : R_PosInf;
+            Rboolean na = FALSE;
+            for (int q=p-n+1; q<=p; q++) {
+                double v = VAL(q);
+                if (ISNAN(v)) na = TRUE;
+                else if (ismax ? v>m : v<m) m = v;
+            }
+            ans[ROW(p)] = na && !narm ? NA_REAL : m;
+        }
+        return;
+    }
+    ps[0] = (rstate){0.0L, 0.0L, 0, 0, 0, 0};
+    for (int p=0; p<len; p++) { ps[p+1] = ps[p]; radd(&ps[p+1], VAL(p), 1); }
+    for (int p=0; p<len; p++) {
+        int n = nv[ROW(p)];
+        if (n>p+1) { ans[ROW(p)] = fill; continue; }
+        const rstate *a = &ps[p+1], *b = &ps[p+1-n];
+        rstate st = {a->s - b->s, a->c - b->c, a->nna - b->nna, a->npinf - b->npinf, a->nninf - b->nninf, a->cnt - b->cnt};
+        ans[ROW(p)] = rvalue(&st, fun, narm);
+    }
+}
+
+SEXP froll(SEXP funArg, SEXP xArg, SEXP nArg, SEXP fillArg, SEXP alignArg, SEXP narmArg, SEXP adaptiveArg, SEXP oArg, SEXP startsArg) {
+    const char *funs[] = {"sum", "mean", "min", "max", "count"};
+    int fun = -1;
+    if (!isString(funArg) || LENGTH(funArg)!=1) error("fun must be a character vector of length 1");
+    for (int i=0; i<5; i++) if (!strcmp(CHAR(STRING_ELT(funArg, 0)), funs[i])) fun = i;
+    if (fun<0) error("fun must be one of 'sum', 'mean', 'min', 'max' or 'count'");
+    if (!isNewList(xArg)) error("x must be a list of double vectors");
+    if (!isInteger(nArg)) error("n must be an integer vector");
+    if (!isReal(fillArg) || LENGTH(fillArg)!=1) error("fill must be a double vector of length 1");
+    if (!isString(alignArg) || LENGTH(alignArg)!=1) error("align must be a character vector of length 1");
+    if (!isLogical(narmArg) || LENGTH(narmArg)!=1 || LOGICAL(narmArg)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
+    if (!isLogical(adaptiveArg) || LENGTH(adaptiveArg)!=1 || LOGICAL(adaptiveArg)[0]==NA_LOGICAL) error("adaptive must be TRUE or FALSE");
+    if (!isInteger(oArg) || !isInteger(startsArg)) error("Internal error: o and starts must be integer vectors");
+    Rboolean narm = LOGICAL(narmArg)[0], adaptive = LOGICAL(adaptiveArg)[0];
+    const char *align = CHAR(STRING_ELT(alignArg, 0));
+    if (strcmp(align, "right") && strcmp(align, "left") && strcmp(align, "center")) error("align must be 'right', 'left' or 'center'");
+    if (adaptive && strcmp(align, "right")) error("adaptive=TRUE supports align='right' only");
+    double fill = REAL(fillArg)[0];
+
+    int nx = length(xArg), nr = nx ? length(VECTOR_ELT(xArg, 0)) : 0;
+    for (int i=0; i<nx; i++) {
+        if (!isReal(VECTOR_ELT(xArg, i))) error("Item %d of x is type '%s' not double", i+1, type2char(TYPEOF(VECTOR_ELT(xArg, i))));
+        if (length(VECTOR_ELT(xArg, i))!=nr) error("Item %d of x has length %d but item 1 has length %d", i+1, length(VECTOR_ELT(xArg, i)), nr);
+    }
+    int nn = adaptive ? 1 : length(nArg), *n = INTEGER(nArg), maxn = 0;
+    if (adaptive && length(nArg)!=nr) error("n has length %d but x has %d rows; with adaptive=TRUE n gives the window width of each row", length(nArg), nr);
+    for (int j=0; j<length(nArg); j++) {
+        if (n[j]==NA_INTEGER || n[j]<1) error("n must be positive integer values (> 0), but item %d is %d", j+1, n[j]);
+        if (n[j]>maxn) maxn = n[j];
+    }
+    int *o = LENGTH(oArg) ? INTEGER(oArg) : NULL, ng = LENGTH(startsArg), *starts = INTEGER(startsArg);
+    if (o && LENGTH(oArg)!=nr) error("Internal error: o has length %d but x has %d rows", LENGTH(oArg), nr);
+
+    // tasks : pieces of at most FROLLCHUNK rows of each group (whole groups when adaptive)
+    int ntask = 0, maxlen = 0;
+    for (int g=0; g<ng; g++) {
+        int len = (g==ng-1 ? nr+1 : starts[g+1]) - starts[g];
+        ntask += adaptive ? len>0 : (len+FROLLCHUNK-1)/FROLLCHUNK;
+        if (len>maxlen) maxlen = len;
+    }
+    int *tg = malloc((ntask+1) * sizeof(int)), *tfrom = malloc((ntask+1) * sizeof(int));
+    if (!tg || !tfrom) { free(tg); free(tfrom); error("Unable to allocate %d tasks for froll", ntask); }
+    for (int g=0, t=0; g<ng; g++) {
+        int len = (g==ng-1 ? nr+1 : starts[g+1]) - starts[g];
+        for (int from=0; from<len; from+=FROLLCHUNK) { tg[t] = g; tfrom[t++] = from; if (adaptive) break; }
+    }
+
+    SEXP ans = PROTECT(allocVector(VECSXP, nx*nn));
+    double **xp = (double **)R_alloc(nx, sizeof(double *)), **ap = (double **)R_alloc(nx*nn, sizeof(double *));
+    for (int i=0; i<nx; i++) {
+        xp[i] = REAL(VECTOR_ELT(xArg, i));
+        for (int j=0; j<nn; j++) {
+            SET_VECTOR_ELT(ans, i*nn+j, allocVector(REALSXP, nr));
+            ap[i*nn+j] = REAL(VECTOR_ELT(ans, i*nn+j));
+        }
+    }
+    int nth = getDTthreads();
+    if (nth > ntask) nth = ntask;
+    if (nth < 1) nth = 1;
+    // per thread : the deque of a fixed window, or the prefix states of an adaptive group
+    size_t bufsize = adaptive ? (size_t)(maxlen+1)*sizeof(rstate) : (size_t)(MIN(maxlen, FROLLCHUNK)+MIN(maxn, maxlen))*sizeof(int);
+    char *buf = malloc(nth * bufsize + 1);
+    if (!buf) { free(tg); free(tfrom); error("Unable to allocate %d * %.0f bytes of working memory for froll", nth, (double)bufsize); }
+    long long ntotal = (long long)nx*nn*ntask;
+    #pragma omp parallel num_threads(nth)
+    {
+        char *mybuf = buf + omp_get_thread_num()*bufsize;
+        #pragma omp for schedule(dynamic)
+        for (long long k=0; k<ntotal; k++) {
+            int t = k % ntask, j = (k/ntask) % nn, i = k/ntask/nn, g = tg[t];
+            int gs = starts[g]-1, len = (g==ng-1 ? nr+1 : starts[g+1]) - starts[g];
+            if (adaptive) {
+                rolladaptive(fun, xp[i], ap[i*nn+j], n, fill, narm, o, gs, len, (rstate *)mybuf);
+            } else {
+                int off = align[0]=='r' ? n[j]-1 : align[0]=='l' ? 0 : (n[j]-1)/2;
+                rollfixed(fun, xp[i], ap[i*nn+j], n[j], off, fill, narm, o, gs, len, tfrom[t], MIN(tfrom[t]+FROLLCHUNK, len), (int *)mybuf);
+            }
+        }
+    }
+    free(buf); free(tg); free(tfrom);
+    UNPROTECT(1);
+    return ans;
+}
@@ -2,88 +2,110 @@
 
 #define INSERT_THRESH 200  // TODO: expose via api and test
 
-static void dinsert(double *x, int n) {   // TODO: if and when twiddled, double => ull
-  if (n<2) return;
+/*
+  fsort sorts on unsigned long long keys. Each type is twiddled to a key whose unsigned order is the sort order
+  with NA first; i.e. na.last=FALSE, as forder and setkey default to. Ascending :
+    double     same bits as forder.c::dtwiddle (without rounding) : NA, NaN, -Inf, ..., +Inf
+    integer    same as icheck+iradix in forder.c : the sign bit flipped so NA_INTEGER (INT_MIN) is 0
+    integer64  same as forder.c::i64twiddle : the sign bit flipped so NA (LLONG_MIN) is 0
+    character  the rank of the string amongst the unique strings, via truelength as csort_pre does in forder.c
+  The key functions are local rather than dtwiddle and i64twiddle themselves because those use a static union and
+  the static nalast from forder, which would not be thread safe here.
+  Decreasing twiddles -x as forder does (order*x), so NA stays first (key 0) and ties stay stable. -x can't overflow
+  since INT_MIN and LLONG_MIN are NA. For character the ranks are reversed leaving NA first.
+  The minimum key is subtracted before the radix passes so only the bits in the range need resolving.
+  The original position can be carried alongside each key to return the ordering (retOrder=TRUE), which is stable for
+  ties so equal to forder's result. The order is always carried for character, to return the input CHARSXP.
+*/
+
+static inline unsigned long long dkey(double x, Rboolean collapseZero) {
+  unsigned long long u;
+  if (ISNAN(x)) return ISNA(x) ? 0 : (1ULL << 51);            // NA first, then NaN; see dtwiddle in forder.c
+  if (x==0 && collapseZero) x=0;                               // -0 to 0; same group as forder. Kept for values (-0 before 0)
+  memcpy(&u, &x, 8);                                           // no type punning; see I64() in init.c
+  return u ^ ((u & 0x8000000000000000) ? 0xffffffffffffffff : 0x8000000000000000);
+}
+
+static inline double dunkey(unsigned long long k) {
+  if (k==0) return NA_REAL;
+  if (k==(1ULL << 51)) return R_NaN;
+  k = (k & 0x8000000000000000) ? k ^ 0x8000000000000000 : ~k;
+  double d;
+  memcpy(&d, &k, 8);
+  return d;
+}
+
+static void kinsert(unsigned long long *x, int *o, int n) {   // o is NULL when not carrying the order
   for (int i=1; i<n; i++) {
-    double xtmp = x[i];
-    int j = i-1;
-    if (xtmp<x[j]) {
-      x[j+1] = x[j];
-      j--;
-      while (j>=0 && xtmp<x[j]) { x[j+1] = x[j]; j--; }
+    unsigned long long xtmp = x[i];
+    if (xtmp<x[i-1]) {
+      int otmp = o ? o[i] : 0;
+      int j = i-1;
+      while (j>=0 && xtmp<x[j]) { x[j+1] = x[j]; if (o) o[j+1] = o[j]; j--; }
       x[j+1] = xtmp;
+      if (o) o[j+1] = otmp;
     }
   }
 }
 
-static union {
-  double d;
-  unsigned long long ull;
-} u;
-static unsigned long long minULL;
-
-static void dradix_r(  // single-threaded recursive worker
-  double *in,          // n doubles to be sorted
-  double *working,     // working memory to put the sorted items before copying over *in; must not overlap *in
+static void kradix_r(  // single-threaded recursive worker
+  unsigned long long *in,        // n keys to be sorted, already minus the minimum key
+  int *oin,                      // NULL or n original positions to be reordered in step with *in
+  unsigned long long *working,   // working memory to put the sorted items before copying over *in; must not overlap *in
+  int *oworking,                 // as working, for oin
   R_xlen_t n,          // number of items to sort.  *in and *working must be at least n long
-  int fromBit,         // After twiddle to ordered ull, the bits [fromBit,toBit] are used to count  
+  int fromBit,         // the bits [fromBit,toBit] are used to count
   int toBit,           //   fromBit<toBit; bit 0 is the least significant; fromBit is right shift amount too
   R_xlen_t *counts     // already zero'd counts vector, 2^(toBit-fromBit+1) long. A stack of these is reused.
 ) {
   unsigned long long width = 1ULL<<(toBit-fromBit+1);
   unsigned long long mask = width-1;
-  
-  const double *tmp=in;
-  for (R_xlen_t i=0; i<n; i++) {
-    counts[(*(unsigned long long *)tmp - minULL) >> fromBit & mask]++;
-    tmp++;
-  }
-  int last = (*(unsigned long long *)--tmp - minULL) >> fromBit & mask;
+
+  for (R_xlen_t i=0; i<n; i++) counts[in[i] >> fromBit & mask]++;
+  int last = in[n-1] >> fromBit & mask;
   if (counts[last] == n) {
     // Single value for these bits here. All counted in one bucket which must be the bucket for the last item.
-    counts[last] = 0;  // clear ready for reuse. All other counts must be zero already so save time by not setting to 0. 
-    if (fromBit > 0)   // move on to next bits (if any remain) to resolve 
-      dradix_r(in, working, n, fromBit<8 ? 0 : fromBit-8, toBit-8, counts+256);
+    counts[last] = 0;  // clear ready for reuse. All other counts must be zero already so save time by not setting to 0.
+    if (fromBit > 0)   // move on to next bits (if any remain) to resolve
+      kradix_r(in, oin, working, oworking, n, fromBit<8 ? 0 : fromBit-8, toBit-8, counts+256);
     return;
   }
 
   R_xlen_t cumSum=0;
   for (R_xlen_t i=0; cumSum<n; i++) { // cumSum<n better than i<width as may return early
-    unsigned long long tmp;
+    R_xlen_t tmp;
     if ((tmp=counts[i])) {  // don't cumulate through 0s, important below to save a wasteful memset to zero
       counts[i] = cumSum;
       cumSum += tmp;
     }
   } // leaves cumSum==n && 0<i && i<=width
-  
-  tmp=in;
-  for (R_xlen_t i=0; i<n; i++) {  // go forwards not backwards to give cpu pipeline better chance
-    int thisx = (*(unsigned long long *)tmp - minULL) >> fromBit & mask;
-    working[ counts[thisx]++ ] = *tmp;
-    tmp++;
+
+  for (R_xlen_t i=0; i<n; i++) {  // go forwards not backwards to give cpu pipeline better chance; and stable for the order
+    R_xlen_t to = counts[in[i] >> fromBit & mask]++;
+    working[to] = in[i];
+    if (oin) oworking[to] = oin[i];
   }
-  
-  memcpy(in, working, n*sizeof(double));
-  
+  memcpy(in, working, n*sizeof(unsigned long long));
+  if (oin) memcpy(oin, oworking, n*sizeof(int));
+
   if (fromBit==0) {
     // nothing left to do other than reset the counts to 0, ready for next recursion
     // the final bucket must contain n and it might be close to the start. After that must be all 0 so no need to reset.
-    // Also this way, we don't need to know how big thisCounts is and therefore no possibility of getting that wrong.
-    // wasteful thisCounts[i]=0 even when already 0 is better than a branch. We are highly recursive at this point
-    // so avoiding memset() is known to be worth it.
-    for (int i=0; counts[i]<n; i++) counts[i]=0;
+    int i=0;
+    while (counts[i]<n) counts[i++]=0;
+    counts[i]=0;  // the final bucket too, else it is left at n for the next group at this level
     return;
   }
-  
+
   cumSum=0;
   for (int i=0; cumSum<n; i++) {   // again, cumSum<n better than i<width as it can return early
     if (counts[i] == 0) continue;
     R_xlen_t thisN = counts[i] - cumSum;  // undo cummulate; i.e. diff
     if (thisN <= INSERT_THRESH) {
-      dinsert(in+cumSum, thisN);  // for thisN==1 this'll return instantly. Probably better than several branches here.
+      kinsert(in+cumSum, oin ? oin+cumSum : NULL, thisN);  // for thisN==1 this'll return instantly
     } else {
-      dradix_r(in+cumSum, working, thisN, fromBit<=8 ? 0 : fromBit-8, toBit-8, counts+256);
-    }  
+      kradix_r(in+cumSum, oin ? oin+cumSum : NULL, working, oworking, thisN, fromBit<=8 ? 0 : fromBit-8, toBit-8, counts+256);
+    }
     cumSum = counts[i];
     counts[i] = 0; // reset to 0 to save wasteful memset afterwards
   }
@@ -98,91 +120,214 @@ int qsort_cmp(const void *a, const void *b) {
   R_xlen_t y = qsort_data[*(int *)b];
   // return x-y;  would like this, but this is long and the cast to int return may not preserve sign
   // We have long vectors in mind (1e10(74GB), 1e11(740GB)) where extreme skew may feasibly mean the largest count
-  // is greater than 2^32. The first split is (currently) 16 bits so should be very rare but to be safe keep 64bit counts.    
+  // is greater than 2^32. The first split is (currently) 16 bits so should be very rare but to be safe keep 64bit counts.
   return (x<y)-(x>y);   // largest first in a safe branchless way casting long to int
 }
 
-SEXP fsort(SEXP x, SEXP verboseArg) {
+static int ustr_cmp(const void *a, const void *b) {
+  return StrCmp(*(SEXP *)a, *(SEXP *)b);   // NA first; the same C-locale ordering of UTF-8 as forder
+}
+
+static int rankStrings(SEXP *x, R_xlen_t n, SEXP **ustrp, int *nrank)
+// Single threaded. Leaves -(rank+1) in the truelength of each unique CHARSXP, for the caller to read in parallel
+// and then reset to 0 before savetl_end(). Strings which compare equal in different encodings get the same rank.
+{
+  int ustr_alloc = 10000, ustr_n = 0;
+  SEXP *ustr = malloc(ustr_alloc * sizeof(SEXP));
+  if (ustr==NULL) { savetl_end(); error("Unable to allocate ustr in fsort"); }
+  for (R_xlen_t i=0; i<n; i++) {
+    SEXP s = x[i];
+    if (TRUELENGTH(s)<0) continue;   // seen already
+    if (TRUELENGTH(s)>0) { savetl(s); SET_TRUELENGTH(s,0); }
+    if (ustr_n == ustr_alloc) {
+      ustr_alloc *= 2;
+      SEXP *tmp = realloc(ustr, ustr_alloc * sizeof(SEXP));
+      if (tmp==NULL) { for (int j=0; j<ustr_n; j++) SET_TRUELENGTH(ustr[j],0); free(ustr); savetl_end(); error("Unable to realloc ustr in fsort to %d", ustr_alloc); }
+      ustr = tmp;
+    }
+    SET_TRUELENGTH(s, -1);
+    ustr[ustr_n++] = s;
+  }
+  qsort(ustr, ustr_n, sizeof(SEXP), ustr_cmp);
+  int rank = 0;
+  SET_TRUELENGTH(ustr[0], -1);
+  for (int i=1; i<ustr_n; i++) {
+    if (StrCmp(ustr[i-1], ustr[i]) != 0) rank++;
+    SET_TRUELENGTH(ustr[i], -rank-1);
+  }
+  *ustrp = ustr;
+  *nrank = rank+1;
+  return ustr_n;
+}
+
+static void batchKeys(SEXP x, Rboolean isI64, Rboolean decreasing, Rboolean collapseZero, int nrank,
+                      R_xlen_t from, R_xlen_t len, unsigned long long *k)
+// Twiddles x[from:(from+len-1)] into k. Thread safe; for character rankStrings() must have been called first.
+{
+  switch(TYPEOF(x)) {
+  case REALSXP :
+    if (isI64) {
+      const long long *d = (const long long *)REAL(x) + from;
+      if (decreasing) for (R_xlen_t j=0; j<len; j++) k[j] = (unsigned long long)(d[j]==NAINT64 ? d[j] : -d[j]) ^ 0x8000000000000000;
+      else            for (R_xlen_t j=0; j<len; j++) k[j] = (unsigned long long)d[j] ^ 0x8000000000000000;
+    } else {
+      const double *d = REAL(x) + from;
+      if (decreasing) for (R_xlen_t j=0; j<len; j++) k[j] = dkey(-d[j], collapseZero);
+      else            for (R_xlen_t j=0; j<len; j++) k[j] = dkey(d[j], collapseZero);
+    }
+    break;
+  case INTSXP : case LGLSXP : {
+    const int *d = INTEGER(x) + from;
+    if (decreasing) for (R_xlen_t j=0; j<len; j++) k[j] = (unsigned int)(d[j]==NA_INTEGER ? d[j] : -d[j]) ^ 0x80000000;
+    else            for (R_xlen_t j=0; j<len; j++) k[j] = (unsigned int)d[j] ^ 0x80000000;
+  } break;
+  case STRSXP : {
+    const SEXP *d = STRING_PTR(x) + from;
+    if (decreasing) for (R_xlen_t j=0; j<len; j++) k[j] = d[j]==NA_STRING ? 0 : nrank+1+TRUELENGTH(d[j]);
+    else            for (R_xlen_t j=0; j<len; j++) k[j] = -TRUELENGTH(d[j]);
+  } break;
+  }
+}
+
+static Rboolean fsortType(SEXP x)
+// returns whether x is integer64, or errors if x is not a supported type
+{
+  if (!isVectorAtomic(x)) error("x must be a vector");
+  switch(TYPEOF(x)) {
+  case REALSXP : return INHERITS(x, char_integer64);
+  case INTSXP : case LGLSXP : case STRSXP : return FALSE;
+  default : error("x is type '%s' but must be type double, integer, logical or character", type2char(TYPEOF(x)));
+  }
+  return FALSE;
+}
+
+SEXP fsort(SEXP x, SEXP decreasingArg, SEXP retOrderArg, SEXP verboseArg) {
   if (!isLogical(verboseArg) || LENGTH(verboseArg)!=1 || LOGICAL(verboseArg)[0]==NA_LOGICAL)
     error("verbose must be TRUE or FALSE");
   Rboolean verbose = LOGICAL(verboseArg)[0];
-  if (!isNumeric(x)) error("x must be a vector of type 'double' currently");
-  // TODO: not only detect if already sorted, but if it is, just return x to save the duplicate
-  
-  SEXP ansVec = PROTECT(allocVector(REALSXP, xlength(x)));
-  double *ans = REAL(ansVec);
-  // allocate early in case fails if not enough RAM
-  // TODO: document this is much cheaper than a copy followed by in-place.
-  
+  if (!isLogical(retOrderArg) || LENGTH(retOrderArg)!=1 || LOGICAL(retOrderArg)[0]==NA_LOGICAL)
+    error("retOrder must be TRUE or FALSE");
+  Rboolean retOrder = LOGICAL(retOrderArg)[0];
+  if (!isLogical(decreasingArg) || LENGTH(decreasingArg)!=1 || LOGICAL(decreasingArg)[0]==NA_LOGICAL)
+    error("decreasing must be TRUE or FALSE");
+  Rboolean decreasing = LOGICAL(decreasingArg)[0];
+  Rboolean isI64 = fsortType(x);
+  R_xlen_t n = xlength(x);
+  Rboolean carry = retOrder || TYPEOF(x)==STRSXP;   // carry the original position alongside each key
+  Rboolean longOrder = carry && n>INT_MAX;           // carry 64bit positions and return the order as double
+  if (n<=1) { forderStatsFsort(TRUE); return retOrder ? allocVector(INTSXP, 0) : x; }
+
   int nth = getDTthreads();
   int nBatch=nth*2;  // at least nth; more to reduce last-man-home; but not too large to keep counts small in cache
   if (verbose) Rprintf("nth=%d, nBatch=%d\n",nth,nBatch);
-  
-  R_xlen_t batchSize = (xlength(x)-1)/nBatch + 1;
+
+  R_xlen_t batchSize = (n-1)/nBatch + 1;
   if (batchSize < 1024) batchSize = 1024; // simple attempt to work reasonably for short vector. 1024*8 = 2 4kb pages
-  nBatch = (xlength(x)-1)/batchSize + 1;
-  R_xlen_t lastBatchSize = xlength(x) - (nBatch-1)*batchSize;
-  // could be that lastBatchSize == batchSize when i) xlength(x) is multiple of nBatch
-  // and ii) for small vectors with just one batch 
-  
-  double mins[nBatch], maxs[nBatch];
+  nBatch = (n-1)/batchSize + 1;
+  R_xlen_t lastBatchSize = n - (nBatch-1)*batchSize;
+  // could be that lastBatchSize == batchSize when i) n is multiple of nBatch
+  // and ii) for small vectors with just one batch
+
+  SEXP *ustr = NULL;
+  int ustr_n = 0, nrank = 0;
+  if (TYPEOF(x)==STRSXP) {
+    savetl_init();
+    ustr_n = rankStrings(STRING_PTR(x), n, &ustr, &nrank);
+    if (verbose) Rprintf("%d unique strings ranked\n", ustr_n);
+  }
+
+  // allocate early in case fails if not enough RAM
+  unsigned long long *key = malloc(n * sizeof(unsigned long long));    // the input twiddled
+  unsigned long long *kans = malloc(n * sizeof(unsigned long long));   // the keys in sorted order, minus min
+  int *oans = carry && !longOrder ? malloc(n * sizeof(int)) : NULL;
+  R_xlen_t *oansL = longOrder ? malloc(n * sizeof(R_xlen_t)) : NULL;
+  if (key==NULL || kans==NULL || (carry && oans==NULL && oansL==NULL)) {
+    free(key); free(kans); free(oans); free(oansL);
+    if (ustr) { for (int i=0; i<ustr_n; i++) SET_TRUELENGTH(ustr[i],0); free(ustr); savetl_end(); }
+    error("Unable to allocate working memory for %lld items in fsort", (long long)n);
+  }
+
+  unsigned long long mins[nBatch], maxs[nBatch], firsts[nBatch], lasts[nBatch];
+  Rboolean sorteds[nBatch];
   #pragma omp parallel for schedule(dynamic) num_threads(nth)
   for (int batch=0; batch<nBatch; batch++) {
     R_xlen_t thisLen = (batch==nBatch-1) ? lastBatchSize : batchSize;
-    double *d = &REAL(x)[batchSize * batch];
-    double myMin=*d, myMax=*d;
-    d++;
+    R_xlen_t from = batchSize * batch;
+    unsigned long long *k = key + from;
+    batchKeys(x, isI64, decreasing, retOrder, nrank, from, thisLen, k);
+    unsigned long long myMin=k[0], myMax=k[0];
+    Rboolean mySorted = TRUE;
     for (R_xlen_t j=1; j<thisLen; j++) {
-      // TODO: test for sortedness here as well.
-      if (*d<myMin) myMin=*d;
-      else if (*d>myMax) myMax=*d;
-      d++;
+      if (k[j]<k[j-1]) mySorted = FALSE;
+      if (k[j]<myMin) myMin=k[j];
+      else if (k[j]>myMax) myMax=k[j];
     }
     mins[batch] = myMin;
     maxs[batch] = myMax;
+    firsts[batch] = k[0];
+    lasts[batch] = k[thisLen-1];
+    sorteds[batch] = mySorted;
+  }
+  if (ustr) {
+    for (int i=0; i<ustr_n; i++) SET_TRUELENGTH(ustr[i],0);
+    free(ustr);
+    savetl_end();
   }
-  double min=mins[0], max=maxs[0];
+  unsigned long long min=mins[0], max=maxs[0];
+  Rboolean sorted = sorteds[0];
   for (int i=1; i<nBatch; i++) {
     // TODO: if boundaries are sorted then we only need sort the unsorted batches known above
     if (mins[i]<min) min=mins[i];
     if (maxs[i]>max) max=maxs[i];
+    sorted &= sorteds[i] && firsts[i]>=lasts[i-1];
+  }
+  if (verbose) Rprintf("Key range = [%llu,%llu]; %s\n", min, max, sorted ? "already sorted" : "not sorted");
+  if (sorted) {
+    free(key); free(kans); free(oans); free(oansL);
+    forderStatsFsort(TRUE);
+    return retOrder ? allocVector(INTSXP, 0) : x;   // integer() for already sorted, as forder
   }
-  if (verbose) Rprintf("Range = [%g,%g]\n", min, max);
-  if (min < 0.0) error("Cannot yet handle negatives.");
-  // TODO: -0ULL should allow negatives
-  //       avoid twiddle function call as expensive in recent tests (0.34 vs 2.7)
-  //       possibly twiddle once to *ans, then untwiddle at the end in a fast parallel sweep
-  u.d = max;
-  unsigned long long maxULL = u.ull;
-  u.d = min;
-  minULL = u.ull;  // set static global for use by dradix_r
-  
-  int maxBit = floor(log(maxULL-minULL) / log(2));  // 0 is the least significant bit
+  if (retOrder && !longOrder && (TYPEOF(x)!=REALSXP || isI64 || INTEGER(getNumericRounding())[0]==0)) {
+    // Sorted apart from a tail; e.g. rows appended to a keyed table. forder's psort sorts just the tail and merges which
+    // is close to O(n), so return its order instead. Leading batches suffice to detect it.
+    // Not for double while rounding is on, since forder would round and we don't.
+    int b = 0;
+    while (b<nBatch && sorteds[b] && (b==0 || firsts[b]>=lasts[b-1])) b++;
+    if (b*batchSize >= n/2) {
+      if (verbose) Rprintf("First %d of %d batches are already sorted; leaving to forder to sort the rest and merge\n", b, nBatch);
+      free(key); free(kans); free(oans); free(oansL);
+      SEXP f = PROTECT(ScalarLogical(FALSE)), t = PROTECT(ScalarLogical(TRUE)), o = PROTECT(ScalarInteger(decreasing ? -1 : 1));
+      SEXP ans = forder(x, R_NilValue, f, t, o, f);
+      UNPROTECT(3);
+      return ans;
+    }
+  }
+
+  unsigned long long range = max-min;   // >0 since not sorted
+  int maxBit = 0;                       // 0 is the least significant bit
+  while (maxBit<63 && range >> (maxBit+1)) maxBit++;
   int MSBNbits = maxBit > 15 ? 16 : maxBit+1;       // how many bits make up the MSB
   int shift = maxBit + 1 - MSBNbits;                // the right shift to leave the MSB bits remaining
   int MSBsize = 1<<MSBNbits;                        // the number of possible MSB values (16 bits => 65,536)
   if (verbose) Rprintf("maxBit=%d; MSBNbits=%d; shift=%d; MSBsize=%d\n", maxBit, MSBNbits, shift, MSBsize);
-  
+
   R_xlen_t *counts = calloc(nBatch*(size_t)MSBsize, sizeof(R_xlen_t));
-  if (counts==NULL) error("Unable to allocate working memory");
+  if (counts==NULL) { free(key); free(kans); free(oans); free(oansL); error("Unable to allocate working memory"); }
   // provided MSBsize>=9, each batch is a multiple of at least one 4k page, so no page overlap
-  // TODO: change all calloc, malloc and free to Calloc and Free to be robust to error() and catch ooms. 
-  
+  // TODO: change all calloc, malloc and free to Calloc and Free to be robust to error() and catch ooms.
+
   if (verbose) Rprintf("counts is %dMB (%d pages per nBatch=%d, batchSize=%lld, lastBatchSize=%lld)\n",
                        nBatch*MSBsize*sizeof(R_xlen_t)/(1024*1024), nBatch*MSBsize*sizeof(R_xlen_t)/(4*1024*nBatch),
                        nBatch, batchSize, lastBatchSize);
-  
+
   #pragma omp parallel for num_threads(nth)
   for (int batch=0; batch<nBatch; batch++) {
     R_xlen_t thisLen = (batch==nBatch-1) ? lastBatchSize : batchSize;
-    double *tmp = &REAL(x)[batchSize * (size_t)batch];
+    const unsigned long long *tmp = key + batchSize * (size_t)batch;
     R_xlen_t *thisCounts = counts + batch*(size_t)MSBsize;
-    for (R_xlen_t j=0; j<thisLen; j++) {
-      thisCounts[(*(unsigned long long *)tmp - minULL) >> shift]++;
-      tmp++;
-    }
+    for (R_xlen_t j=0; j<thisLen; j++) thisCounts[(tmp[j] - min) >> shift]++;
   }
-  
+
   // cumulate columnwise; parallel histogram; small so no need to parallelize
   R_xlen_t rollSum=0;
   for (int msb=0; msb<MSBsize; msb++) {
@@ -194,33 +339,36 @@ SEXP fsort(SEXP x, SEXP verboseArg) {
       j += MSBsize;  // deliberately non-contiguous here
     }
   }  // leaves msb cumSum in the last batch i.e. last row of the matrix
-  
+
   #pragma omp parallel for num_threads(nth)
   for (int batch=0; batch<nBatch; batch++) {
     R_xlen_t thisLen = (batch==nBatch-1) ? lastBatchSize : batchSize;
-    double *source = &REAL(x)[batchSize * batch];
-    R_xlen_t *thisCounts = counts + batch*MSBsize;
+    R_xlen_t from = batchSize * (size_t)batch;
+    const unsigned long long *source = key + from;
+    R_xlen_t *thisCounts = counts + batch*(size_t)MSBsize;
     for (R_xlen_t j=0; j<thisLen; j++) {
-      ans[ thisCounts[(*(unsigned long long *)source - minULL) >> shift]++ ] = *source;
-      // This assignment to ans is not random access as it may seem, but cache efficient by
+      unsigned long long k = source[j] - min;
+      R_xlen_t to = thisCounts[k >> shift]++;
+      kans[to] = k;
+      if (oans) oans[to] = from+j;
+      else if (oansL) oansL[to] = from+j;
+      // This assignment to kans is not random access as it may seem, but cache efficient by
       // design since target pages are written to contiguously. MSBsize * 4k < cache.
       // TODO: therefore 16 bit MSB seems too big for this step. Time this step and reduce 16 a lot.
       //       20MB cache / nth / 4k => MSBsize=160
-      source++;
     }
   }
   // Done with batches now. Will not use batch dimension again.
-  
-  // TODO: add a timing point up to here
-  
-  if (shift > 0) { // otherwise, no more bits left to resolve ties and we're done  
+  free(key);   // the working memory per thread below is at most the size of the largest msb
+
+  if (shift > 0) { // otherwise, no more bits left to resolve ties and we're done
     int toBit = shift-1;
     int fromBit = toBit>7 ? toBit-7 : 0;
 
     // sort bins by size, largest first to minimise last-man-home
     R_xlen_t *msbCounts = counts + (nBatch-1)*(size_t)MSBsize;
     // msbCounts currently contains the ending position of each MSB (the starting location of the next) even across empty
-    if (msbCounts[MSBsize-1] != xlength(x)) error("Internal error: counts[nBatch-1][MSBsize-1] != length(x)");
+    if (msbCounts[MSBsize-1] != n) error("Internal error: counts[nBatch-1][MSBsize-1] != length(x)");
     R_xlen_t *msbFrom = malloc(MSBsize*sizeof(R_xlen_t));
     int *order = malloc(MSBsize*sizeof(int));
     R_xlen_t cumSum = 0;
@@ -234,69 +382,272 @@ SEXP fsort(SEXP x, SEXP verboseArg) {
     qsort(order, MSBsize, sizeof(int), qsort_cmp);  // find order of the sizes, largest first
     // Would have liked to define qsort_cmp() inside this function right here, but not sure that's fully portable.
     // TODO: time this qsort but likely insignificant.
-    
+
     if (verbose) {
-      Rprintf("Top 5 MSB counts: "); for(int i=0; i<5; i++) Rprintf("%lld ", msbCounts[order[i]]); Rprintf("\n");
+      Rprintf("Top 5 MSB counts: "); for(int i=0; i<5 && i<MSBsize; i++) Rprintf("%lld ", msbCounts[order[i]]); Rprintf("\n");
       Rprintf("Reduced MSBsize from %d to ", MSBsize);
     }
     while (MSBsize>0 && msbCounts[order[MSBsize-1]] < 2) MSBsize--;
     if (verbose) {
       Rprintf("%d by excluding 0 and 1 counts\n", MSBsize);
     }
-    
-    #pragma omp parallel num_threads(getDTthreads())
+    if (longOrder && MSBsize && msbCounts[order[0]]>INT_MAX) {
+      // each msb is sorted with an int index local to it, below
+      free(msbFrom); free(order); free(counts); free(kans); free(oansL);
+      error("The largest MSB of this long vector contains %lld items; more than INT_MAX. Too skewed to sort with order.", (long long)msbCounts[order[0]]);
+    }
+
+    // The working memory of each thread, allocated up front for the largest msb (msbCounts is sorted largest first) so
+    // that a failure is caught here rather than inside the parallel region. The largest msb is small next to n anyway
+    // since the initial split is so large (16bits => 65,536 msbs; n/65,536 each if uniformly distributed).
+    int nthm = MSBsize < nth ? (MSBsize ? MSBsize : 1) : nth;
+    size_t maxN = MSBsize ? (size_t)msbCounts[order[0]] : 0, ncounts = (size_t)(toBit/8 + 1)*256;
+    R_xlen_t *tcounts = calloc(nthm*ncounts + 1, sizeof(R_xlen_t));   // each thread has its own (small) stack of counts
+    unsigned long long *tworking = malloc(nthm*maxN*sizeof(unsigned long long) + 1);
+    int *toworking = carry ? malloc(nthm*maxN*sizeof(int) + 1) : NULL;
+    int *tlidx = longOrder ? malloc(nthm*maxN*sizeof(int) + 1) : NULL;   // for longOrder; positions within the msb are
+    R_xlen_t *tlworking = longOrder ? malloc(nthm*maxN*sizeof(R_xlen_t) + 1) : NULL;   // sorted as int lidx then applied
+    if (!tcounts || !tworking || (carry && !toworking) || (longOrder && (!tlidx || !tlworking))) {
+      free(tcounts); free(tworking); free(toworking); free(tlidx); free(tlworking);
+      free(msbFrom); free(order); free(counts); free(kans); free(oans); free(oansL);
+      error("Unable to allocate %d * %.0f bytes of working memory to sort the largest MSB of %.0f items", nthm,
+            (double)(maxN*(sizeof(unsigned long long) + (carry ? sizeof(int) : 0) + (longOrder ? sizeof(int)+sizeof(R_xlen_t) : 0))), (double)maxN);
+    }
+
+    #pragma omp parallel num_threads(nthm)
     {
-      R_xlen_t *counts = calloc((toBit/8 + 1)*256, sizeof(R_xlen_t));
-      // each thread has its own (small) stack of counts
-      // don't use VLAs here: perhaps too big for stack yes but more that VLAs apparently fail with schedule(dynamic)
-      
-      double *working=NULL;
-      // the working memory (for the largest groups) is allocated the first time the thread is assigned to
-      // an iteration.
-     
-      #pragma omp for schedule(dynamic,1)    
-      // All we assume here is that a thread can never be assigned to an earlier iteration; i.e. threads 0:(nth-1)
-      // get iterations 0:(nth-1) possibly out of order, then first-come-first-served in order after that.
-      // If a thread deals with an msb lower than the first one it dealt with, then its *working will be too small.
+      const int me = omp_get_thread_num();
+      R_xlen_t *counts = tcounts + me*ncounts;
+      unsigned long long *working = tworking + me*maxN;
+      int *oworking = carry ? toworking + me*maxN : NULL, *lidx = longOrder ? tlidx + me*maxN : NULL;
+      R_xlen_t *lworking = longOrder ? tlworking + me*maxN : NULL;
+
+      #pragma omp for schedule(dynamic,1)
       for (int msb=0; msb<MSBsize; msb++) {
-      
+
         R_xlen_t from= msbFrom[order[msb]];
         R_xlen_t thisN = msbCounts[order[msb]];
-        
-        if (working==NULL) working = malloc(thisN * sizeof(double)); // TODO: check succeeded otherwise exit gracefully 
-        // Depends on msbCounts being sorted largest first before this parallel loop
-        // Could be significant RAM saving if the largest msb is
-        // a lot larger than the 2nd largest msb, especially as nth grows to perhaps 128 on X1.
-        // However, the initial split is so large (16bits => 65,536) that the largest MSB should be
-        // relatively small anyway (n/65,536 if uniformly distributed).
-        // For msb>=nth, that thread's *working will already be big
-        // enough because the smallest *working (for thread nth-1) is big enough for all iterations following.
-        // Progressively, less and less of the working will be needed by the thread (just the first thisN will be
-        // used) and the unused pages will simply not be cached.
-        // TODO: Calloc isn't thread-safe. But this deep malloc should be ok here as no possible error() points
-        //       before free. Just need to add the check and exit thread safely somehow.
+
+        if (longOrder) for (int i=0; i<thisN; i++) lidx[i] = i;
+        int *thisO = longOrder ? lidx : (carry ? oans+from : NULL);
+        // Only the first thisN of the working memory is used; as the msbs get smaller the unused pages of a thread's
+        // working memory will simply not be cached.
 
         if (thisN <= INSERT_THRESH) {
-          dinsert(ans+from, thisN);
+          kinsert(kans+from, thisO, thisN);
         } else {
-          dradix_r(ans+from, working, thisN, fromBit, toBit, counts);
+          kradix_r(kans+from, thisO, working, oworking, thisN, fromBit, toBit, counts);
+        }
+        if (longOrder) {
+          for (int i=0; i<thisN; i++) lworking[i] = oansL[from+lidx[i]];
+          memcpy(oansL+from, lworking, thisN*sizeof(R_xlen_t));
         }
       }
-      free(counts);
-      free(working);
     }
+    free(tcounts); free(tworking); free(toworking); free(tlidx); free(tlworking);
     free(msbFrom);
     free(order);
   }
-  
+
   free(counts);
-  
+
   // TODO: parallel sweep to check sorted using <= on original input. Feasible that twiddling messed up.
   //       After a few years of heavy use remove this check for speed, and move into unit tests.
   //       It's a perfectly contiguous and cache efficient parallel scan so should be relatively negligible.
-  
+
+  SEXP ansVec;
+  if (retOrder && longOrder) {
+    ansVec = PROTECT(allocVector(REALSXP, n));  // positions beyond INT_MAX; R indexes long vectors by double
+    double *ans = REAL(ansVec);
+    #pragma omp parallel for num_threads(nth)
+    for (R_xlen_t i=0; i<n; i++) ans[i] = (double)(oansL[i]+1);
+  } else if (retOrder) {
+    ansVec = PROTECT(allocVector(INTSXP, n));
+    int *ans = INTEGER(ansVec);
+    #pragma omp parallel for num_threads(nth)
+    for (R_xlen_t i=0; i<n; i++) ans[i] = oans[i]+1;
+  } else {
+    ansVec = PROTECT(allocVector(TYPEOF(x), n));
+    switch(TYPEOF(x)) {
+    case REALSXP : {
+      double *ans = REAL(ansVec);
+      if (isI64) {
+        long long *ll = (long long *)ans;
+        #pragma omp parallel for num_threads(nth)
+        for (R_xlen_t i=0; i<n; i++) {
+          ll[i] = (long long)((kans[i]+min) ^ 0x8000000000000000);
+          if (decreasing && ll[i]!=NAINT64) ll[i] = -ll[i];
+        }
+      } else {
+        #pragma omp parallel for num_threads(nth)
+        for (R_xlen_t i=0; i<n; i++) {
+          ans[i] = dunkey(kans[i]+min);
+          if (decreasing && !ISNAN(ans[i])) ans[i] = -ans[i];
+        }
+      }
+    } break;
+    case INTSXP : case LGLSXP : {
+      int *ans = INTEGER(ansVec);
+      #pragma omp parallel for num_threads(nth)
+      for (R_xlen_t i=0; i<n; i++) {
+        ans[i] = (int)((unsigned int)(kans[i]+min) ^ 0x80000000);
+        if (decreasing && ans[i]!=NA_INTEGER) ans[i] = -ans[i];
+      }
+    } break;
+    case STRSXP : {
+      // via the order rather than the rank, so that the original CHARSXP (and its encoding) is returned
+      if (longOrder) for (R_xlen_t i=0; i<n; i++) SET_STRING_ELT(ansVec, i, STRING_ELT(x, oansL[i]));
+      else           for (R_xlen_t i=0; i<n; i++) SET_STRING_ELT(ansVec, i, STRING_ELT(x, oans[i]));
+    } break;
+    }
+    copyMostAttrib(x, ansVec);  // integer64, factor and Date remain so; names are dropped as base::sort
+  }
+  free(kans);
+  free(oans);
+  free(oansL);
+  forderStatsFsort(FALSE);
   UNPROTECT(1);
   return(ansVec);
 }
 
+SEXP ftopn(SEXP x, SEXP nArg, SEXP decreasingArg, SEXP retOrderArg)
+// The first n of fsort(x, decreasing, retOrder) without sorting all of x. One parallel pass histograms the most
+// significant 16 bits (as fsort's first pass) to find the MSB bucket containing the n-th item. Only the items in
+// that bucket or earlier are then gathered (keeping their original order so ties are stable) and sorted. That is
+// at most n plus the size of the boundary bucket, typically n + length(x)/65,536.
+{
+  if (!isInteger(nArg) || LENGTH(nArg)!=1 || INTEGER(nArg)[0]<0) error("n must be a single non-negative integer");
+  if (!isLogical(retOrderArg) || LENGTH(retOrderArg)!=1 || LOGICAL(retOrderArg)[0]==NA_LOGICAL)
+    error("retOrder must be TRUE or FALSE");
+  Rboolean retOrder = LOGICAL(retOrderArg)[0];
+  if (!isLogical(decreasingArg) || LENGTH(decreasingArg)!=1 || LOGICAL(decreasingArg)[0]==NA_LOGICAL)
+    error("decreasing must be TRUE or FALSE");
+  Rboolean decreasing = LOGICAL(decreasingArg)[0];
+  Rboolean isI64 = fsortType(x);
+  R_xlen_t n = xlength(x);
+  if (n>INT_MAX) error("ftopn of a long vector is not yet implemented");
+  int k = INTEGER(nArg)[0];
+  if (k>n) k=n;
+  if (k==0) return retOrder ? allocVector(INTSXP, 0) : allocVector(TYPEOF(x), 0);
+
+  int nth = getDTthreads();
+  int nBatch=nth*2;
+  R_xlen_t batchSize = (n-1)/nBatch + 1;
+  if (batchSize < 1024) batchSize = 1024;
+  nBatch = (n-1)/batchSize + 1;
+  R_xlen_t lastBatchSize = n - (nBatch-1)*batchSize;
+
+  SEXP *ustr = NULL;
+  int ustr_n = 0, nrank = 0;
+  if (TYPEOF(x)==STRSXP) {
+    savetl_init();
+    ustr_n = rankStrings(STRING_PTR(x), n, &ustr, &nrank);
+  }
+  unsigned long long *key = malloc(n * sizeof(unsigned long long));
+  if (key==NULL) {
+    if (ustr) { for (int i=0; i<ustr_n; i++) SET_TRUELENGTH(ustr[i],0); free(ustr); savetl_end(); }
+    error("Unable to allocate working memory for %d items in ftopn", (int)n);
+  }
+  unsigned long long mins[nBatch], maxs[nBatch];
+  #pragma omp parallel for schedule(dynamic) num_threads(nth)
+  for (int batch=0; batch<nBatch; batch++) {
+    R_xlen_t thisLen = (batch==nBatch-1) ? lastBatchSize : batchSize;
+    unsigned long long *kk = key + batchSize*batch;
+    batchKeys(x, isI64, decreasing, TRUE, nrank, batchSize*batch, thisLen, kk);
+    unsigned long long myMin=kk[0], myMax=kk[0];
+    for (R_xlen_t j=1; j<thisLen; j++) {
+      if (kk[j]<myMin) myMin=kk[j];
+      else if (kk[j]>myMax) myMax=kk[j];
+    }
+    mins[batch] = myMin;
+    maxs[batch] = myMax;
+  }
+  if (ustr) {
+    for (int i=0; i<ustr_n; i++) SET_TRUELENGTH(ustr[i],0);
+    free(ustr);
+    savetl_end();
+  }
+
+  int m = 0;                  // number of candidates gathered
+  unsigned long long *ck = NULL;
+  int *co = NULL;
+  unsigned long long min=mins[0], max=maxs[0];
+  for (int i=1; i<nBatch; i++) {
+    if (mins[i]<min) min=mins[i];
+    if (maxs[i]>max) max=maxs[i];
+  }
+  unsigned long long range = max-min;
+  int maxBit = 0;
+  while (maxBit<63 && range >> (maxBit+1)) maxBit++;
+  int MSBNbits = maxBit > 15 ? 16 : maxBit+1;
+  int shift = maxBit + 1 - MSBNbits;
+  int MSBsize = 1<<MSBNbits;
+
+  R_xlen_t *counts = calloc(nBatch*(size_t)MSBsize, sizeof(R_xlen_t));
+  if (counts==NULL) { free(key); error("Unable to allocate working memory"); }
+  #pragma omp parallel for num_threads(nth)
+  for (int batch=0; batch<nBatch; batch++) {
+    R_xlen_t thisLen = (batch==nBatch-1) ? lastBatchSize : batchSize;
+    const unsigned long long *kk = key + batchSize*(size_t)batch;
+    R_xlen_t *thisCounts = counts + batch*(size_t)MSBsize;
+    for (R_xlen_t j=0; j<thisLen; j++) thisCounts[(kk[j] - min) >> shift]++;
+  }
+  // find the msb bucket containing the k-th smallest key
+  R_xlen_t cumSum = 0;
+  int boundary = 0;
+  for (; boundary<MSBsize; boundary++) {
+    for (int batch=0; batch<nBatch; batch++) cumSum += counts[batch*(size_t)MSBsize + boundary];
+    if (cumSum >= k) break;
+  }
+  m = cumSum;
+  // count the candidates in each batch, then gather in parallel into their batch's offset, preserving original order
+  R_xlen_t offsets[nBatch];
+  for (int batch=0, cum=0; batch<nBatch; batch++) {
+    offsets[batch] = cum;
+    for (int msb=0; msb<=boundary; msb++) cum += counts[batch*(size_t)MSBsize + msb];
+  }
+  free(counts);
+  ck = malloc(m * sizeof(unsigned long long));
+  co = malloc(m * sizeof(int));
+  if (ck==NULL || co==NULL) { free(key); free(ck); free(co); error("Unable to allocate %d candidates in ftopn", m); }
+  unsigned long long limit = ((unsigned long long)boundary+1) << shift;   // keys-min below this are candidates
+  #pragma omp parallel for num_threads(nth)
+  for (int batch=0; batch<nBatch; batch++) {
+    R_xlen_t thisLen = (batch==nBatch-1) ? lastBatchSize : batchSize;
+    R_xlen_t from = batchSize*(size_t)batch;
+    R_xlen_t to = offsets[batch];
+    for (R_xlen_t j=0; j<thisLen; j++) {
+      unsigned long long kk = key[from+j] - min;
+      if (kk < limit || boundary==MSBsize-1) { ck[to] = kk; co[to++] = from+j; }
+    }
+  }
+  free(key);
+  if (m <= INSERT_THRESH) {
+    kinsert(ck, co, m);
+  } else {
+    unsigned long long *working = malloc(m * sizeof(unsigned long long));
+    int *oworking = malloc(m * sizeof(int));
+    R_xlen_t *kcounts = calloc((maxBit/8 + 1)*256, sizeof(R_xlen_t));
+    if (!working || !oworking || !kcounts) { free(working); free(oworking); free(kcounts); free(ck); free(co); error("Unable to allocate working memory in ftopn"); }
+    kradix_r(ck, co, working, oworking, m, maxBit>7 ? maxBit-7 : 0, maxBit, kcounts);
+    free(working); free(oworking); free(kcounts);
+  }
 
+  SEXP ans;
+  if (retOrder) {
+    ans = PROTECT(allocVector(INTSXP, k));
+    for (int i=0; i<k; i++) INTEGER(ans)[i] = co[i]+1;
+  } else {
+    ans = PROTECT(allocVector(TYPEOF(x), k));
+    switch(TYPEOF(x)) {
+    case REALSXP : for (int i=0; i<k; i++) REAL(ans)[i] = REAL(x)[co[i]]; break;
+    case INTSXP : case LGLSXP : for (int i=0; i<k; i++) INTEGER(ans)[i] = INTEGER(x)[co[i]]; break;
+    case STRSXP : for (int i=0; i<k; i++) SET_STRING_ELT(ans, i, STRING_ELT(x, co[i])); break;
+    }
+    copyMostAttrib(x, ans);
+  }
+  free(ck);
+  free(co);
+  UNPROTECT(1);
+  return ans;
+}
@@ -5,7 +5,7 @@ static int *grp = NULL;      // the group of each x item, like a factor
 static int ngrp = 0;         // number of groups
 static int *grpsize = NULL;  // size of each group, used by gmean (and gmedian) not gsum
 static int grpn = 0;         // length of underlying x == length(grp)
-static int *irows;           // GForce support for subsets in 'i' (TODO: joins in 'i')
+static int *irows;           // GForce support for subsets in 'i', and joins in 'i' with by=.EACHI
 static int irowslen = -1;    // -1 is for irows = NULL
 
 // for gmedian
@@ -13,8 +13,68 @@ static int maxgrpn = 0;
 static int *oo = NULL;
 static int *ff = NULL;
 static int isunsorted = 0;
-static union {double d;
-              long long ll;} u;
+
+// threads for the GForce kernels; 1 below getOption("datatable.gforce.threshold") rows. See gblocks() for how they split
+// the work, and ?datatable.optimize for when sums of double may then differ in the last bits
+static int gnth = 1;
+
+// getOption("datatable.summation") for gsum and gmean of double columns, see sumMode() in fastmean.c
+static int gsummode = SUM_LONG;
+
+// getOption("datatable.gforce.lowmem") : no grp and no per-thread accumulators, groups are read along f/o and summed
+// GWINDOW at a time
+static Rboolean glowmem = FALSE;
+#define GWINDOW 65536
+static int gfrom = 0, gto = 0;   // the groups held by the accumulators in gacc : all of them unless glowmem
+
+// working memory in use by the g* functions (not counting their answers) and its peak, for verbose
+static size_t gmemnow = 0, gmempeak = 0;
+static void gmemtake(size_t bytes) {
+    gmemnow += bytes;
+    if (gmemnow > gmempeak) gmempeak = gmemnow;
+}
+static void gmemgive(size_t bytes) {
+    gmemnow -= bytes;
+}
+
+// 1 : serial through grp. nb>1 (few groups) : nb blocks of rows, combined in block order. 0 (many groups, or no grp) :
+// each thread owns whole groups, visited in row order through growx(), so identical to serial
+static int gblocks() {
+    if (glowmem) return 0;
+    if (gnth == 1) return grp ? 1 : 0;
+    return ngrp < 4*gnth ? gnth : 0;
+}
+
+// the group holding row i (in grp space) when grp is NULL and groups are contiguous, by binary search on f
+static int gfind(int i) {
+    int lo = 0, hi = ngrp-1;
+    while (lo < hi) {
+        int mid = lo + (hi-lo+1)/2;
+        if (ff[mid]-1 <= i) lo = mid; else hi = mid-1;
+    }
+    return lo;
+}
+
+// first row (in grp space) of block b out of nb, for n rows
+#define BFROM(b, nb, n) ((int)((long long)(n)*(b)/(nb)))
+
+// dynamic chunk size for owned groups, ~16 chunks per thread to balance groups of very different sizes
+static int gchunk() {
+    int chunk = (gto-gfrom)/(16*gnth);
+    return chunk>1 ? chunk : 1;
+}
+
+// the number of groups in each window for gsum, gmean and gprod
+static int gwindow() {
+    return glowmem && ngrp > GWINDOW ? GWINDOW : ngrp;
+}
+
+// row of x holding item j (0-based) of group g
+static inline int growx(int g, int j) {
+    int k = ff[g]+j-1;
+    if (isunsorted) k = oo[k]-1;
+    return (irowslen == -1) ? k : irows[k]-1;
+}
 
 // from R's src/cov.c (for variance / sd)
 #ifdef HAVE_LONG_DOUBLE
@@ -23,7 +83,9 @@ static union {double d;
 # define SQRTL sqrt
 #endif
 
-SEXP gforce(SEXP env, SEXP jsub, SEXP o, SEXP f, SEXP l, SEXP irowsArg) {
+static SEXP gfuse(SEXP env, SEXP jsub);
+
+SEXP gforce(SEXP env, SEXP jsub, SEXP o, SEXP f, SEXP l, SEXP irowsArg, SEXP thresholdArg, SEXP summationArg, SEXP lowmemArg, SEXP verboseArg) {
     int i, j, g, *this;
     // clock_t start = clock();
     if (TYPEOF(env) != ENVSXP) error("env is not an environment");
@@ -32,38 +94,49 @@ SEXP gforce(SEXP env, SEXP jsub, SEXP o, SEXP f, SEXP l, SEXP irowsArg) {
     if (!isInteger(f)) error("f is not an integer vector");
     if (!isInteger(l)) error("l is not an integer vector");
     if (!isInteger(irowsArg) && !isNull(irowsArg)) error("irowsArg is not an integer vector");
+    if (!isNumeric(thresholdArg) || LENGTH(thresholdArg)!=1 || asInteger(thresholdArg)==NA_INTEGER) error("getOption('datatable.gforce.threshold') must be a single number");
+    if (!isLogical(lowmemArg) || LENGTH(lowmemArg)!=1 || LOGICAL(lowmemArg)[0]==NA_LOGICAL) error("getOption('datatable.gforce.lowmem') must be TRUE or FALSE");
+    if (!isLogical(verboseArg) || LENGTH(verboseArg)!=1 || LOGICAL(verboseArg)[0]==NA_LOGICAL) error("verbose must be TRUE or FALSE");
     ngrp = LENGTH(l);
     if (LENGTH(f) != ngrp) error("length(f)=%d != length(l)=%d", LENGTH(f), ngrp);
     grpn=0;
     grpsize = INTEGER(l);
     for (i=0; i<ngrp; i++) grpn+=grpsize[i];
     if (LENGTH(o) && LENGTH(o)!=grpn) error("o has length %d but sum(l)=%d", LENGTH(o), grpn);
-    
-    grp = (int *)R_alloc(grpn, sizeof(int));
-    // global grp because the g* functions (inside jsub) share this common memory
-    
-    if (LENGTH(o)) {
-        isunsorted = 1; // for gmedian
+    isunsorted = LENGTH(o) > 0; // for gmedian
+    glowmem = LOGICAL(lowmemArg)[0];
+    gmemnow = gmempeak = 0;
+
+    grp = NULL;
+    if (isunsorted && !glowmem) {
+        // when sorted each group is a contiguous range of rows and the kernels don't need grp, see gblocks()
+        grp = (int *)R_alloc(grpn, sizeof(int));
+        gmemtake((size_t)grpn*sizeof(int));
+        // global grp because the g* functions (inside jsub) share this common memory
         for (g=0; g<ngrp; g++) {
             this = INTEGER(o) + INTEGER(f)[g]-1;
             for (j=0; j<grpsize[g]; j++)  grp[ this[j]-1 ] = g;
         }
-    } else {
-        for (g=0; g<ngrp; g++) {
-            this = grp + INTEGER(f)[g]-1;
-            for (j=0; j<grpsize[g]; j++)  this[j] = g;
-        }
     }
     // for gmedian
     // initialise maxgrpn
-    maxgrpn = INTEGER(getAttrib(o, install("maxgrpn")))[0];
+    // forderv() sets it; otherwise (e.g. by=.EACHI) it's found from l
+    SEXP tt = getAttrib(o, install("maxgrpn"));
+    if (isNull(tt)) { maxgrpn = 0; for (g=0; g<ngrp; g++) if (grpsize[g]>maxgrpn) maxgrpn = grpsize[g]; }
+    else maxgrpn = INTEGER(tt)[0];
     oo = INTEGER(o);
     ff = INTEGER(f);
 
     irows = INTEGER(irowsArg);
     if (!isNull(irowsArg)) irowslen = length(irowsArg);
-    
-    SEXP ans = PROTECT( eval(jsub, env) );
+
+    gnth = grpn >= asInteger(thresholdArg) ? getDTthreads() : 1;
+    gsummode = sumMode(summationArg);
+    gfrom = 0; gto = ngrp;
+
+    // a list() of several g* calls is evaluated by gfuse, to scan each column once. Not with lowmem, as gfuse
+    // would hold the sums, products and so on of every group at once.
+    SEXP ans = PROTECT( !glowmem && isLanguage(jsub) && CAR(jsub)==install("list") ? gfuse(env, jsub) : eval(jsub, env) );
     // if this eval() fails with R error, R will release grp for us. Which is why we use R_alloc above.
     if (isVectorAtomic(ans)) {
       SEXP tt = ans;
@@ -71,13 +144,410 @@ SEXP gforce(SEXP env, SEXP jsub, SEXP o, SEXP f, SEXP l, SEXP irowsArg) {
       SET_VECTOR_ELT(ans, 0, tt);
       UNPROTECT(1);
     }
-    ngrp = 0; maxgrpn = 0; irowslen = -1; isunsorted = 0;
+    if (LOGICAL(verboseArg)[0])
+        Rprintf("\n  GForce%s working memory peak %.3fMB for %d groups of %d rows\n", glowmem ? " (lowmem)" : "", gmempeak/1048576.0, ngrp, grpn);
+    ngrp = 0; maxgrpn = 0; irowslen = -1; isunsorted = 0; gnth = 1; gsummode = SUM_LONG;
+    glowmem = FALSE; grp = NULL; gfrom = gto = 0;
 
     // Rprintf("gforce took %8.3f\n", 1.0*(clock()-start)/CLOCKS_PER_SEC);
     UNPROTECT(1);
     return(ans);
 }
 
+// := by group with GForce, e.g. DT[, total:=sum(v), by=g] : writes each group's value (or each row's, from gcum) to
+// the rows of its group, creating new columns like the := branch of dogroups()
+SEXP gassign(SEXP dt, SEXP lhs, SEXP newnames, SEXP jval, SEXP o, SEXP f, SEXP l, SEXP irowsArg) {
+    if (!isNewList(jval) || !LENGTH(jval)) error("Internal error: jval is not a non-empty list");
+    int n = LENGTH(l), *ll = INTEGER(l), *fl = INTEGER(f), nrow = 0;
+    for (int g=0; g<n; g++) nrow += ll[g];
+    const int *ol = LENGTH(o) ? INTEGER(o) : NULL, *il = isNull(irowsArg) ? NULL : INTEGER(irowsArg);
+    SEXP dtnames = getAttrib(dt, R_NamesSymbol);
+    R_len_t origncol = LENGTH(dt);
+    for (int j=0; j<length(lhs); j++) {
+        int col = INTEGER(lhs)[j]-1;
+        SEXP target = col<LENGTH(dt) ? VECTOR_ELT(dt, col) : R_NilValue;
+        SEXP RHS = VECTOR_ELT(jval, j%LENGTH(jval));
+        if (!isVectorAtomic(RHS) || (LENGTH(RHS)!=n && LENGTH(RHS)!=nrow)) error("Internal error: item %d of jval is not an atomic vector with one value for each of the %d groups or of their %d rows", j%LENGTH(jval)+1, n, nrow);
+        const Rboolean perrow = LENGTH(RHS)!=n;
+        if (isNull(target)) {
+            if (TRUELENGTH(dt) <= col) error("Internal error: Trying to add new column by reference but tl is full; alloc.col should have run first at R level before getting to this point in gassign");
+            target = PROTECT(allocNAVector(TYPEOF(RHS), LENGTH(VECTOR_ELT(dt,0))));
+            SETLENGTH(dtnames, LENGTH(dtnames)+1);
+            SETLENGTH(dt, LENGTH(dt)+1);
+            SET_VECTOR_ELT(dt, col, target);
+            UNPROTECT(1);
+            SET_STRING_ELT(dtnames, col, STRING_ELT(newnames, col-origncol));
+        }
+        if (TYPEOF(target)!=TYPEOF(RHS)) error("Type of RHS ('%s') must match LHS ('%s'). To check and coerce would impact performance too much for the fastest cases. Either change the type of the target column, or coerce the RHS of := yourself (e.g. by using 1L instead of 1)", type2char(TYPEOF(RHS)), type2char(TYPEOF(target)));
+        for (int g=0; g<n; g++) {
+            for (int k=fl[g]-1; k<fl[g]-1+ll[g]; k++) {
+                int r = ol ? ol[k]-1 : k, v = perrow ? k : g;
+                if (il) r = il[r]-1;
+                switch(TYPEOF(target)) {
+                case LGLSXP :
+                case INTSXP :
+                    INTEGER(target)[r] = INTEGER(RHS)[v];
+                    break;
+                case REALSXP :
+                    REAL(target)[r] = REAL(RHS)[v];
+                    break;
+                case CPLXSXP :
+                    COMPLEX(target)[r] = COMPLEX(RHS)[v];
+                    break;
+                case STRSXP :
+                    SET_STRING_ELT(target, r, STRING_ELT(RHS, v));
+                    break;
+                default :
+                    error("Type '%s' not supported by GForce :=", type2char(TYPEOF(target)));
+                }
+            }
+        }
+        copyMostAttrib(RHS, target);  // not names, as dogroups
+    }
+    return(dt);
+}
+
+// gmin and gmax update rules for integer and double columns. These don't depend on the order of the
+// rows, so applying them again to combine the block results (in block order) gives the serial answer.
+static inline int imin(int a, int v)     { return v < a ? v : a; }  // NA_INTEGER==INT_MIN always wins
+static inline int iminrm(int a, int v)   { return v != NA_INTEGER && (a == NA_INTEGER || v < a) ? v : a; }
+static inline int imax(int a, int v)     { return a != NA_INTEGER && (v == NA_INTEGER || v > a) ? v : a; }
+static inline int imaxrm(int a, int v)   { return v != NA_INTEGER && (a == NA_INTEGER || v > a) ? v : a; }
+static inline double dmin(double a, double v)   { return ISNAN(v) || v < a ? v : a; }
+static inline double dminrm(double a, double v) { return !ISNAN(v) && (ISNAN(a) || v < a) ? v : a; }
+// NA wins over NaN which wins over numbers, #1461
+static inline double dmax(double a, double v)   { return !ISNA(a) && (ISNA(v) || (ISNAN(v) && !ISNAN(a)) || v > a) ? v : a; }
+static inline double dmaxrm(double a, double v) { return !ISNAN(v) && (ISNAN(a) || v > a) ? v : a; }
+
+// Per-group accumulators filled by one scan of a column in gaccum(); NULL when not wanted. gfuse() asks for several
+typedef struct {
+    long double *s;   // sum, for gsum and gmean
+    int *c;           // count of non-NA, for gmean na.rm=TRUE
+    long double *p;   // product, for gprod
+    void *mn, *mx;    // int or double like x, for gmin and gmax
+} gacc;
+
+static void gacc_init(gacc *a, Rboolean isint, Rboolean rm) {
+    for (int g=0; g<gto-gfrom; g++) {
+        if (a->s) a->s[g] = 0;
+        if (a->c) a->c[g] = 0;
+        if (a->p) a->p[g] = 1.0;
+        if (isint) {
+            if (a->mn) ((int *)a->mn)[g] = rm ? NA_INTEGER : INT_MAX;
+            if (a->mx) ((int *)a->mx)[g] = rm ? NA_INTEGER : INT_MIN+1;  // groups are never empty, and INT_MIN+1 is the smallest non-NA integer
+        } else {
+            if (a->mn) ((double *)a->mn)[g] = rm ? NA_REAL : R_PosInf;
+            if (a->mx) ((double *)a->mx)[g] = rm ? NA_REAL : R_NegInf;
+        }
+    }
+}
+
+static inline void gacc_int(gacc *a, int g, int v, Rboolean rm) {
+    if (v == NA_INTEGER) {
+        if (!rm) {  // Let NA_REAL propogate from here. R_NaReal is IEEE.
+            if (a->s) a->s[g] = NA_REAL;
+            if (a->p) a->p[g] = NA_REAL;
+        }
+    } else {
+        if (a->s) a->s[g] += v;  // no under/overflow here, s is long double (like base)
+        if (a->c) a->c[g]++;
+        if (a->p) a->p[g] *= v;
+    }
+    if (a->mn) ((int *)a->mn)[g] = rm ? iminrm(((int *)a->mn)[g], v) : imin(((int *)a->mn)[g], v);
+    if (a->mx) ((int *)a->mx)[g] = rm ? imaxrm(((int *)a->mx)[g], v) : imax(((int *)a->mx)[g], v);
+}
+
+static inline void gacc_real(gacc *a, int g, double v, Rboolean rm) {
+    if (!rm || !ISNAN(v)) {  // else let NA_REAL propogate from here
+        if (a->s) a->s[g] += v;  // done in long double, like base
+        if (a->c && !ISNAN(v)) a->c[g]++;
+        if (a->p) a->p[g] *= v;
+    }
+    if (a->mn) ((double *)a->mn)[g] = rm ? dminrm(((double *)a->mn)[g], v) : dmin(((double *)a->mn)[g], v);
+    if (a->mx) ((double *)a->mx)[g] = rm ? dmaxrm(((double *)a->mx)[g], v) : dmax(((double *)a->mx)[g], v);
+}
+
+static void gacc_free(gacc *a) {
+    free(a->s); free(a->c); free(a->p); free(a->mn); free(a->mx);
+}
+
+// the bytes of the accumulators wanted in a, for n groups
+static size_t gacc_size(gacc *a, Rboolean isint, int n) {
+    size_t mmsize = isint ? sizeof(int) : sizeof(double);
+    return (size_t)n * ((a->s ? sizeof(long double) : 0) + (a->c ? sizeof(int) : 0) + (a->p ? sizeof(long double) : 0) +
+                        (a->mn ? mmsize : 0) + (a->mx ? mmsize : 0));
+}
+
+// the sum of x[from, to) as gacc_int and gacc_real accumulate it, in a tight loop for a group of sorted rows
+static inline long double gsumrange_int(const int *x, int from, int to, Rboolean rm) {
+    long double s = 0;
+    for (int k=from; k<to; k++) {
+        if (x[k] == NA_INTEGER) { if (!rm) return NA_REAL; continue; }
+        s += x[k];
+    }
+    return s;
+}
+
+static inline long double gsumrange_real(const double *x, int from, int to, Rboolean rm) {
+    long double s = 0;
+    if (rm) { for (int k=from; k<to; k++) if (!ISNAN(x[k])) s += x[k]; }
+    else    { for (int k=from; k<to; k++) s += x[k]; }
+    return s;
+}
+
+// Fill the accumulators wanted in a for groups gfrom to gto-1 (all of them unless glowmem), x logical, integer or double
+static void gaccum(SEXP x, Rboolean rm, gacc *a) {
+    int n = grpn, nb = gblocks();
+    Rboolean isint = TYPEOF(x) != REALSXP;
+    const int *xi = isint ? INTEGER(x) : NULL;
+    const double *xd = isint ? NULL : REAL(x);
+    gacc_init(a, isint, rm);
+    if (nb==0) {
+        const Rboolean contig = !isunsorted && irowslen == -1;  // each group is x[f-1, f-1+len)
+        const Rboolean sumonly = a->s && !a->c && !a->p && !a->mn && !a->mx;
+        #pragma omp parallel for num_threads(gnth) schedule(dynamic, gchunk())
+        for (int g=gfrom; g<gto; g++) {
+            if (contig) {
+                const int from = ff[g]-1, to = from+grpsize[g];
+                if (sumonly) a->s[g-gfrom] = isint ? gsumrange_int(xi, from, to, rm) : gsumrange_real(xd, from, to, rm);
+                else if (isint) for (int k=from; k<to; k++) gacc_int(a, g-gfrom, xi[k], rm);
+                else            for (int k=from; k<to; k++) gacc_real(a, g-gfrom, xd[k], rm);
+            } else {
+                if (isint) for (int j=0; j<grpsize[g]; j++) gacc_int(a, g-gfrom, xi[growx(g,j)], rm);
+                else       for (int j=0; j<grpsize[g]; j++) gacc_real(a, g-gfrom, xd[growx(g,j)], rm);
+            }
+        }
+        return;
+    }
+    gacc *ba = a;  // the accumulators of each block
+    size_t bsize = nb>1 ? nb*gacc_size(a, isint, ngrp) : 0;
+    if (nb>1) {
+        size_t mmsize = isint ? sizeof(int) : sizeof(double);
+        Rboolean ok = (ba = calloc(nb, sizeof(gacc))) != NULL;
+        for (int b=0; ok && b<nb; b++) {
+            if (a->s)  ok &= (ba[b].s  = malloc(ngrp*sizeof(long double))) != NULL;
+            if (a->c)  ok &= (ba[b].c  = malloc(ngrp*sizeof(int))) != NULL;
+            if (a->p)  ok &= (ba[b].p  = malloc(ngrp*sizeof(long double))) != NULL;
+            if (a->mn) ok &= (ba[b].mn = malloc(ngrp*mmsize)) != NULL;
+            if (a->mx) ok &= (ba[b].mx = malloc(ngrp*mmsize)) != NULL;
+        }
+        if (!ok) {
+            if (ba) { for (int b=0; b<nb; b++) gacc_free(ba+b); free(ba); }
+            error("Unable to allocate GForce accumulators for %d blocks of %d groups", nb, ngrp);
+        }
+        for (int b=0; b<nb; b++) gacc_init(ba+b, isint, rm);
+        gmemtake(bsize);
+    }
+    #pragma omp parallel for num_threads(nb)
+    for (int b=0; b<nb; b++) {
+        gacc *thisa = ba+b;
+        const int from = BFROM(b,nb,n), to = BFROM(b+1,nb,n);
+        int g = 0, gend = 0;  // without grp (sorted), the group of row i is followed as i goes by
+        if (!grp && from<to) { g = gfind(from); gend = ff[g]-1+grpsize[g]; }
+        for (int i=from; i<to; i++) {
+            if (grp) g = grp[i];
+            else while (i >= gend) { g++; gend = ff[g]-1+grpsize[g]; }
+            int ix = (irowslen == -1) ? i : irows[i]-1;
+            if (isint) gacc_int(thisa, g, xi[ix], rm);
+            else       gacc_real(thisa, g, xd[ix], rm);
+        }
+    }
+    if (nb>1) {
+        for (int b=0; b<nb; b++) {
+            gacc *thisa = ba+b;
+            for (int g=0; g<ngrp; g++) {
+                if (a->s) a->s[g] += thisa->s[g];
+                if (a->c) a->c[g] += thisa->c[g];
+                if (a->p) a->p[g] *= thisa->p[g];
+                if (isint) {
+                    if (a->mn) ((int *)a->mn)[g] = rm ? iminrm(((int *)a->mn)[g], ((int *)thisa->mn)[g]) : imin(((int *)a->mn)[g], ((int *)thisa->mn)[g]);
+                    if (a->mx) ((int *)a->mx)[g] = rm ? imaxrm(((int *)a->mx)[g], ((int *)thisa->mx)[g]) : imax(((int *)a->mx)[g], ((int *)thisa->mx)[g]);
+                } else {
+                    if (a->mn) ((double *)a->mn)[g] = rm ? dminrm(((double *)a->mn)[g], ((double *)thisa->mn)[g]) : dmin(((double *)a->mn)[g], ((double *)thisa->mn)[g]);
+                    if (a->mx) ((double *)a->mx)[g] = rm ? dmaxrm(((double *)a->mx)[g], ((double *)thisa->mx)[g]) : dmax(((double *)a->mx)[g], ((double *)thisa->mx)[g]);
+                }
+            }
+            gacc_free(thisa);
+        }
+        free(ba);
+        gmemgive(bsize);
+    }
+}
+
+static inline void neumaier(double *s, double *c, double v) {
+    double t = *s + v;
+    *c += fabs(*s) >= fabs(v) ? (*s - t) + v : (v - t) + *s;
+    *s = t;
+}
+
+// gsum and gmean of double when gsummode isn't SUM_LONG, as gaccum but in double; SUM_EXACT always lets threads own
+// whole groups since its result doesn't depend on the order
+static void gsumd(SEXP x, Rboolean rm, long double *s, int *c) {
+    const double *xd = REAL(x);
+    const Rboolean kahan = gsummode==SUM_KAHAN;
+    int n = grpn, nb = gsummode==SUM_EXACT ? 0 : gblocks();
+    if (nb==0) {
+        const Rboolean contig = !isunsorted && irowslen == -1;  // each group is x[f-1, f-1+len)
+        #pragma omp parallel for num_threads(gnth) schedule(dynamic, gchunk())
+        for (int g=gfrom; g<gto; g++) {
+            double ds = 0, dc = 0;
+            int cnt = 0;
+            xsum xs;
+            if (gsummode==SUM_EXACT) xsumInit(&xs);
+            for (int j=0; j<grpsize[g]; j++) {
+                double v = xd[contig ? ff[g]-1+j : growx(g,j)];
+                if (rm && ISNAN(v)) continue;
+                cnt++;
+                if (gsummode==SUM_EXACT) xsumAdd(&xs, v);
+                else if (kahan) neumaier(&ds, &dc, v);
+                else ds += v;
+            }
+            s[g-gfrom] = gsummode==SUM_EXACT ? xsumRound(&xs) : (R_FINITE(ds) ? ds + dc : ds);
+            if (c) c[g-gfrom] = cnt;
+        }
+        return;
+    }
+    // sums then compensations for each block, combined in block order as gaccum does
+    double *bs = calloc(2*(size_t)nb*ngrp, sizeof(double));
+    int *bc = c ? calloc((size_t)nb*ngrp, sizeof(int)) : NULL;
+    if (!bs || (c && !bc)) { free(bs); free(bc); error("Unable to allocate GForce accumulators for %d blocks of %d groups", nb, ngrp); }
+    size_t bsize = (size_t)nb*ngrp*(2*sizeof(double) + (c ? sizeof(int) : 0));
+    gmemtake(bsize);
+    #pragma omp parallel for num_threads(nb)
+    for (int b=0; b<nb; b++) {
+        double *ts = bs + 2*(size_t)b*ngrp, *tc = ts + ngrp;
+        int *tn = bc ? bc + (size_t)b*ngrp : NULL;
+        const int from = BFROM(b,nb,n), to = BFROM(b+1,nb,n);
+        int g = 0, gend = 0;  // as in gaccum
+        if (!grp && from<to) { g = gfind(from); gend = ff[g]-1+grpsize[g]; }
+        for (int i=from; i<to; i++) {
+            if (grp) g = grp[i];
+            else while (i >= gend) { g++; gend = ff[g]-1+grpsize[g]; }
+            double v = xd[(irowslen == -1) ? i : irows[i]-1];
+            if (rm && ISNAN(v)) continue;
+            if (kahan) neumaier(ts+g, tc+g, v);
+            else ts[g] += v;
+            if (tn) tn[g]++;
+        }
+    }
+    for (int g=0; g<ngrp; g++) {
+        double ds = bs[g], dc = bs[ngrp+g];
+        int cnt = bc ? bc[g] : 0;
+        for (int b=1; b<nb; b++) {
+            const double *ts = bs + 2*(size_t)b*ngrp;
+            if (kahan) { neumaier(&ds, &dc, ts[g]); dc += ts[ngrp+g]; }
+            else ds += ts[g];
+            if (bc) cnt += bc[(size_t)b*ngrp+g];
+        }
+        s[g] = R_FINITE(ds) ? ds + dc : ds;
+        if (c) c[g] = cnt;
+    }
+    free(bs); free(bc);
+    gmemgive(bsize);
+}
+
+// the sums (and counts of non-NA when c isn't NULL) for gsum and gmean, in gsummode
+static void gsums(SEXP x, Rboolean rm, long double *s, int *c) {
+    if (gsummode != SUM_LONG && TYPEOF(x) == REALSXP) gsumd(x, rm, s, c);
+    else {
+        gacc a = { .s = s, .c = c };
+        gaccum(x, rm, &a);
+    }
+}
+
+// The results from the accumulators for groups gfrom to gto-1 into ans; gsum_result returns a (unprotected) double
+// replacement when an integer sum overflows
+static SEXP gsum_result(SEXP x, SEXP ans, long double *s) {
+    for (int g=gfrom; g<gto; g++) {
+        long double v = s[g-gfrom];
+        if (TYPEOF(x) == REALSXP) {
+            if (v > DBL_MAX) REAL(ans)[g] = R_PosInf;
+            else if (v < -DBL_MAX) REAL(ans)[g] = R_NegInf;
+            else REAL(ans)[g] = (double)v;
+            continue;
+        }
+        if (TYPEOF(ans) == INTSXP) {
+            if (v > INT_MAX || v < INT_MIN) {
+                warning("Group %d summed to more than type 'integer' can hold so the result has been coerced to 'numeric' automatically, for convenience.", g+1);
+                ans = coerceVector(ans, REALSXP);  // the groups before g, and the rest are overwritten
+            } else {
+                INTEGER(ans)[g] = ISNA(v) ? NA_INTEGER : (int)v;
+                continue;
+            }
+        }
+        REAL(ans)[g] = (double)v;
+    }
+    return(ans);
+}
+
+// s is the sum with the same na.rm, c the count of non-NA (only needed for na.rm=TRUE). warned is set once an
+// integer sum has overflowed, to warn only once as gsum does.
+static void gmean_result(SEXP x, SEXP ans, Rboolean rm, long double *s, int *c, Rboolean *warned) {
+    double *ansd = REAL(ans);
+    for (int g=gfrom; g<gto; g++) {
+        long double v = s[g-gfrom];
+        if (!rm) {
+            if (TYPEOF(x) != REALSXP) {
+                if ((v > INT_MAX || v < INT_MIN) && !*warned) {
+                    warning("Group %d summed to more than type 'integer' can hold so the result has been coerced to 'numeric' automatically, for convenience.", g+1);
+                    *warned = TRUE;
+                }
+                ansd[g] = ISNA(v) ? NA_REAL : (double)v;
+            } else if (v > DBL_MAX) ansd[g] = R_PosInf;
+            else if (v < -DBL_MAX) ansd[g] = R_NegInf;
+            else ansd[g] = (double)v;
+            ansd[g] /= grpsize[g];  // let NA propogate
+            continue;
+        }
+        int cnt = c[g-gfrom];
+        if (cnt==0) { ansd[g] = R_NaN; continue; }  // NaN to follow base::mean
+        if (gsummode != SUM_LONG) { ansd[g] = (double)v / cnt; continue; }  // in double, for the same result everywhere
+        long double m = v / cnt;
+        if (m > DBL_MAX) ansd[g] = R_PosInf;
+        else if (m < -DBL_MAX) ansd[g] = R_NegInf;
+        else ansd[g] = (double)m;
+    }
+}
+
+static void gprod_result(SEXP ans, long double *p) {
+    for (int g=gfrom; g<gto; g++) {
+        long double v = p[g-gfrom];
+        if (v > DBL_MAX) REAL(ans)[g] = R_PosInf;
+        else if (v < -DBL_MAX) REAL(ans)[g] = R_NegInf;
+        else REAL(ans)[g] = (double)v;
+    }
+}
+
+// ans holds the accumulated min or max (and is protected by the caller); replaces the groups with no
+// non-missing values when na.rm=TRUE
+static SEXP gminmax_result(SEXP x, SEXP ans, Rboolean rm, Rboolean ismin) {
+    int i, protecti=0;
+    if (rm && TYPEOF(ans) == INTSXP) {
+        for (i=0; i<ngrp; i++) {
+            if (INTEGER(ans)[i] == NA_INTEGER) {
+                warning("No non-missing values found in at least one group. Coercing to numeric type and returning 'Inf' for such groups to be consistent with base");
+                ans = PROTECT(coerceVector(ans, REALSXP)); protecti++;
+                for (i=0; i<ngrp; i++) {
+                    if (ISNA(REAL(ans)[i])) REAL(ans)[i] = ismin ? R_PosInf : R_NegInf;
+                }
+                break;
+            }
+        }
+    } else if (rm && TYPEOF(ans) == REALSXP) {
+        for (i=0; i<ngrp; i++) {
+            if (ISNAN(REAL(ans)[i])) {
+                if (ismin) warning("No non-missing values found in at least one group. Returning 'Inf' for such groups to be consistent with base");
+                else warning("No non-missing values found in at least one group. Returning '-Inf' for such groups to be consistent with base");
+                for (; i<ngrp; i++) if (ISNAN(REAL(ans)[i])) REAL(ans)[i] = ismin ? R_PosInf : R_NegInf;
+                break;
+            }
+        }
+    }
+    copyMostAttrib(x, ans); // all but names,dim and dimnames. And if so, we want a copy here, not keepattr's SET_ATTRIB.
+    UNPROTECT(protecti);
+    return(ans);
+}
+
 // long double usage here results in test 648 being failed when running with valgrind
 // http://valgrind.org/docs/manual/manual-core.html#manual-core.limits
 SEXP gsum(SEXP x, SEXP narm)
@@ -85,59 +555,26 @@ SEXP gsum(SEXP x, SEXP narm)
     if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
     if (!isVectorAtomic(x)) error("GForce sum can only be applied to columns, not .SD or similar. To sum all items in a list such as .SD, either add the prefix base::sum(.SD) or turn off GForce optimization using options(datatable.optimize=1). More likely, you may be looking for 'DT[,lapply(.SD,sum),by=,.SDcols=]'");
     if (inherits(x, "factor")) error("sum is not meaningful for factors.");
-    int i, ix, thisgrp;
     int n = (irowslen == -1) ? length(x) : irowslen;
     //clock_t start = clock();
-    SEXP ans;
     if (grpn != n) error("grpn [%d] != length(x) [%d] in gsum", grpn, n);
-    long double *s = malloc(ngrp * sizeof(long double));
-    if (!s) error("Unable to allocate %d * %d bytes for gsum", ngrp, sizeof(long double));
-    memset(s, 0, ngrp * sizeof(long double)); // all-0 bits == (long double)0, checked in init.c
-    switch(TYPEOF(x)) {
-    case LGLSXP: case INTSXP:
-        for (i=0; i<n; i++) {
-            thisgrp = grp[i];
-            ix = (irowslen == -1) ? i : irows[i]-1;
-            if(INTEGER(x)[ix] == NA_INTEGER) { 
-                if (!LOGICAL(narm)[0]) s[thisgrp] = NA_REAL;  // Let NA_REAL propogate from here. R_NaReal is IEEE.
-                continue;
-            }
-            s[thisgrp] += INTEGER(x)[ix];  // no under/overflow here, s is long double (like base)
-        }
-        ans = PROTECT(allocVector(INTSXP, ngrp));
-        for (i=0; i<ngrp; i++) {
-            if (s[i] > INT_MAX || s[i] < INT_MIN) {
-                warning("Group %d summed to more than type 'integer' can hold so the result has been coerced to 'numeric' automatically, for convenience.", i+1);
-                UNPROTECT(1);
-                ans = PROTECT(allocVector(REALSXP, ngrp));
-                for (i=0; i<ngrp; i++) REAL(ans)[i] = (double)s[i];
-                break;
-            } else if (ISNA(s[i])) {
-                INTEGER(ans)[i] = NA_INTEGER;
-            } else {
-                INTEGER(ans)[i] = (int)s[i]; 
-            }
-        }
-        break;
-    case REALSXP:
-        ans = PROTECT(allocVector(REALSXP, ngrp));
-        for (i=0; i<n; i++) {
-            thisgrp = grp[i];
-            ix = (irowslen == -1) ? i : irows[i]-1;
-            if(ISNAN(REAL(x)[ix]) && LOGICAL(narm)[0]) continue;  // else let NA_REAL propogate from here
-            s[thisgrp] += REAL(x)[ix];  // done in long double, like base
-        }
-        for (i=0; i<ngrp; i++) {
-            if (s[i] > DBL_MAX) REAL(ans)[i] = R_PosInf;
-            else if (s[i] < -DBL_MAX) REAL(ans)[i] = R_NegInf;
-            else REAL(ans)[i] = (double)s[i];
-        }
-        break;
-    default:
-        free(s);
+    if (TYPEOF(x)!=LGLSXP && TYPEOF(x)!=INTSXP && TYPEOF(x)!=REALSXP)
         error("Type '%s' not supported by GForce sum (gsum). Either add the prefix base::sum(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)));
+    int w = gwindow();
+    long double *s = malloc(w * sizeof(long double));
+    if (!s) error("Unable to allocate %d * %d bytes for gsum", w, sizeof(long double));
+    gmemtake(w * sizeof(long double));
+    SEXP ans;
+    PROTECT_INDEX ipx;
+    PROTECT_WITH_INDEX(ans = allocVector(TYPEOF(x) == REALSXP ? REALSXP : INTSXP, ngrp), &ipx);
+    for (gfrom=0; gfrom<ngrp; gfrom=gto) {
+        gto = MIN(gfrom+w, ngrp);
+        gsums(x, LOGICAL(narm)[0], s, NULL);
+        REPROTECT(ans = gsum_result(x, ans, s), ipx);
     }
+    gfrom = 0; gto = ngrp;
     free(s);
+    gmemgive(w * sizeof(long double));
     copyMostAttrib(x, ans);
     UNPROTECT(1);
     // Rprintf("this gsum took %8.3f\n", 1.0*(clock()-start)/CLOCKS_PER_SEC);
@@ -146,182 +583,86 @@ SEXP gsum(SEXP x, SEXP narm)
 
 SEXP gmean(SEXP x, SEXP narm)
 {
-    SEXP ans;
-    int i, ix, protecti=0, thisgrp, n;
     //clock_t start = clock();
     if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
     if (!isVectorAtomic(x)) error("GForce mean can only be applied to columns, not .SD or similar. Likely you're looking for 'DT[,lapply(.SD,mean),by=,.SDcols=]'. See ?data.table.");
     if (inherits(x, "factor")) error("mean is not meaningful for factors.");
-    if (!LOGICAL(narm)[0]) {
-        ans = PROTECT(gsum(x,narm)); protecti++;
-        switch(TYPEOF(ans)) {
-        case LGLSXP: case INTSXP:
-            ans = PROTECT(coerceVector(ans, REALSXP)); protecti++;
-        case REALSXP:
-            for (i=0; i<ngrp; i++) REAL(ans)[i] /= grpsize[i];  // let NA propogate
-            break;
-        default :
-            error("Internal error: gsum returned type '%s'. typeof(x) is '%s'", type2char(TYPEOF(ans)), type2char(TYPEOF(x)));
-        }
-        UNPROTECT(protecti);
-        return(ans);
-    }
-    // na.rm=TRUE.  Similar to gsum, but we need to count the non-NA as well for the divisor
-    n = (irowslen == -1) ? length(x) : irowslen;
-    if (grpn != n) error("grpn [%d] != length(x) [%d] in gsum", grpn, n);
-
-    long double *s = malloc(ngrp * sizeof(long double));
-    if (!s) error("Unable to allocate %d * %d bytes for sum in gmean na.rm=TRUE", ngrp, sizeof(long double));
-    memset(s, 0, ngrp * sizeof(long double)); // all-0 bits == (long double)0, checked in init.c
-
-    int *c = malloc(ngrp * sizeof(int));
-    if (!c) error("Unable to allocate %d * %d bytes for counts in gmean na.rm=TRUE", ngrp, sizeof(int));
-    memset(c, 0, ngrp * sizeof(int)); // all-0 bits == (int)0, checked in init.c
-        
-    switch(TYPEOF(x)) {
-    case LGLSXP: case INTSXP:
-        for (i=0; i<n; i++) {
-            thisgrp = grp[i];
-            ix = (irowslen == -1) ? i : irows[i]-1;
-            if(INTEGER(x)[ix] == NA_INTEGER) continue;
-            s[thisgrp] += INTEGER(x)[ix];  // no under/overflow here, s is long double
-            c[thisgrp]++;
-        }
-        break;
-    case REALSXP:
-        for (i=0; i<n; i++) {
-            thisgrp = grp[i];
-            ix = (irowslen == -1) ? i : irows[i]-1;
-            if (ISNAN(REAL(x)[ix])) continue;
-            s[thisgrp] += REAL(x)[ix];
-            c[thisgrp]++;
-        }
-        break;
-    default:
-        free(s); free(c);
-        error("Type '%s' not supported by GForce mean (gmean) na.rm=TRUE. Either add the prefix base::mean(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)));
-    }
-    ans = PROTECT(allocVector(REALSXP, ngrp));
-    for (i=0; i<ngrp; i++) {
-        if (c[i]==0) { REAL(ans)[i] = R_NaN; continue; }  // NaN to follow base::mean
-        s[i] /= c[i]; 
-        if (s[i] > DBL_MAX) REAL(ans)[i] = R_PosInf;
-        else if (s[i] < -DBL_MAX) REAL(ans)[i] = R_NegInf;
-        else REAL(ans)[i] = (double)s[i];
+    int n = (irowslen == -1) ? length(x) : irowslen;
+    if (grpn != n) error("grpn [%d] != length(x) [%d] in gmean", grpn, n);
+    if (TYPEOF(x)!=LGLSXP && TYPEOF(x)!=INTSXP && TYPEOF(x)!=REALSXP)
+        error("Type '%s' not supported by GForce mean (gmean). Either add the prefix base::mean(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)));
+    // na.rm=TRUE needs the count of non-NA as well for the divisor
+    Rboolean rm = LOGICAL(narm)[0];
+    int w = gwindow();
+    long double *s = malloc(w * sizeof(long double));
+    int *c = rm ? malloc(w * sizeof(int)) : NULL;
+    if (!s || (rm && !c)) { free(s); free(c); error("Unable to allocate %d * %d bytes for gmean", w, sizeof(long double)+sizeof(int)); }
+    size_t bytes = w * (sizeof(long double) + (rm ? sizeof(int) : 0));
+    gmemtake(bytes);
+    SEXP ans = PROTECT(allocVector(REALSXP, ngrp));
+    Rboolean warned = FALSE;
+    for (gfrom=0; gfrom<ngrp; gfrom=gto) {
+        gto = MIN(gfrom+w, ngrp);
+        gsums(x, rm, s, c);
+        gmean_result(x, ans, rm, s, c, &warned);
     }
+    gfrom = 0; gto = ngrp;
     free(s); free(c);
+    gmemgive(bytes);
     copyMostAttrib(x, ans);
     UNPROTECT(1);
-    // Rprintf("this gmean na.rm=TRUE took %8.3f\n", 1.0*(clock()-start)/CLOCKS_PER_SEC);
+    // Rprintf("this gmean took %8.3f\n", 1.0*(clock()-start)/CLOCKS_PER_SEC);
     return(ans);
 }
 
+// gmin and gmax of a character column : NA for a group with an NA unless rm, and NA with a warning when rm leaves none
+static SEXP gminmax_str(SEXP x, Rboolean rm, Rboolean ismin) {
+    int n = (irowslen == -1) ? length(x) : irowslen;
+    SEXP ans = PROTECT(allocVector(STRSXP, ngrp));
+    SEXP *m = (SEXP *)R_alloc(ngrp, sizeof(SEXP));  // NULL until the group's first value; NA_STRING sticks unless rm
+    gmemtake(ngrp*sizeof(SEXP));
+    for (int g=0; g<ngrp; g++) m[g] = NULL;
+    #define GSTRUPD(g, v) \
+        if ((v) == NA_STRING) { if (!rm) m[g] = NA_STRING; } \
+        else if (m[g] == NULL || (m[g] != NA_STRING && (ismin ? strcmp(CHAR(v), CHAR(m[g])) < 0 : strcmp(CHAR(v), CHAR(m[g])) > 0))) m[g] = (v);
+    if (grp) {
+        for (int i=0; i<n; i++) { SEXP v = STRING_ELT(x, (irowslen == -1) ? i : irows[i]-1); GSTRUPD(grp[i], v) }
+    } else {
+        for (int g=0; g<ngrp; g++) for (int j=0; j<grpsize[g]; j++) { SEXP v = STRING_ELT(x, growx(g,j)); GSTRUPD(g, v) }
+    }
+    #undef GSTRUPD
+    Rboolean anyempty = FALSE;
+    for (int g=0; g<ngrp; g++) {
+        SET_STRING_ELT(ans, g, m[g] ? m[g] : NA_STRING);
+        anyempty |= m[g] == NULL;
+    }
+    gmemgive(ngrp*sizeof(SEXP));
+    if (rm && anyempty) warning("No non-missing values found in at least one group. Returning 'NA' for such groups to be consistent with base");
+    UNPROTECT(1);
+    return ans;
+}
+
 // gmin
 SEXP gmin(SEXP x, SEXP narm)
 {
     if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
     if (!isVectorAtomic(x)) error("GForce min can only be applied to columns, not .SD or similar. To find min of all items in a list such as .SD, either add the prefix base::min(.SD) or turn off GForce optimization using options(datatable.optimize=1). More likely, you may be looking for 'DT[,lapply(.SD,min),by=,.SDcols=]'");
     if (inherits(x, "factor")) error("min is not meaningful for factors.");
-    R_len_t i, ix, thisgrp=0;
     int n = (irowslen == -1) ? length(x) : irowslen;
     //clock_t start = clock();
     SEXP ans;
+    gacc a = { NULL };
     if (grpn != n) error("grpn [%d] != length(x) [%d] in gmin", grpn, n);
     switch(TYPEOF(x)) {
-    case LGLSXP: case INTSXP:
-        ans = PROTECT(allocVector(INTSXP, ngrp));
-        if (!LOGICAL(narm)[0]) {
-            for (i=0; i<ngrp; i++) INTEGER(ans)[i] = INT_MAX;
-            for (i=0; i<n; i++) {
-                thisgrp = grp[i];
-                ix = (irowslen == -1) ? i : irows[i]-1;
-                if (INTEGER(x)[ix] < INTEGER(ans)[thisgrp])   // NA_INTEGER==INT_MIN checked in init.c
-                    INTEGER(ans)[thisgrp] = INTEGER(x)[ix];
-            }
-        } else {
-            for (i=0; i<ngrp; i++) INTEGER(ans)[i] = NA_INTEGER;
-            for (i=0; i<n; i++) {
-                thisgrp = grp[i];
-                ix = (irowslen == -1) ? i : irows[i]-1;
-                if (INTEGER(x)[ix] == NA_INTEGER) continue;
-                if (INTEGER(ans)[thisgrp] == NA_INTEGER || INTEGER(x)[ix] < INTEGER(ans)[thisgrp])
-                    INTEGER(ans)[thisgrp] = INTEGER(x)[ix];
-            }
-            for (i=0; i<ngrp; i++) {
-                if (INTEGER(ans)[i] == NA_INTEGER) {
-                    warning("No non-missing values found in at least one group. Coercing to numeric type and returning 'Inf' for such groups to be consistent with base");
-                    UNPROTECT(1);
-                    ans = PROTECT(coerceVector(ans, REALSXP));
-                    for (i=0; i<ngrp; i++) {
-                        if (ISNA(REAL(ans)[i])) REAL(ans)[i] = R_PosInf;
-                    }
-                    break;
-                }
-            }
-        }
-        break;
+    case LGLSXP: case INTSXP: case REALSXP:
+        ans = PROTECT(allocVector(TYPEOF(x)==REALSXP ? REALSXP : INTSXP, ngrp));
+        a.mn = DATAPTR(ans);
+        gaccum(x, LOGICAL(narm)[0], &a);
+        ans = gminmax_result(x, ans, LOGICAL(narm)[0], TRUE);
+        UNPROTECT(1);
+        return(ans);
     case STRSXP:
-        ans = PROTECT(allocVector(STRSXP, ngrp));
-        if (!LOGICAL(narm)[0]) {
-            for (i=0; i<ngrp; i++) SET_STRING_ELT(ans, i, R_BlankString);
-            for (i=0; i<n; i++) {
-                thisgrp = grp[i];
-                ix = (irowslen == -1) ? i : irows[i]-1;
-                if (STRING_ELT(x, ix) == NA_STRING) {
-                    SET_STRING_ELT(ans, thisgrp, NA_STRING);
-                } else {
-                    if (STRING_ELT(ans, thisgrp) == R_BlankString ||
-                        (STRING_ELT(ans, thisgrp) != NA_STRING && strcmp(CHAR(STRING_ELT(x, ix)), CHAR(STRING_ELT(ans, thisgrp))) < 0 )) {
-                        SET_STRING_ELT(ans, thisgrp, STRING_ELT(x, ix));
-                    }
-                }
-            }
-        } else {
-            for (i=0; i<ngrp; i++) SET_STRING_ELT(ans, i, NA_STRING);
-            for (i=0; i<n; i++) {
-                thisgrp = grp[i];
-                ix = (irowslen == -1) ? i : irows[i]-1;
-                if (STRING_ELT(x, ix) == NA_STRING) continue;
-                if (STRING_ELT(ans, thisgrp) == NA_STRING || 
-                    strcmp(CHAR(STRING_ELT(x, ix)), CHAR(STRING_ELT(ans, thisgrp))) < 0) {
-                    SET_STRING_ELT(ans, thisgrp, STRING_ELT(x, ix));
-                }
-            }
-            for (i=0; i<ngrp; i++) {
-                if (STRING_ELT(ans, i)==NA_STRING) {
-                    warning("No non-missing values found in at least one group. Returning 'NA' for such groups to be consistent with base");
-                    break;
-                }
-            }
-        }
-        break;
-    case REALSXP:
-        ans = PROTECT(allocVector(REALSXP, ngrp));
-        if (!LOGICAL(narm)[0]) {    
-            for (i=0; i<ngrp; i++) REAL(ans)[i] = R_PosInf;
-            for (i=0; i<n; i++) {
-                thisgrp = grp[i];
-                ix = (irowslen == -1) ? i : irows[i]-1;
-                if (ISNAN(REAL(x)[ix]) || REAL(x)[ix] < REAL(ans)[thisgrp])
-                    REAL(ans)[thisgrp] = REAL(x)[ix];
-            }
-        } else {
-            for (i=0; i<ngrp; i++) REAL(ans)[i] = NA_REAL;
-            for (i=0; i<n; i++) {
-                thisgrp = grp[i];
-                ix = (irowslen == -1) ? i : irows[i]-1;
-                if (ISNAN(REAL(x)[ix])) continue;
-                if (ISNAN(REAL(ans)[thisgrp]) || REAL(x)[ix] < REAL(ans)[thisgrp])
-                    REAL(ans)[thisgrp] = REAL(x)[ix];
-            }
-            for (i=0; i<ngrp; i++) {
-                if (ISNAN(REAL(ans)[i])) {
-                    warning("No non-missing values found in at least one group. Returning 'Inf' for such groups to be consistent with base");
-                    for (; i<ngrp; i++) if (ISNAN(REAL(ans)[i])) REAL(ans)[i] = R_PosInf;
-                    break;
-                }
-            }
-        }
+        ans = PROTECT(gminmax_str(x, LOGICAL(narm)[0], TRUE));
         break;
     default:
         error("Type '%s' not supported by GForce min (gmin). Either add the prefix base::min(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)));
@@ -338,134 +679,22 @@ SEXP gmax(SEXP x, SEXP narm)
     if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
     if (!isVectorAtomic(x)) error("GForce max can only be applied to columns, not .SD or similar. To find max of all items in a list such as .SD, either add the prefix base::max(.SD) or turn off GForce optimization using options(datatable.optimize=1). More likely, you may be looking for 'DT[,lapply(.SD,max),by=,.SDcols=]'");
     if (inherits(x, "factor")) error("max is not meaningful for factors.");
-    R_len_t i, ix, thisgrp=0;
     int n = (irowslen == -1) ? length(x) : irowslen;
     //clock_t start = clock();
     SEXP ans;
     if (grpn != n) error("grpn [%d] != length(x) [%d] in gmax", grpn, n);
-    
-    // TODO rework gmax in the same way as gmin and remove this *update
-    char *update = (char *)R_alloc(ngrp, sizeof(char));
-    for (int i=0; i<ngrp; i++) update[i] = 0;
-    
+    gacc a = { NULL };
+
     switch(TYPEOF(x)) {
-    case LGLSXP: case INTSXP:
-        ans = PROTECT(allocVector(INTSXP, ngrp));
-        for (i=0; i<ngrp; i++) INTEGER(ans)[i] = 0;
-        if (!LOGICAL(narm)[0]) { // simple case - deal in a straightforward manner first
-            for (i=0; i<n; i++) {
-                thisgrp = grp[i];
-                ix = (irowslen == -1) ? i : irows[i]-1;
-                if (INTEGER(x)[ix] != NA_INTEGER && INTEGER(ans)[thisgrp] != NA_INTEGER) {
-                    if ( update[thisgrp] != 1 || INTEGER(ans)[thisgrp] < INTEGER(x)[ix] ) {
-                        INTEGER(ans)[thisgrp] = INTEGER(x)[ix];
-                        if (update[thisgrp] != 1) update[thisgrp] = 1;
-                    }
-                } else  INTEGER(ans)[thisgrp] = NA_INTEGER;
-            }
-        } else {
-            for (i=0; i<n; i++) {
-                thisgrp = grp[i];
-                ix = (irowslen == -1) ? i : irows[i]-1;
-                if (INTEGER(x)[ix] != NA_INTEGER) {
-                    if ( update[thisgrp] != 1 || INTEGER(ans)[thisgrp] < INTEGER(x)[ix] ) {
-                        INTEGER(ans)[thisgrp] = INTEGER(x)[ix];
-                        if (update[thisgrp] != 1) update[thisgrp] = 1;
-                    }
-                } else {
-                    if (update[thisgrp] != 1) {
-                        INTEGER(ans)[thisgrp] = NA_INTEGER;
-                    }
-                }
-            }
-            for (i=0; i<ngrp; i++) {
-                if (update[i] != 1)  {// equivalent of INTEGER(ans)[thisgrp] == NA_INTEGER
-                    warning("No non-missing values found in at least one group. Coercing to numeric type and returning 'Inf' for such groups to be consistent with base");
-                    UNPROTECT(1);
-                    ans = PROTECT(coerceVector(ans, REALSXP));
-                    for (i=0; i<ngrp; i++) {
-                        if (update[i] != 1) REAL(ans)[i] = -R_PosInf;
-                    }
-                    break;
-                }
-            }
-        }
-        break;
+    case LGLSXP: case INTSXP: case REALSXP:
+        ans = PROTECT(allocVector(TYPEOF(x)==REALSXP ? REALSXP : INTSXP, ngrp));
+        a.mx = DATAPTR(ans);
+        gaccum(x, LOGICAL(narm)[0], &a);
+        ans = gminmax_result(x, ans, LOGICAL(narm)[0], FALSE);
+        UNPROTECT(1);
+        return(ans);
     case STRSXP:
-        ans = PROTECT(allocVector(STRSXP, ngrp));
-        for (i=0; i<ngrp; i++) SET_STRING_ELT(ans, i, mkChar(""));
-        if (!LOGICAL(narm)[0]) { // simple case - deal in a straightforward manner first
-            for (i=0; i<n; i++) {
-                thisgrp = grp[i];
-                ix = (irowslen == -1) ? i : irows[i]-1;
-                if (STRING_ELT(x,ix) != NA_STRING && STRING_ELT(ans, thisgrp) != NA_STRING) {
-                    if ( update[thisgrp] != 1 || strcmp(CHAR(STRING_ELT(ans, thisgrp)), CHAR(STRING_ELT(x,ix))) < 0 ) {
-                        SET_STRING_ELT(ans, thisgrp, STRING_ELT(x, ix));
-                        if (update[thisgrp] != 1) update[thisgrp] = 1;
-                    }
-                } else  SET_STRING_ELT(ans, thisgrp, NA_STRING);
-            }
-        } else {
-            for (i=0; i<n; i++) {
-                thisgrp = grp[i];
-                ix = (irowslen == -1) ? i : irows[i]-1;
-                if (STRING_ELT(x, ix) != NA_STRING) {
-                    if ( update[thisgrp] != 1 || strcmp(CHAR(STRING_ELT(ans, thisgrp)), CHAR(STRING_ELT(x, ix))) < 0 ) {
-                        SET_STRING_ELT(ans, thisgrp, STRING_ELT(x, ix));
-                        if (update[thisgrp] != 1) update[thisgrp] = 1;
-                    }
-                } else {
-                    if (update[thisgrp] != 1) {
-                        SET_STRING_ELT(ans, thisgrp, NA_STRING);
-                    }
-                }
-            }
-            for (i=0; i<ngrp; i++) {
-                if (update[i] != 1)  {// equivalent of INTEGER(ans)[thisgrp] == NA_INTEGER
-                    warning("No non-missing values found in at least one group. Returning 'NA' for such groups to be consistent with base");
-                    break;
-                }
-            }
-        }    
-        break;
-    case REALSXP:
-        ans = PROTECT(allocVector(REALSXP, ngrp));
-        for (i=0; i<ngrp; i++) REAL(ans)[i] = 0;
-        if (!LOGICAL(narm)[0]) {
-            for (i=0; i<n; i++) {
-                thisgrp = grp[i];
-                ix = (irowslen == -1) ? i : irows[i]-1;
-                if ( !ISNA(REAL(x)[ix]) && !ISNA(REAL(ans)[thisgrp]) ) {
-                    if ( update[thisgrp] != 1 || REAL(ans)[thisgrp] < REAL(x)[ix] || 
-                         (ISNAN(REAL(x)[ix]) && !ISNAN(REAL(ans)[thisgrp])) ) { // #1461
-                        REAL(ans)[thisgrp] = REAL(x)[ix];
-                        if (update[thisgrp] != 1) update[thisgrp] = 1;
-                    }
-                } else REAL(ans)[thisgrp] = NA_REAL;
-            }
-        } else {
-            for (i=0; i<n; i++) {
-                thisgrp = grp[i];
-                ix = (irowslen == -1) ? i : irows[i]-1;
-                if ( !ISNAN(REAL(x)[ix]) ) { // #1461
-                    if ( update[thisgrp] != 1 || REAL(ans)[thisgrp] < REAL(x)[ix] ) {
-                        REAL(ans)[thisgrp] = REAL(x)[ix];
-                        if (update[thisgrp] != 1) update[thisgrp] = 1;
-                    }
-                } else {
-                    if (update[thisgrp] != 1) {
-                        REAL(ans)[thisgrp] = -R_PosInf;
-                    }
-                }
-            }
-            // everything taken care of already. Just warn if all NA groups have occurred at least once
-            for (i=0; i<ngrp; i++) {
-                if (update[i] != 1)  { // equivalent of REAL(ans)[thisgrp] == -R_PosInf
-                    warning("No non-missing values found in at least one group. Returning '-Inf' for such groups to be consistent with base");
-                    break;
-                }
-            }
-        }
+        ans = PROTECT(gminmax_str(x, LOGICAL(narm)[0], FALSE));
         break;
     default:
         error("Type '%s' not supported by GForce max (gmax). Either add the prefix base::max(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)));
@@ -476,180 +705,6 @@ SEXP gmax(SEXP x, SEXP narm)
     return(ans);
 }
 
-// gmedian, always returns numeric type (to avoid as.numeric() wrap..)
-SEXP gmedian(SEXP x, SEXP narm) {
-
-    if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
-    if (!isVectorAtomic(x)) error("GForce median can only be applied to columns, not .SD or similar. To find median of all items in a list such as .SD, either add the prefix stats::median(.SD) or turn off GForce optimization using options(datatable.optimize=1). More likely, you may be looking for 'DT[,lapply(.SD,median),by=,.SDcols=]'");
-    if (inherits(x, "factor")) error("median is not meaningful for factors.");
-    R_len_t i=0, j=0, k=0, imed=0, thisgrpsize=0, medianindex=0, nacount=0;
-    double val = 0.0;
-    Rboolean isna = FALSE, isint64 = FALSE;
-    SEXP ans, sub, class;
-    void *ptr;
-    int n = (irowslen == -1) ? length(x) : irowslen;
-    if (grpn != n) error("grpn [%d] != length(x) [%d] in gmedian", grpn, n);
-    switch(TYPEOF(x)) {
-    case REALSXP:
-        class = getAttrib(x, R_ClassSymbol);
-        isint64 = (isString(class) && STRING_ELT(class, 0) == char_integer64);
-        ans = PROTECT(allocVector(REALSXP, ngrp));
-        sub = PROTECT(allocVector(REALSXP, maxgrpn)); // allocate once upfront
-        ptr = DATAPTR(sub);
-        if (!LOGICAL(narm)[0]) {
-            for (i=0; i<ngrp; i++) {
-                isna = FALSE;
-                thisgrpsize = grpsize[i];
-                SETLENGTH(sub, thisgrpsize);
-                for (j=0; j<thisgrpsize; j++) {
-                    k = ff[i]+j-1;
-                    if (isunsorted) k = oo[k]-1;
-                    k = (irowslen == -1) ? k : irows[k]-1;
-                    // TODO: raise this if-statement?
-                    if (!isint64) {
-                        if (!ISNAN(REAL(x)[k])) {
-                            REAL(sub)[j] = REAL(x)[k];
-                        } else {
-                            REAL(ans)[i] = NA_REAL;
-                            isna = TRUE; break;
-                        }
-                    } else {
-                        u.d = REAL(x)[k];
-                        if (u.ll != NAINT64) {
-                            REAL(sub)[j] = (double)u.ll;
-                        } else {
-                            REAL(ans)[i] = NA_REAL;
-                            isna = TRUE; break;
-                        }
-                    } 
-                }
-                if (isna) continue;
-                medianindex = (R_len_t)(ceil((double)(thisgrpsize)/2));
-                REAL(ans)[i] = dquickselect(ptr, thisgrpsize, medianindex-1); // 0-indexed
-                // all elements to the left of thisgrpsize/2 is < the value at that index
-                // we just need to get min of last half
-                if (thisgrpsize % 2 == 0) {
-                    val = REAL(sub)[medianindex]; // 0-indexed
-                    for (imed=medianindex+1; imed<thisgrpsize; imed++) {
-                        val = REAL(sub)[imed] > val ? val : REAL(sub)[imed];
-                    }
-                    REAL(ans)[i] = (REAL(ans)[i] + val)/2.0;
-                }
-            }
-        } else {
-            for (i=0; i<ngrp; i++) {
-                nacount = 0;
-                thisgrpsize = grpsize[i];
-                for (j=0; j<thisgrpsize; j++) {
-                    k = ff[i]+j-1;
-                    if (isunsorted) k = oo[k]-1;
-                    k = (irowslen == -1) ? k : irows[k]-1;
-                    // TODO: raise this if-statement?
-                    if (!isint64) {
-                        if (!ISNAN(REAL(x)[k])) {
-                            REAL(sub)[j-nacount] = REAL(x)[k];
-                        } else { nacount++; continue; }
-                    } else {
-                        u.d = REAL(x)[k];
-                        if (u.ll != NAINT64) {
-                            REAL(sub)[j-nacount] = (double)u.ll;
-                        } else { nacount++; continue; }
-                    }
-                }
-                if (nacount == thisgrpsize) {
-                    REAL(ans)[i] = NA_REAL; // all NAs
-                    continue;
-                }
-                thisgrpsize -= nacount;
-                SETLENGTH(sub, thisgrpsize);
-                medianindex = (R_len_t)(ceil((double)(thisgrpsize)/2));
-                REAL(ans)[i] = dquickselect(ptr, thisgrpsize, medianindex-1);
-                if (thisgrpsize % 2 == 0) {
-                    // all elements to the left of thisgrpsize/2 is < the value at that index
-                    // we just need to get min of last half
-                    val = REAL(sub)[medianindex]; // 0-indexed
-                    for (imed=medianindex+1; imed<thisgrpsize; imed++) {
-                        val = REAL(sub)[imed] > val ? val : REAL(sub)[imed];
-                    }
-                    REAL(ans)[i] = (REAL(ans)[i] + val)/2.0;
-                }
-            }            
-        }
-        SETLENGTH(sub, maxgrpn);
-        break;
-    case LGLSXP: case INTSXP: 
-        ans = PROTECT(allocVector(REALSXP, ngrp));
-        sub = PROTECT(allocVector(INTSXP, maxgrpn)); // allocate once upfront
-        ptr = DATAPTR(sub);
-        if (!LOGICAL(narm)[0]) {
-            for (i=0; i<ngrp; i++) {
-                isna = FALSE;
-                thisgrpsize = grpsize[i];
-                SETLENGTH(sub, thisgrpsize);
-                for (j=0; j<thisgrpsize; j++) {
-                    k = ff[i]+j-1;
-                    if (isunsorted) k = oo[k]-1;
-                    k = (irowslen == -1) ? k : irows[k]-1;
-                    if (INTEGER(x)[k] != NA_INTEGER) {
-                        INTEGER(sub)[j] = INTEGER(x)[k];
-                    } else {
-                        REAL(ans)[i] = NA_REAL;
-                        isna = TRUE; break;
-                    }
-                }
-                if (isna) continue;
-                medianindex = (R_len_t)(ceil((double)(thisgrpsize)/2));
-                REAL(ans)[i] = iquickselect(ptr, thisgrpsize, medianindex-1); // 0-indexed
-                // all elements to the left of thisgrpsize/2 is < the value at that index
-                // we just need to get min of last half
-                if (thisgrpsize % 2 == 0) {
-                    val = INTEGER(sub)[medianindex]; // 0-indexed
-                    for (imed=medianindex+1; imed<thisgrpsize; imed++) {
-                        val = INTEGER(sub)[imed] > val ? val : INTEGER(sub)[imed];
-                    }
-                    REAL(ans)[i] = (REAL(ans)[i] + val)/2.0;
-                }
-            }
-        } else {
-            for (i=0; i<ngrp; i++) {
-                nacount = 0;
-                thisgrpsize = grpsize[i];
-                for (j=0; j<thisgrpsize; j++) {
-                    k = ff[i]+j-1;
-                    if (isunsorted) k = oo[k]-1;
-                    k = (irowslen == -1) ? k : irows[k]-1;
-                    if (INTEGER(x)[k] != NA_INTEGER) {
-                        INTEGER(sub)[j-nacount] = INTEGER(x)[k];
-                    } else { nacount++; continue; }
-                }
-                if (nacount == thisgrpsize) {
-                    REAL(ans)[i] = NA_REAL; // all NAs
-                    continue;
-                }
-                thisgrpsize -= nacount;
-                SETLENGTH(sub, thisgrpsize);
-                medianindex = (R_len_t)(ceil((double)(thisgrpsize)/2));
-                REAL(ans)[i] = iquickselect(ptr, thisgrpsize, medianindex-1);
-                if (thisgrpsize % 2 == 0) {
-                    // all elements to the left of thisgrpsize/2 is < the value at that index
-                    // we just need to get min of last half
-                    val = INTEGER(sub)[medianindex]; // 0-indexed
-                    for (imed=medianindex+1; imed<thisgrpsize; imed++) {
-                        val = INTEGER(sub)[imed] > val ? val : INTEGER(sub)[imed];
-                    }
-                    REAL(ans)[i] = (REAL(ans)[i] + val)/2.0;
-                }
-            }            
-        }
-        SETLENGTH(sub, maxgrpn);
-        break;
-    default:
-        error("Type '%s' not supported by GForce median (gmedian). Either add the prefix stats::median(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)));
-    }
-    UNPROTECT(2);
-    return(ans);
-}
-
 SEXP glast(SEXP x) {
 
     if (!isVectorAtomic(x)) error("GForce tail can only be applied to columns, not .SD or similar. To get tail of all items in a list such as .SD, either add the prefix utils::tail(.SD) or turn off GForce optimization using options(datatable.optimize=1).");
@@ -857,122 +912,91 @@ SEXP gvarsd1(SEXP x, SEXP narm, Rboolean isSD)
     if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
     if (!isVectorAtomic(x)) error("GForce var/sd can only be applied to columns, not .SD or similar. To find var/sd of all items in a list such as .SD, either add the prefix stats::var(.SD) (or stats::sd(.SD)) or turn off GForce optimization using options(datatable.optimize=1). More likely, you may be looking for 'DT[,lapply(.SD,var),by=,.SDcols=]'");
     if (inherits(x, "factor")) error("var/sd is not meaningful for factors.");
-    long double m, s, v;
-    R_len_t i, j, ix, thisgrpsize = 0, n = (irowslen == -1) ? length(x) : irowslen;
+    R_len_t n = (irowslen == -1) ? length(x) : irowslen;
     if (grpn != n) error("grpn [%d] != length(x) [%d] in gvar", grpn, n);
-    SEXP sub, ans = PROTECT(allocVector(REALSXP, ngrp));
-    Rboolean ans_na;
+    SEXP ans = PROTECT(allocVector(REALSXP, ngrp));
+    double *ansd = REAL(ans);
+    const Rboolean rm = LOGICAL(narm)[0];
+    // Threads own whole groups, each gathering into its own maxgrpn buffer. So only go parallel when there
+    // are many groups, and use at most 1+grpn/maxgrpn threads so that the buffers stay within 2*grpn.
+    int nth = gblocks() ? 1 : MIN(gnth, 1+grpn/(maxgrpn>0 ? maxgrpn : 1));
     switch(TYPEOF(x)) {
-        case LGLSXP: case INTSXP:
-        sub = PROTECT(allocVector(INTSXP, maxgrpn)); // allocate once upfront
-        if (!LOGICAL(narm)[0]) {
-            for (i=0; i<ngrp; i++) {
-                m=0.; s=0.; v=0.; ans_na = FALSE;
-                if (grpsize[i] != 1) {
-                    thisgrpsize = grpsize[i];
-                    SETLENGTH(sub, thisgrpsize); // to gather this group's data
-                    for (j=0; j<thisgrpsize; j++) {
-                        ix = ff[i]+j-1;
-                        if (isunsorted) ix = oo[ix]-1;
-                        ix = (irowslen == -1) ? ix : irows[ix]-1;
-                        if (INTEGER(x)[ix] == NA_INTEGER) { ans_na = TRUE; break; }
-                        INTEGER(sub)[j] = INTEGER(x)[ix];
-                        m += INTEGER(sub)[j]; // sum
-                    }
-                    if (ans_na) { REAL(ans)[i] = NA_REAL; continue; }
-                    m = m/thisgrpsize; // mean, first pass
-                    for (j=0; j<thisgrpsize; j++) s += (INTEGER(sub)[j]-m); // residuals
-                    m += (s/thisgrpsize); // mean, second pass
-                    for (j=0; j<thisgrpsize; j++) { // variance
-                        v += (INTEGER(sub)[j]-(double)m) * (INTEGER(sub)[j]-(double)m);
-                    }
-                    REAL(ans)[i] = (double)v/(thisgrpsize-1);
-                    if (isSD) REAL(ans)[i] = SQRTL(REAL(ans)[i]);
-                } else REAL(ans)[i] = NA_REAL;
-            }
-        } else {
-            for (i=0; i<ngrp; i++) {
-                m=0.; s=0.; v=0.; thisgrpsize = 0;
-                if (grpsize[i] != 1) {
-                    SETLENGTH(sub, grpsize[i]); // to gather this group's data
-                    for (j=0; j<grpsize[i]; j++) {
-                        ix = ff[i]+j-1;
-                        if (isunsorted) ix = oo[ix]-1;
-                        ix = (irowslen == -1) ? ix : irows[ix]-1;
-                        if (INTEGER(x)[ix] == NA_INTEGER) continue;
-                        INTEGER(sub)[thisgrpsize] = INTEGER(x)[ix];
-                        m += INTEGER(sub)[thisgrpsize]; // sum
-                        thisgrpsize++;
+        case LGLSXP: case INTSXP: {
+        const int *xd = INTEGER(x);
+        int *buf = malloc((size_t)nth*maxgrpn*sizeof(int)); // allocate once upfront
+        if (!buf && maxgrpn) error("Unable to allocate %d * %d * %d bytes for gvar", nth, maxgrpn, sizeof(int));
+        gmemtake((size_t)nth*maxgrpn*sizeof(int));
+        #pragma omp parallel num_threads(nth)
+        {
+            int *sub = buf + (size_t)omp_get_thread_num()*maxgrpn;
+            #pragma omp for schedule(dynamic, gchunk())
+            for (int i=0; i<ngrp; i++) {
+                long double m=0., s=0., v=0.;
+                int thisgrpsize = 0;
+                Rboolean ans_na = FALSE;
+                if (grpsize[i] == 1) { ansd[i] = NA_REAL; continue; }
+                for (int j=0; j<grpsize[i]; j++) {  // gather this group's data
+                    int xj = xd[growx(i,j)];
+                    if (xj == NA_INTEGER) {
+                        if (rm) continue;
+                        ans_na = TRUE; break;
                     }
-                    if (thisgrpsize <= 1) { REAL(ans)[i] = NA_REAL; continue; }
-                    m = m/thisgrpsize; // mean, first pass
-                    for (j=0; j<thisgrpsize; j++) s += (INTEGER(sub)[j]-m); // residuals
-                    m += (s/thisgrpsize); // mean, second pass
-                    for (j=0; j<thisgrpsize; j++) { // variance
-                        v += (INTEGER(sub)[j]-(double)m) * (INTEGER(sub)[j]-(double)m);
-                    }
-                    REAL(ans)[i] = (double)v/(thisgrpsize-1);
-                    if (isSD) REAL(ans)[i] = SQRTL(REAL(ans)[i]);
-                } else REAL(ans)[i] = NA_REAL;
+                    sub[thisgrpsize] = xj;
+                    m += sub[thisgrpsize]; // sum
+                    thisgrpsize++;
+                }
+                if (ans_na || thisgrpsize <= 1) { ansd[i] = NA_REAL; continue; }
+                m = m/thisgrpsize; // mean, first pass
+                for (int j=0; j<thisgrpsize; j++) s += (sub[j]-m); // residuals
+                m += (s/thisgrpsize); // mean, second pass
+                for (int j=0; j<thisgrpsize; j++) { // variance
+                    v += (sub[j]-(double)m) * (sub[j]-(double)m);
+                }
+                ansd[i] = (double)v/(thisgrpsize-1);
+                if (isSD) ansd[i] = SQRTL(ansd[i]);
             }
         }
-        SETLENGTH(sub, maxgrpn);
-        break;
-        case REALSXP:
-        sub = PROTECT(allocVector(REALSXP, maxgrpn)); // allocate once upfront
-        if (!LOGICAL(narm)[0]) {
-            for (i=0; i<ngrp; i++) {
-                m=0.; s=0.; v=0.; ans_na = FALSE;
-                if (grpsize[i] != 1) {
-                    thisgrpsize = grpsize[i];
-                    SETLENGTH(sub, thisgrpsize); // to gather this group's data
-                    for (j=0; j<thisgrpsize; j++) {
-                        ix = ff[i]+j-1;
-                        if (isunsorted) ix = oo[ix]-1;
-                        ix = (irowslen == -1) ? ix : irows[ix]-1;
-                        if (ISNAN(REAL(x)[ix])) { ans_na = TRUE; break; }
-                        REAL(sub)[j] = REAL(x)[ix];
-                        m += REAL(sub)[j]; // sum
-                    }
-                    if (ans_na) { REAL(ans)[i] = NA_REAL; continue; }
-                    m = m/thisgrpsize; // mean, first pass
-                    for (j=0; j<thisgrpsize; j++) s += (REAL(sub)[j]-m); // residuals
-                    m += (s/thisgrpsize); // mean, second pass
-                    for (j=0; j<thisgrpsize; j++) { // variance
-                        v += (REAL(sub)[j]-(double)m) * (REAL(sub)[j]-(double)m);
+        free(buf);
+        gmemgive((size_t)nth*maxgrpn*sizeof(*buf));
+        } break;
+        case REALSXP: {
+        const double *xd = REAL(x);
+        double *buf = malloc((size_t)nth*maxgrpn*sizeof(double)); // allocate once upfront
+        if (!buf && maxgrpn) error("Unable to allocate %d * %d * %d bytes for gvar", nth, maxgrpn, sizeof(double));
+        gmemtake((size_t)nth*maxgrpn*sizeof(double));
+        #pragma omp parallel num_threads(nth)
+        {
+            double *sub = buf + (size_t)omp_get_thread_num()*maxgrpn;
+            #pragma omp for schedule(dynamic, gchunk())
+            for (int i=0; i<ngrp; i++) {
+                long double m=0., s=0., v=0.;
+                int thisgrpsize = 0;
+                Rboolean ans_na = FALSE;
+                if (grpsize[i] == 1) { ansd[i] = NA_REAL; continue; }
+                for (int j=0; j<grpsize[i]; j++) {  // gather this group's data
+                    double xj = xd[growx(i,j)];
+                    if (ISNAN(xj)) {
+                        if (rm) continue;
+                        ans_na = TRUE; break;
                     }
-                    REAL(ans)[i] = (double)v/(thisgrpsize-1);
-                    if (isSD) REAL(ans)[i] = SQRTL(REAL(ans)[i]);
-                } else REAL(ans)[i] = NA_REAL;
-            }
-        } else {
-            for (i=0; i<ngrp; i++) {
-                m=0.; s=0.; v=0.; thisgrpsize = 0;
-                if (grpsize[i] != 1) {
-                    SETLENGTH(sub, grpsize[i]); // to gather this group's data
-                    for (j=0; j<grpsize[i]; j++) {
-                        ix = ff[i]+j-1;
-                        if (isunsorted) ix = oo[ix]-1;
-                        ix = (irowslen == -1) ? ix : irows[ix]-1;
-                        if (ISNAN(REAL(x)[ix])) continue;
-                        REAL(sub)[thisgrpsize] = REAL(x)[ix];
-                        m += REAL(sub)[thisgrpsize]; // sum
-                        thisgrpsize++;
-                    }
-                    if (thisgrpsize <= 1) { REAL(ans)[i] = NA_REAL; continue; }
-                    m = m/thisgrpsize; // mean, first pass
-                    for (j=0; j<thisgrpsize; j++) s += (REAL(sub)[j]-m); // residuals
-                    m += (s/thisgrpsize); // mean, second pass
-                    for (j=0; j<thisgrpsize; j++) { // variance
-                        v += (REAL(sub)[j]-(double)m) * (REAL(sub)[j]-(double)m);
-                    }
-                    REAL(ans)[i] = (double)v/(thisgrpsize-1);
-                    if (isSD) REAL(ans)[i] = SQRTL(REAL(ans)[i]);
-                } else REAL(ans)[i] = NA_REAL;
+                    sub[thisgrpsize] = xj;
+                    m += sub[thisgrpsize]; // sum
+                    thisgrpsize++;
+                }
+                if (ans_na || thisgrpsize <= 1) { ansd[i] = NA_REAL; continue; }
+                m = m/thisgrpsize; // mean, first pass
+                for (int j=0; j<thisgrpsize; j++) s += (sub[j]-m); // residuals
+                m += (s/thisgrpsize); // mean, second pass
+                for (int j=0; j<thisgrpsize; j++) { // variance
+                    v += (sub[j]-(double)m) * (sub[j]-(double)m);
+                }
+                ansd[i] = (double)v/(thisgrpsize-1);
+                if (isSD) ansd[i] = SQRTL(ansd[i]);
             }
         }
-        SETLENGTH(sub, maxgrpn);
-        break;
+        free(buf);
+        gmemgive((size_t)nth*maxgrpn*sizeof(*buf));
+        } break;
         default: 
             if (isSD) {
                 error("Type '%s' not supported by GForce var (gvar). Either add the prefix stats::var(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)));
@@ -980,7 +1004,7 @@ SEXP gvarsd1(SEXP x, SEXP narm, Rboolean isSD)
                 error("Type '%s' not supported by GForce sd (gsd). Either add the prefix stats::sd(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)));                
             }
     }
-    UNPROTECT(2);
+    UNPROTECT(1);
     return (ans);
 }
 
@@ -997,52 +1021,600 @@ SEXP gprod(SEXP x, SEXP narm)
     if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
     if (!isVectorAtomic(x)) error("GForce prod can only be applied to columns, not .SD or similar. To multiply all items in a list such as .SD, either add the prefix base::prod(.SD) or turn off GForce optimization using options(datatable.optimize=1). More likely, you may be looking for 'DT[,lapply(.SD,prod),by=,.SDcols=]'");
     if (inherits(x, "factor")) error("prod is not meaningful for factors.");
-    int i, ix, thisgrp;
     int n = (irowslen == -1) ? length(x) : irowslen;
     //clock_t start = clock();
-    SEXP ans;
     if (grpn != n) error("grpn [%d] != length(x) [%d] in gprod", grpn, n);
-    long double *s = malloc(ngrp * sizeof(long double));
-    if (!s) error("Unable to allocate %d * %d bytes for gprod", ngrp, sizeof(long double));
-    for (i=0; i<ngrp; i++) s[i] = 1.0;
-    ans = PROTECT(allocVector(REALSXP, ngrp));
-    switch(TYPEOF(x)) {
-    case LGLSXP: case INTSXP:
-        for (i=0; i<n; i++) {
-            thisgrp = grp[i];
-            ix = (irowslen == -1) ? i : irows[i]-1;
-            if(INTEGER(x)[ix] == NA_INTEGER) { 
-                if (!LOGICAL(narm)[0]) s[thisgrp] = NA_REAL;  // Let NA_REAL propogate from here. R_NaReal is IEEE.
-                continue;
-            }
-            s[thisgrp] *= INTEGER(x)[ix];  // no under/overflow here, s is long double (like base)
+    if (TYPEOF(x)!=LGLSXP && TYPEOF(x)!=INTSXP && TYPEOF(x)!=REALSXP)
+        error("Type '%s' not supported by GForce prod (gprod). Either add the prefix base::prod(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)));
+    int w = gwindow();
+    long double *p = malloc(w * sizeof(long double));
+    if (!p) error("Unable to allocate %d * %d bytes for gprod", w, sizeof(long double));
+    gmemtake(w * sizeof(long double));
+    SEXP ans = PROTECT(allocVector(REALSXP, ngrp));
+    gacc a = { .p = p };
+    for (gfrom=0; gfrom<ngrp; gfrom=gto) {
+        gto = MIN(gfrom+w, ngrp);
+        gaccum(x, LOGICAL(narm)[0], &a);
+        gprod_result(ans, p);
+    }
+    gfrom = 0; gto = ngrp;
+    free(p);
+    gmemgive(w * sizeof(long double));
+    copyMostAttrib(x, ans);
+    UNPROTECT(1);
+    // Rprintf("this gprod took %8.3f\n", 1.0*(clock()-start)/CLOCKS_PER_SEC);
+    return(ans);
+}
+
+// The kernels below scan through grp (serial) or let each thread own whole groups, so results don't depend on threads
+
+static inline Rboolean gisna(const void *xd, int type, Rboolean isint64, int i) {
+    switch(type) {
+    case LGLSXP: case INTSXP: return ((const int *)xd)[i] == NA_INTEGER;
+    case REALSXP: {
+        double v = ((const double *)xd)[i];
+        if (!isint64) return ISNAN(v);
+        long long ll; memcpy(&ll, &v, 8);  // no type punning; see I64() in init.c
+        return ll == NAINT64;
+    }
+    case CPLXSXP: return ISNAN(((const Rcomplex *)xd)[i].r) || ISNAN(((const Rcomplex *)xd)[i].i);
+    case STRSXP: return ((const SEXP *)xd)[i] == NA_STRING;
+    default: return FALSE;  // raw
+    }
+}
+
+static Rboolean gisint64(SEXP x) {
+    SEXP class = getAttrib(x, R_ClassSymbol);
+    return TYPEOF(x)==REALSXP && isString(class) && STRING_ELT(class, 0) == char_integer64;
+}
+
+// sum(!is.na(x)) : the number of non-NA in each group, without allocating !is.na(x)
+SEXP gnotna(SEXP x) {
+    if (!isVectorAtomic(x)) error("GForce sum(!is.na(.)) can only be applied to columns, not .SD or similar. Either add the prefix base::sum(.) or turn off GForce optimization using options(datatable.optimize=1).");
+    int n = (irowslen == -1) ? length(x) : irowslen;
+    if (grpn != n) error("grpn [%d] != length(x) [%d] in gnotna", grpn, n);
+    const int type = TYPEOF(x);
+    const Rboolean isint64 = gisint64(x);
+    const void *xd = DATAPTR(x);
+    SEXP ans = PROTECT(allocVector(INTSXP, ngrp));
+    int *ansd = INTEGER(ans);
+    if (grp && gblocks()) {
+        memset(ansd, 0, ngrp*sizeof(int));
+        for (int i=0; i<n; i++) {
+            int ix = (irowslen == -1) ? i : irows[i]-1;
+            ansd[grp[i]] += !gisna(xd, type, isint64, ix);
         }
-        for (i=0; i<ngrp; i++) {
-            if (s[i] > DBL_MAX) REAL(ans)[i] = R_PosInf;
-            else if (s[i] < -DBL_MAX) REAL(ans)[i] = R_NegInf;
-            else REAL(ans)[i] = (double)s[i];
+    } else {
+        #pragma omp parallel for num_threads(gnth) schedule(dynamic, gchunk())
+        for (int g=0; g<ngrp; g++) {
+            int c = 0;
+            for (int j=0; j<grpsize[g]; j++) c += !gisna(xd, type, isint64, growx(g,j));
+            ansd[g] = c;
         }
-        break;
-    case REALSXP:
-        for (i=0; i<n; i++) {
-            thisgrp = grp[i];
-            ix = (irowslen == -1) ? i : irows[i]-1;
-            if(ISNAN(REAL(x)[ix]) && LOGICAL(narm)[0]) continue;  // else let NA_REAL propogate from here
-            s[thisgrp] *= REAL(x)[ix];  // done in long double, like base
+    }
+    UNPROTECT(1);
+    return(ans);
+}
+
+// any and all of a logical column, or of an elementwise expression such as x>0 evaluated on the whole column
+SEXP ganyall(SEXP x, SEXP narm, Rboolean isany) {
+    if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
+    if (TYPEOF(x) != LGLSXP) error("Type '%s' not supported by GForce %s (g%s). Either add the prefix base::%s(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)), isany ? "any" : "all", isany ? "any" : "all", isany ? "any" : "all");
+    int n = (irowslen == -1) ? length(x) : irowslen;
+    if (grpn != n) error("grpn [%d] != length(x) [%d] in g%s", grpn, n, isany ? "any" : "all");
+    const Rboolean rm = LOGICAL(narm)[0];
+    const int *xd = LOGICAL(x);
+    // any() is decided by the first TRUE and all() by the first FALSE; otherwise NA wins unless na.rm=TRUE
+    const int decider = isany ? TRUE : FALSE, other = !decider;
+    SEXP ans = PROTECT(allocVector(LGLSXP, ngrp));
+    int *ansd = LOGICAL(ans);
+    if (grp && gblocks()) {
+        for (int g=0; g<ngrp; g++) ansd[g] = other;
+        for (int i=0; i<n; i++) {
+            int v = xd[(irowslen == -1) ? i : irows[i]-1];
+            int *a = ansd + grp[i];
+            if (v == decider) *a = decider;
+            else if (v == NA_LOGICAL && !rm && *a != decider) *a = NA_LOGICAL;
         }
-        for (i=0; i<ngrp; i++) {
-            if (s[i] > DBL_MAX) REAL(ans)[i] = R_PosInf;
-            else if (s[i] < -DBL_MAX) REAL(ans)[i] = R_NegInf;
-            else REAL(ans)[i] = (double)s[i];
+    } else {
+        #pragma omp parallel for num_threads(gnth) schedule(dynamic, gchunk())
+        for (int g=0; g<ngrp; g++) {
+            int a = other;
+            for (int j=0; j<grpsize[g]; j++) {
+                int v = xd[growx(g,j)];
+                if (v == decider) { a = decider; break; }
+                if (v == NA_LOGICAL && !rm) a = NA_LOGICAL;
+            }
+            ansd[g] = a;
         }
-        break;
-    default:
+    }
+    UNPROTECT(1);
+    return(ans);
+}
+
+SEXP gany(SEXP x, SEXP narm) {
+    return (ganyall(x, narm, TRUE));
+}
+
+SEXP gall(SEXP x, SEXP narm) {
+    return (ganyall(x, narm, FALSE));
+}
+
+static inline double gdouble(const void *xd, Rboolean isreal, int i) {
+    if (isreal) return ((const double *)xd)[i];
+    int v = ((const int *)xd)[i];
+    return v == NA_INTEGER ? NA_REAL : v;
+}
+
+// weighted.mean(x, w) as stats:::weighted.mean.default : sum((x*w)[w != 0])/sum(w), after removing the NA in x
+// (but not in w) when na.rm=TRUE
+SEXP gweightedmean(SEXP x, SEXP w, SEXP narm) {
+    if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
+    if (!isVectorAtomic(x) || !isVectorAtomic(w)) error("GForce weighted.mean can only be applied to columns, not .SD or similar. Either add the prefix stats::weighted.mean(.) or turn off GForce optimization using options(datatable.optimize=1).");
+    if (inherits(x, "factor") || inherits(w, "factor")) error("weighted.mean is not meaningful for factors.");
+    for (int k=0; k<2; k++) {
+        SEXP v = k ? w : x;
+        if (TYPEOF(v)!=LGLSXP && TYPEOF(v)!=INTSXP && TYPEOF(v)!=REALSXP)
+            error("Type '%s' not supported by GForce weighted.mean (gweighted.mean). Either add the prefix stats::weighted.mean(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(v)));
+    }
+    if (length(w) != length(x)) error("'x' and 'w' must have the same length");
+    int n = (irowslen == -1) ? length(x) : irowslen;
+    if (grpn != n) error("grpn [%d] != length(x) [%d] in gweighted.mean", grpn, n);
+    const Rboolean rm = LOGICAL(narm)[0], xreal = TYPEOF(x)==REALSXP, wreal = TYPEOF(w)==REALSXP;
+    const void *xd = DATAPTR(x), *wd = DATAPTR(w);
+    SEXP ans = PROTECT(allocVector(REALSXP, ngrp));
+    double *ansd = REAL(ans);
+    if (grp && gblocks()) {
+        long double *s = calloc(2*(size_t)ngrp, sizeof(long double));  // sum(x*w) then sum(w)
+        if (!s) error("Unable to allocate %d * %d bytes for gweighted.mean", 2*ngrp, sizeof(long double));
+        gmemtake(2*(size_t)ngrp*sizeof(long double));
+        long double *sw = s + ngrp;
+        for (int i=0; i<n; i++) {
+            int ix = (irowslen == -1) ? i : irows[i]-1;
+            double xv = gdouble(xd, xreal, ix), wv = gdouble(wd, wreal, ix);
+            if (rm && ISNAN(xv)) continue;
+            sw[grp[i]] += wv;
+            if (wv != 0) s[grp[i]] += xv*wv;  // including NA w, as (x*w)[w != 0] does
+        }
+        for (int g=0; g<ngrp; g++) ansd[g] = (double)(s[g]/sw[g]);
         free(s);
-        error("Type '%s' not supported by GForce prod (gprod). Either add the prefix base::prod(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)));
+        gmemgive(2*(size_t)ngrp*sizeof(long double));
+    } else {
+        #pragma omp parallel for num_threads(gnth) schedule(dynamic, gchunk())
+        for (int g=0; g<ngrp; g++) {
+            long double s = 0, sw = 0;
+            for (int j=0; j<grpsize[g]; j++) {
+                int ix = growx(g,j);
+                double xv = gdouble(xd, xreal, ix), wv = gdouble(wd, wreal, ix);
+                if (rm && ISNAN(xv)) continue;
+                sw += wv;
+                if (wv != 0) s += xv*wv;
+            }
+            ansd[g] = (double)(s/sw);
+        }
     }
-    free(s);
-    copyMostAttrib(x, ans);
     UNPROTECT(1);
-    // Rprintf("this gprod took %8.3f\n", 1.0*(clock()-start)/CLOCKS_PER_SEC);
+    return(ans);
+}
+
+// The kernels below gather each group into a buffer like gvarsd1, with threads owning whole groups.
+static int gbufthreads() {
+    return gblocks() ? 1 : MIN(gnth, 1+grpn/(maxgrpn>0 ? maxgrpn : 1));
+}
+
+// Gathers the non-NA values of group g, as double, into sub and returns how many; -1 on an NA when !rm.
+// *asc is set when they came in ascending order, e.g. x is the next column of the key after by=.
+static int ggather(double *sub, const void *xd, int type, Rboolean isint64, int g, Rboolean rm, Rboolean *asc) {
+    int m = 0;
+    Rboolean a = TRUE;
+    for (int j=0; j<grpsize[g]; j++) {
+        int ix = growx(g,j);
+        if (gisna(xd, type, isint64, ix)) {
+            if (rm) continue;
+            return -1;
+        }
+        double v;
+        if (!isint64) v = gdouble(xd, type==REALSXP, ix);
+        else { long long ll; memcpy(&ll, (const double *)xd+ix, 8); v = (double)ll; }
+        if (m && v < sub[m-1]) a = FALSE;
+        sub[m++] = v;
+    }
+    *asc = a;
+    return m;
+}
+
+// The k-th smallest (0-based) of sub[0..m-1] and, when next isn't NULL, the one after it (k+1 < m).
+// Values gathered in ascending order are read off directly; otherwise sub is partially sorted in place.
+static double gkth(double *sub, int m, int k, Rboolean asc, double *next) {
+    if (asc) {
+        if (next) *next = sub[k+1];
+        return sub[k];
+    }
+    double v = dquickselect(sub, m, k);
+    if (next) {
+        // sub[k+1..m-1] are all >= v, so the next is their minimum
+        double h = sub[k+1];
+        for (int i=k+2; i<m; i++) if (sub[i] < h) h = sub[i];
+        *next = h;
+    }
+    return v;
+}
+
+// gmedian, always returns numeric type (to avoid as.numeric() wrap..)
+SEXP gmedian(SEXP x, SEXP narm) {
+    if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
+    if (!isVectorAtomic(x)) error("GForce median can only be applied to columns, not .SD or similar. To find median of all items in a list such as .SD, either add the prefix stats::median(.SD) or turn off GForce optimization using options(datatable.optimize=1). More likely, you may be looking for 'DT[,lapply(.SD,median),by=,.SDcols=]'");
+    if (inherits(x, "factor")) error("median is not meaningful for factors.");
+    if (TYPEOF(x)!=LGLSXP && TYPEOF(x)!=INTSXP && TYPEOF(x)!=REALSXP)
+        error("Type '%s' not supported by GForce median (gmedian). Either add the prefix stats::median(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)));
+    int n = (irowslen == -1) ? length(x) : irowslen;
+    if (grpn != n) error("grpn [%d] != length(x) [%d] in gmedian", grpn, n);
+    const Rboolean rm = LOGICAL(narm)[0], isint64 = gisint64(x);
+    const void *xd = DATAPTR(x);
+    SEXP ans = PROTECT(allocVector(REALSXP, ngrp));
+    double *ansd = REAL(ans);
+    int nth = gbufthreads();
+    double *buf = malloc((size_t)nth*maxgrpn*sizeof(double));
+    if (!buf && maxgrpn) error("Unable to allocate %d * %d * %d bytes for gmedian", nth, maxgrpn, sizeof(double));
+    gmemtake((size_t)nth*maxgrpn*sizeof(double));
+    #pragma omp parallel num_threads(nth)
+    {
+        double *sub = buf + (size_t)omp_get_thread_num()*maxgrpn;
+        #pragma omp for schedule(dynamic, gchunk())
+        for (int g=0; g<ngrp; g++) {
+            Rboolean asc;
+            int m = ggather(sub, xd, TYPEOF(x), isint64, g, rm, &asc);
+            if (m <= 0) { ansd[g] = NA_REAL; continue; }
+            int k = (m+1)/2 - 1;  // 0-based, the lower middle when m is even
+            if (m % 2) ansd[g] = gkth(sub, m, k, asc, NULL);
+            else {
+                double hi, lo = gkth(sub, m, k, asc, &hi);
+                ansd[g] = (lo + hi)/2.0;
+            }
+        }
+    }
+    free(buf);
+    gmemgive((size_t)nth*maxgrpn*sizeof(double));
+    UNPROTECT(1);
+    return(ans);
+}
+
+// quantile(x, probs) for a single probs, as type=7 in stats:::quantile.default
+SEXP gquantile(SEXP x, SEXP probs, SEXP narm) {
+    if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
+    if (!isNumeric(probs) || LENGTH(probs)!=1 || ISNAN(asReal(probs)) || asReal(probs)<0 || asReal(probs)>1) error("GForce quantile needs a single 'probs' between 0 and 1");
+    if (!isVectorAtomic(x)) error("GForce quantile can only be applied to columns, not .SD or similar. Either add the prefix stats::quantile(.) or turn off GForce optimization using options(datatable.optimize=1).");
+    if (inherits(x, "factor")) error("quantile is not meaningful for factors.");
+    if (TYPEOF(x)!=LGLSXP && TYPEOF(x)!=INTSXP && TYPEOF(x)!=REALSXP)
+        error("Type '%s' not supported by GForce quantile (gquantile). Either add the prefix stats::quantile(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)));
+    int n = (irowslen == -1) ? length(x) : irowslen;
+    if (grpn != n) error("grpn [%d] != length(x) [%d] in gquantile", grpn, n);
+    const Rboolean rm = LOGICAL(narm)[0], isint64 = gisint64(x);
+    const double p = asReal(probs);
+    const void *xd = DATAPTR(x);
+    SEXP ans = PROTECT(allocVector(REALSXP, ngrp));
+    double *ansd = REAL(ans);
+    int nth = gbufthreads(), anyna = 0;
+    double *buf = malloc((size_t)nth*maxgrpn*sizeof(double));
+    if (!buf && maxgrpn) error("Unable to allocate %d * %d * %d bytes for gquantile", nth, maxgrpn, sizeof(double));
+    gmemtake((size_t)nth*maxgrpn*sizeof(double));
+    #pragma omp parallel num_threads(nth)
+    {
+        double *sub = buf + (size_t)omp_get_thread_num()*maxgrpn;
+        #pragma omp for schedule(dynamic, gchunk())
+        for (int g=0; g<ngrp; g++) {
+            Rboolean asc;
+            int m = ggather(sub, xd, TYPEOF(x), isint64, g, rm, &asc);
+            if (m < 0) { anyna = 1; continue; }  // an error, raised below outside the parallel region
+            if (m == 0) { ansd[g] = NA_REAL; continue; }
+            double index = 1 + (m-1)*p;   // 1-based, as in R
+            int lo = (int)floor(index);
+            double hi, qs = gkth(sub, m, lo-1, asc, index > lo ? &hi : NULL);
+            if (index > lo && hi != qs) { double h = index - lo; qs = (1-h)*qs + h*hi; }
+            ansd[g] = qs;
+        }
+    }
+    free(buf);
+    gmemgive((size_t)nth*maxgrpn*sizeof(double));
+    if (anyna) error("missing values and NaN's not allowed if 'na.rm' is FALSE");
+    UNPROTECT(1);
+    return(ans);
+}
+
+static int ullcmp(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+
+// uniqueN(x) by group, with values compared as forderv groups them (-0 is 0, NA and NaN differ, rounding applies,
+// strings by CHARSXP)
+SEXP guniqueN(SEXP x, SEXP narm) {
+    if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) error("na.rm must be TRUE or FALSE");
+    if (!isVectorAtomic(x)) error("GForce uniqueN can only be applied to columns, not .SD or similar. Either add the prefix data.table::uniqueN(.) or turn off GForce optimization using options(datatable.optimize=1).");
+    if (TYPEOF(x)!=LGLSXP && TYPEOF(x)!=INTSXP && TYPEOF(x)!=REALSXP && TYPEOF(x)!=STRSXP)
+        error("Type '%s' not supported by GForce uniqueN (guniqueN). Either add the prefix data.table::uniqueN(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)));
+    int n = (irowslen == -1) ? length(x) : irowslen;
+    if (grpn != n) error("grpn [%d] != length(x) [%d] in guniqueN", grpn, n);
+    const Rboolean rm = LOGICAL(narm)[0], isint64 = gisint64(x);
+    const int type = TYPEOF(x);
+    const int dround = INTEGER(getNumericRounding())[0];
+    const unsigned long long dmask1 = dround ? 1ULL << (8*dround-1) : 0, dmask2 = 0xffffffffffffffffULL << dround*8;
+    SEXP ans = PROTECT(allocVector(INTSXP, ngrp));
+    int *ansd = INTEGER(ans);
+    const void *xd = DATAPTR(x);
+    int nth = gbufthreads();
+    unsigned long long *buf = malloc((size_t)nth*maxgrpn*sizeof(unsigned long long));
+    if (!buf && maxgrpn) error("Unable to allocate %d * %d * %d bytes for guniqueN", nth, maxgrpn, sizeof(unsigned long long));
+    gmemtake((size_t)nth*maxgrpn*sizeof(unsigned long long));
+    #pragma omp parallel num_threads(nth)
+    {
+        unsigned long long *sub = buf + (size_t)omp_get_thread_num()*maxgrpn;
+        #pragma omp for schedule(dynamic, gchunk())
+        for (int g=0; g<ngrp; g++) {
+            int m = 0;
+            for (int j=0; j<grpsize[g]; j++) {
+                int ix = growx(g,j);
+                if (rm && gisna(xd, type, isint64, ix)) continue;
+                unsigned long long k;
+                switch(type) {
+                case LGLSXP: case INTSXP: k = (unsigned int)((const int *)xd)[ix]; break;
+                case STRSXP: k = (unsigned long long)(size_t)((const SEXP *)xd)[ix]; break;
+                default: {
+                    double v = ((const double *)xd)[ix];
+                    memcpy(&k, &v, 8);
+                    if (isint64) break;
+                    // as dtwiddle in forder.c : the rounding, 0 for -0, and one key each for NA and for the other NaN.
+                    // Those two keys are NaN bit patterns which no rounded number has.
+                    if (ISNAN(v)) k = ISNA(v) ? 0x7ff0000000000001ULL : 0x7ff8000000000000ULL;
+                    else if (R_FINITE(v)) k = (v == 0) ? 0 : (k + ((k & dmask1) << 1)) & dmask2;
+                    else k &= dmask2;
+                }}
+                sub[m++] = k;
+            }
+            qsort(sub, m, sizeof(unsigned long long), ullcmp);
+            int u = m>0;
+            for (int k=1; k<m; k++) u += sub[k] != sub[k-1];
+            ansd[g] = u;
+        }
+    }
+    free(buf);
+    gmemgive((size_t)nth*maxgrpn*sizeof(unsigned long long));
+    UNPROTECT(1);
+    return(ans);
+}
+
+// Cumulative functions by group, e.g. DT[, cs := cumsum(x), by=g] : one value per row, in grouped order as dogroups()
+// returns it; gassign() writes it back for :=
+enum { GCUMSUM, GCUMPROD, GCUMMIN, GCUMMAX };
+
+static SEXP gcum(SEXP x, int op) {
+    const char *name = op==GCUMSUM ? "cumsum" : op==GCUMPROD ? "cumprod" : op==GCUMMIN ? "cummin" : "cummax";
+    if (!isVectorAtomic(x)) error("GForce %s can only be applied to columns, not .SD or similar. Either add the prefix base::%s(.) or turn off GForce optimization using options(datatable.optimize=1).", name, name);
+    if (inherits(x, "factor")) error("'%s' not meaningful for factors", name);
+    if ((TYPEOF(x)!=LGLSXP && TYPEOF(x)!=INTSXP && TYPEOF(x)!=REALSXP) || gisint64(x))
+        error("Type '%s' not supported by GForce %s (g%s). Either add the prefix base::%s(.) or turn off GForce optimization using options(datatable.optimize=1)", gisint64(x) ? "integer64" : type2char(TYPEOF(x)), name, name, name);
+    int n = (irowslen == -1) ? length(x) : irowslen;
+    if (grpn != n) error("grpn [%d] != length(x) [%d] in g%s", grpn, n, name);
+    // as base : integer and logical give integer, except cumprod which is always double
+    const Rboolean isint = TYPEOF(x)!=REALSXP, intans = isint && op!=GCUMPROD;
+    SEXP ans = PROTECT(allocVector(intans ? INTSXP : REALSXP, grpn));
+    const int *xi = isint ? INTEGER(x) : NULL;
+    const double *xd = isint ? NULL : REAL(x);
+    int *ai = intans ? INTEGER(ans) : NULL;
+    double *ad = intans ? NULL : REAL(ans);
+    int overflow = 0;
+    #pragma omp parallel for num_threads(gnth) schedule(dynamic, gchunk()) reduction(|:overflow)
+    for (int g=0; g<ngrp; g++) {
+        const int m = grpsize[g], k = ff[g]-1;
+        int j = 0;
+        if (intans) {
+            // NA, and an integer overflow of cumsum, end the group with NA as in base
+            double s = 0;
+            int v = 0;
+            for (; j<m; j++) {
+                int xv = xi[growx(g,j)];
+                if (xv == NA_INTEGER) break;
+                if (op == GCUMSUM) {
+                    s += xv;
+                    if (s > INT_MAX || s < 1+INT_MIN) { overflow = 1; break; }
+                    v = (int)s;
+                } else v = (j==0 || (op==GCUMMIN ? xv<v : xv>v)) ? xv : v;
+                ai[k+j] = v;
+            }
+            for (; j<m; j++) ai[k+j] = NA_INTEGER;
+        } else if (op == GCUMSUM || op == GCUMPROD) {
+            long double s = op==GCUMSUM ? 0 : 1;
+            for (; j<m; j++) {
+                int ix = growx(g,j);
+                double xv = isint ? (xi[ix]==NA_INTEGER ? NA_REAL : xi[ix]) : xd[ix];
+                if (op == GCUMSUM) s += xv; else s *= xv;
+                ad[k+j] = (double)s;
+            }
+        } else {
+            // as base : NaN carries on until an NA, which wins and ends the group with NA
+            double v = op==GCUMMIN ? R_PosInf : R_NegInf;
+            for (; j<m; j++) {
+                double xv = xd[growx(g,j)];
+                if (ISNAN(xv) || ISNAN(v)) {
+                    if (ISNA(xv)) break;
+                    v = R_NaN;
+                } else if (op==GCUMMIN ? xv<v : xv>v) v = xv;
+                ad[k+j] = v;
+            }
+            for (; j<m; j++) ad[k+j] = NA_REAL;
+        }
+    }
+    if (overflow) warning("integer overflow in 'cumsum'; use 'cumsum(as.numeric(.))'");
+    UNPROTECT(1);
+    return(ans);
+}
+
+SEXP gcumsum(SEXP x)  { return gcum(x, GCUMSUM); }
+SEXP gcumprod(SEXP x) { return gcum(x, GCUMPROD); }
+SEXP gcummin(SEXP x)  { return gcum(x, GCUMMIN); }
+SEXP gcummax(SEXP x)  { return gcum(x, GCUMMAX); }
+
+// seq_len(.N) and seq_along(x) : the row number within the group
+SEXP gseq() {
+    SEXP ans = PROTECT(allocVector(INTSXP, grpn));
+    int *ansd = INTEGER(ans);
+    #pragma omp parallel for num_threads(gnth) schedule(dynamic, gchunk())
+    for (int g=0; g<ngrp; g++) {
+        for (int j=0; j<grpsize[g]; j++) ansd[ff[g]-1+j] = j+1;
+    }
+    UNPROTECT(1);
+    return(ans);
+}
+
+// frank(x, ties.method=) within each group, with na.last=TRUE. x is gathered in grouped order next to the
+// group of each item and the pair is ordered by forder : frank()'s ties logic then restarts at each group.
+SEXP gfrank(SEXP x, SEXP ties) {
+    if (!isVectorAtomic(x)) error("GForce frank can only be applied to columns, not .SD or similar. Either add the prefix data.table::frank(.) or turn off GForce optimization using options(datatable.optimize=1).");
+    if (TYPEOF(x)!=LGLSXP && TYPEOF(x)!=INTSXP && TYPEOF(x)!=REALSXP && TYPEOF(x)!=STRSXP)
+        error("Type '%s' not supported by GForce frank (gfrank). Either add the prefix data.table::frank(.) or turn off GForce optimization using options(datatable.optimize=1)", type2char(TYPEOF(x)));
+    if (!isString(ties) || LENGTH(ties)!=1) error("ties.method must be a character vector of length 1");
+    int n = (irowslen == -1) ? length(x) : irowslen;
+    if (grpn != n) error("grpn [%d] != length(x) [%d] in gfrank", grpn, n);
+    SEXP dt = PROTECT(allocVector(VECSXP, 2));
+    SEXP gid = allocVector(INTSXP, grpn);
+    SET_VECTOR_ELT(dt, 0, gid);
+    SEXP xg = allocVector(TYPEOF(x), grpn);
+    SET_VECTOR_ELT(dt, 1, xg);
+    copyMostAttrib(x, xg);   // e.g. integer64 for forder
+    int *gd = INTEGER(gid);
+    const size_t size = SIZEOF(x);
+    for (int g=0; g<ngrp; g++) {
+        for (int j=0; j<grpsize[g]; j++) {
+            int k = ff[g]-1+j, ix = growx(g,j);
+            gd[k] = g+1;
+            if (TYPEOF(x) == STRSXP) SET_STRING_ELT(xg, k, STRING_ELT(x, ix));
+            else memcpy((char *)DATAPTR(xg) + k*size, (const char *)DATAPTR(x) + ix*size, size);
+        }
+    }
+    SEXP by = PROTECT(allocVector(INTSXP, 2)), order = PROTECT(allocVector(INTSXP, 2)), yes = PROTECT(ScalarLogical(TRUE));
+    INTEGER(by)[0] = 1; INTEGER(by)[1] = 2;
+    INTEGER(order)[0] = INTEGER(order)[1] = 1;
+    SEXP o = PROTECT(forder(dt, by, yes, yes, order, yes));
+    SEXP starts = getAttrib(o, sym_starts), xorder = o;
+    if (!LENGTH(o)) {
+        // already in order
+        xorder = allocVector(INTSXP, grpn);
+        for (int i=0; i<grpn; i++) INTEGER(xorder)[i] = i+1;
+    }
+    PROTECT(xorder);
+    SEXP lens = PROTECT(uniqlengths(starts, PROTECT(ScalarInteger(grpn))));
+    SEXP ans = frank(xorder, starts, lens, ties, gid);
+    UNPROTECT(8);
+    return(ans);
+}
+
+// j = list(sum(x), mean(x), max(x), ...) : the sum, mean, prod, min and max of the same column come from one scan of
+// it; the rest are eval()-ed as usual
+static SEXP gfuse(SEXP env, SEXP jsub) {
+    enum { FUSED=-2, FSUM=0, FMEAN, FPROD, FMIN, FMAX, NFUN };
+    const char *funs[NFUN] = {"gsum", "gmean", "gprod", "gmin", "gmax"};
+    int i, j, k, n = length(jsub)-1, protecti=0;
+    SEXP ans = PROTECT(allocVector(VECSXP, n)); protecti++;
+    int *fun = (int *)R_alloc(n, sizeof(int));   // -1 when not one of funs, FUSED once done
+    int *rm = (int *)R_alloc(n, sizeof(int));
+    SEXP *col = (SEXP *)R_alloc(n, sizeof(SEXP));
+    Rboolean anyname = FALSE;
+    SEXP a = CDR(jsub);
+    for (i=0; i<n; i++, a=CDR(a)) {
+        SEXP e = CAR(a);
+        if (TAG(a) != R_NilValue) anyname = TRUE;
+        fun[i] = -1;
+        if (!isLanguage(e) || !isSymbol(CAR(e)) || length(e)<2 || length(e)>3 || !isSymbol(CADR(e))) continue;
+        for (k=0; k<NFUN && CAR(e)!=install(funs[k]); k++);
+        if (k==NFUN) continue;
+        rm[i] = FALSE;
+        if (length(e)==3) {
+            SEXP narm = eval(CADDR(e), env);
+            if (!isLogical(narm) || LENGTH(narm)!=1 || LOGICAL(narm)[0]==NA_LOGICAL) continue;  // the kernel will error
+            rm[i] = LOGICAL(narm)[0];
+        }
+        fun[i] = k;
+        col[i] = CADR(e);
+    }
+    for (i=0; i<n; i++) {
+        if (fun[i]<0) continue;
+        // the others on the same column and na.rm
+        int nsame = 0, want[NFUN] = {0};
+        for (j=i; j<n; j++) if (fun[j]>=0 && col[j]==col[i] && rm[j]==rm[i]) { nsame++; want[fun[j]]++; }
+        if (nsame<2) continue;
+        SEXP x = eval(col[i], env);
+        if ((TYPEOF(x)!=LGLSXP && TYPEOF(x)!=INTSXP && TYPEOF(x)!=REALSXP) || inherits(x, "factor") ||
+            (irowslen == -1 ? length(x) : irowslen) != grpn) continue;
+        PROTECT(x); protecti++;
+        SEXP mn = R_NilValue, mx = R_NilValue;
+        if (want[FMIN]) { mn = PROTECT(allocVector(TYPEOF(x)==REALSXP ? REALSXP : INTSXP, ngrp)); protecti++; }
+        if (want[FMAX]) { mx = PROTECT(allocVector(TYPEOF(x)==REALSXP ? REALSXP : INTSXP, ngrp)); protecti++; }
+        gacc acc = { NULL };
+        Rboolean ok = TRUE;
+        if (want[FSUM] || want[FMEAN]) ok &= (acc.s = malloc(ngrp*sizeof(long double))) != NULL;
+        if (want[FMEAN] && rm[i])      ok &= (acc.c = malloc(ngrp*sizeof(int))) != NULL;
+        if (want[FPROD])               ok &= (acc.p = malloc(ngrp*sizeof(long double))) != NULL;
+        if (!ok) { gacc_free(&acc); error("Unable to allocate GForce accumulators for %d groups", ngrp); }
+        size_t bytes = gacc_size(&acc, TYPEOF(x) != REALSXP, ngrp);
+        gmemtake(bytes);
+        acc.mn = want[FMIN] ? DATAPTR(mn) : NULL;
+        acc.mx = want[FMAX] ? DATAPTR(mx) : NULL;
+        if (gsummode != SUM_LONG && TYPEOF(x) == REALSXP && acc.s) {
+            // the sums in their own scan, see gsums
+            long double *s = acc.s; int *c = acc.c;
+            acc.s = NULL; acc.c = NULL;
+            if (acc.p || acc.mn || acc.mx) gaccum(x, rm[i], &acc);
+            acc.s = s; acc.c = c;
+            gsumd(x, rm[i], s, c);
+        } else gaccum(x, rm[i], &acc);
+        acc.mn = acc.mx = NULL;  // owned by R, not to be freed
+        for (j=i; j<n; j++) {
+            if (fun[j]<0 || col[j]!=col[i] || rm[j]!=rm[i]) continue;
+            SEXP thisans = R_NilValue;
+            Rboolean warned = FALSE;
+            switch(fun[j]) {
+            case FSUM :
+                thisans = gsum_result(x, PROTECT(allocVector(TYPEOF(x) == REALSXP ? REALSXP : INTSXP, ngrp)), acc.s);
+                UNPROTECT(1);
+                break;
+            case FMEAN :
+                thisans = PROTECT(allocVector(REALSXP, ngrp));
+                gmean_result(x, thisans, rm[i], acc.s, acc.c, &warned);
+                UNPROTECT(1);
+                break;
+            case FPROD :
+                thisans = allocVector(REALSXP, ngrp);
+                gprod_result(thisans, acc.p);
+                break;
+            // gminmax_result may change its argument, so all but the last min (or max) get a copy
+            case FMIN :
+                thisans = PROTECT(--want[FMIN] ? duplicate(mn) : mn);
+                thisans = gminmax_result(x, thisans, rm[i], TRUE);
+                UNPROTECT(1);
+                break;
+            case FMAX :
+                thisans = PROTECT(--want[FMAX] ? duplicate(mx) : mx);
+                thisans = gminmax_result(x, thisans, rm[i], FALSE);
+                UNPROTECT(1);
+                break;
+            }
+            PROTECT(thisans);
+            if (fun[j]==FSUM || fun[j]==FMEAN || fun[j]==FPROD) copyMostAttrib(x, thisans);
+            SET_VECTOR_ELT(ans, j, thisans);
+            UNPROTECT(1);
+            fun[j] = FUSED;
+        }
+        gacc_free(&acc);
+        gmemgive(bytes);
+    }
+    a = CDR(jsub);
+    for (i=0; i<n; i++, a=CDR(a)) if (fun[i]!=FUSED) SET_VECTOR_ELT(ans, i, eval(CAR(a), env));
+    if (anyname) {
+        SEXP names = PROTECT(allocVector(STRSXP, n)); protecti++;
+        a = CDR(jsub);
+        for (i=0; i<n; i++, a=CDR(a)) SET_STRING_ELT(names, i, TAG(a)==R_NilValue ? R_BlankString : PRINTNAME(TAG(a)));
+        setAttrib(ans, R_NamesSymbol, names);
+    }
+    UNPROTECT(protecti);
     return(ans);
 }
@@ -0,0 +1,175 @@
+#include "data.table.h"
+#include <stdint.h>
+
+// Equi join of an x that has neither a key nor an index on the join columns, without sorting x. The distinct
+// values of the join columns of the smaller of x and i are put in an open addressing hash table (linear probing),
+// then each row of the larger side looks its values up there, in parallel. Values are compared as bmerge does :
+// double and integer64 twiddled (so numeric rounding applies), character by their CHARSXP in UTF-8. Each row of x
+// and of i then has the id of its value (-1 for none) and the rows of x are grouped by id, in row order within a
+// group, into xo. starts and lens index xo just as bmerge's index the order of x, so mult and nomatch give the same
+// rows. Only rows of x that match some row of i are in xo.
+// When the join columns are all integer, logical or factor and their ranges of values over x and i fit in 64 bits
+// together (e.g. a date, a store and a product id), each row is packed into one 64 bit key instead : each column
+// takes the bits its range needs, 0 for NA else value-min+1. Equal keys are then equal rows, so the table holds the
+// key itself and a probe is a single comparison, without reading the join columns of the row it found.
+
+typedef struct { int type; Rboolean i64; const void *p; int mn, bits; } hjcol;  // mn and bits when packed
+
+static inline unsigned long long hjval(const hjcol *c, int r) {
+    switch (c->type) {
+    case LGLSXP : case INTSXP : return (unsigned)((const int *)c->p)[r];
+    case REALSXP : return (c->i64 ? i64twiddle : dtwiddle)((void *)c->p, r, 1);
+    default : return (uintptr_t)((const SEXP *)c->p)[r];  // already in UTF-8, see below
+    }
+}
+
+static inline unsigned long long hjhash(const hjcol *cols, int ncol, int r) {
+    unsigned long long h = 0;
+    for (int col=0; col<ncol; col++) h = (h ^ hjval(cols+col, r)) * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 29);
+}
+
+static inline Rboolean hjeq(const hjcol *a, int ra, const hjcol *b, int rb, int ncol) {
+    for (int col=0; col<ncol; col++) if (hjval(a+col, ra) != hjval(b+col, rb)) return FALSE;
+    return TRUE;
+}
+
+static inline unsigned long long hjpack(const hjcol *cols, int ncol, int r) {
+    unsigned long long k = 0;
+    for (int col=0; col<ncol; col++) {
+        int v = ((const int *)cols[col].p)[r];
+        k = (k << cols[col].bits) | (v == NA_INTEGER ? 0 : (unsigned long long)((long long)v - cols[col].mn + 1));
+    }
+    return k;
+}
+
+// the packed key of row r (when packed), else its hash; *s is its slot in a table of mask+1
+static inline unsigned long long hjkey(const hjcol *cols, int ncol, int r, Rboolean packed, size_t mask, size_t *s) {
+    if (!packed) { unsigned long long h = hjhash(cols, ncol, r); *s = h & mask; return h; }
+    unsigned long long k = hjpack(cols, ncol, r), h = k * 0x9E3779B97F4A7C15ULL;
+    *s = (h ^ (h >> 29)) & mask;
+    return k;
+}
+
+SEXP hashjoin(SEXP iArg, SEXP xArg, SEXP icolsArg, SEXP xcolsArg, SEXP nomatchArg, SEXP multArg) {
+    if (!isInteger(icolsArg) || !isInteger(xcolsArg) || LENGTH(icolsArg) != LENGTH(xcolsArg) || !LENGTH(icolsArg))
+        error("Internal error: icols and xcols must be integer vectors of the same non-zero length");
+    if (!isInteger(nomatchArg) || LENGTH(nomatchArg) != 1) error("Internal error: nomatch must be a length 1 integer");
+    if (!isString(multArg) || LENGTH(multArg) != 1) error("Internal error: mult must be a length 1 character");
+    const char *mult = CHAR(STRING_ELT(multArg, 0));
+    if (strcmp(mult, "all") && strcmp(mult, "first") && strcmp(mult, "last")) error("Internal error: invalid value for 'mult'");
+    int ncol = LENGTH(icolsArg), *icols = INTEGER(icolsArg), *xcols = INTEGER(xcolsArg), nomatch = INTEGER(nomatchArg)[0];
+    int xN = length(VECTOR_ELT(xArg, 0)), iN = length(VECTOR_ELT(iArg, 0)), protecti = 0;
+    hjcol *ic = (hjcol *)R_alloc(ncol, sizeof(hjcol)), *xc = (hjcol *)R_alloc(ncol, sizeof(hjcol));
+    for (int col=0; col<ncol; col++) {
+        if (icols[col]<1 || icols[col]>LENGTH(iArg)) error("icols[%d]=%d outside range [1,length(i)=%d]", col, icols[col], LENGTH(iArg));
+        if (xcols[col]<1 || xcols[col]>LENGTH(xArg)) error("xcols[%d]=%d outside range [1,length(x)=%d]", col, xcols[col], LENGTH(xArg));
+        SEXP iv = VECTOR_ELT(iArg, icols[col]-1), xv = VECTOR_ELT(xArg, xcols[col]-1);
+        if (TYPEOF(iv) != TYPEOF(xv)) error("typeof x.%s (%s) != typeof i.%s (%s)", CHAR(STRING_ELT(getAttrib(xArg,R_NamesSymbol),xcols[col]-1)), type2char(TYPEOF(xv)), CHAR(STRING_ELT(getAttrib(iArg,R_NamesSymbol),icols[col]-1)), type2char(TYPEOF(iv)));
+        if (TYPEOF(xv) != LGLSXP && TYPEOF(xv) != INTSXP && TYPEOF(xv) != STRSXP && TYPEOF(xv) != REALSXP) error("Type '%s' not supported as key column", type2char(TYPEOF(xv)));
+        Rboolean i64 = TYPEOF(xv)==REALSXP && INHERITS(xv, char_integer64);
+        if (TYPEOF(xv) == STRSXP) {
+            // compared by pointer, so strings not already ASCII or UTF-8 are translated first, single threaded
+            iv = PROTECT(ENC2UTF8vec(iv)); xv = PROTECT(ENC2UTF8vec(xv)); protecti += 2;
+        }
+        ic[col] = (hjcol){TYPEOF(xv), i64, DATAPTR(iv), 0, 0};
+        xc[col] = (hjcol){TYPEOF(xv), i64, DATAPTR(xv), 0, 0};
+    }
+    Rboolean packed = TRUE;
+    for (int col=0, totbits=0; col<ncol && packed; col++) {
+        if (xc[col].type != LGLSXP && xc[col].type != INTSXP) { packed = FALSE; break; }
+        int lo = INT_MAX, hi = INT_MIN;  // NA_INTEGER is INT_MIN, so hi is only ever a value
+        const int *xp = (const int *)xc[col].p, *ip = (const int *)ic[col].p;
+        for (int r=0; r<xN; r++) { if (xp[r] != NA_INTEGER && xp[r] < lo) lo = xp[r]; if (xp[r] > hi) hi = xp[r]; }
+        for (int r=0; r<iN; r++) { if (ip[r] != NA_INTEGER && ip[r] < lo) lo = ip[r]; if (ip[r] > hi) hi = ip[r]; }
+        if (lo > hi) lo = hi = 0;  // all NA
+        int bits = 1;
+        while (bits < 33 && (1LL << bits) < (long long)hi - lo + 2) bits++;
+        xc[col].mn = ic[col].mn = lo;
+        xc[col].bits = ic[col].bits = bits;
+        packed = (totbits += bits) <= 64;
+    }
+
+    // build on the smaller side, probe with the larger
+    Rboolean buildx = xN <= iN;
+    const hjcol *bc = buildx ? xc : ic, *pc = buildx ? ic : xc;
+    int nb = buildx ? xN : iN, np = buildx ? iN : xN;
+    int bits = 1;
+    while ((1LL<<bits) < 2LL*nb) bits++;
+    size_t m = (size_t)1<<bits, mask = m-1;
+    int *slot = (int *)malloc(m * sizeof(int));               // key id in each slot, -1 when empty
+    int *rep = (int *)malloc(((size_t)nb+1) * sizeof(int));    // a row of the build side with the value of each key id
+    unsigned long long *hk = (unsigned long long *)malloc(((size_t)nb+1) * sizeof(unsigned long long));
+    int *idb = (int *)malloc(((size_t)nb+1) * sizeof(int)), *idp = (int *)malloc(((size_t)np+1) * sizeof(int));
+    if (!slot || !rep || !hk || !idb || !idp) {
+        free(slot); free(rep); free(hk); free(idb); free(idp);
+        error("Unable to allocate the hash table of %d rows for the join", nb);
+    }
+    for (size_t s=0; s<m; s++) slot[s] = -1;
+    int nk = 0;
+    for (int r=0; r<nb; r++) {
+        size_t s;
+        unsigned long long h = hjkey(bc, ncol, r, packed, mask, &s);
+        while (slot[s] != -1 && (hk[slot[s]] != h || (!packed && !hjeq(bc, rep[slot[s]], bc, r, ncol)))) s = (s+1) & mask;
+        if (slot[s] == -1) { slot[s] = nk; rep[nk] = r; hk[nk++] = h; }
+        idb[r] = slot[s];
+    }
+    int nth = getDTthreads();
+    if (nth > np/1024) nth = np/1024;
+    if (nth < 1) nth = 1;
+    #pragma omp parallel for num_threads(nth) schedule(static)
+    for (int r=0; r<np; r++) {
+        size_t s;
+        unsigned long long h = hjkey(pc, ncol, r, packed, mask, &s);
+        while (slot[s] != -1 && (hk[slot[s]] != h || (!packed && !hjeq(bc, rep[slot[s]], pc, r, ncol)))) s = (s+1) & mask;
+        idp[r] = slot[s];
+    }
+    free(slot); free(hk);
+    const int *idx = buildx ? idb : idp, *idi = buildx ? idp : idb;
+
+    // group the rows of x by key id : counting sort, stable
+    int *start = rep;  // rep is no longer needed, reuse it for the start of each key id in xo
+    memset(start, 0, ((size_t)nk+1) * sizeof(int));
+    for (int r=0; r<xN; r++) if (idx[r] >= 0) start[idx[r]+1]++;
+    for (int k=0; k<nk; k++) start[k+1] += start[k];
+    SEXP xoArg = PROTECT(allocVector(INTSXP, start[nk])); protecti++;
+    int *xo = INTEGER(xoArg);
+    int *pos = (int *)malloc(((size_t)nk+1) * sizeof(int));
+    if (!pos) { free(rep); free(idb); free(idp); error("Unable to allocate %d positions for the join", nk); }
+    memcpy(pos, start, ((size_t)nk+1) * sizeof(int));
+    for (int r=0; r<xN; r++) if (idx[r] >= 0) xo[pos[idx[r]]++] = r+1;
+    free(pos);
+
+    SEXP retFirstArg = PROTECT(allocVector(INTSXP, iN)); protecti++;
+    SEXP retLengthArg = PROTECT(allocVector(INTSXP, iN)); protecti++;
+    int *retFirst = INTEGER(retFirstArg), *retLength = INTEGER(retLengthArg);
+    Rboolean allLen1 = TRUE;
+    for (int r=0; r<iN; r++) {
+        int k = idi[r], len = k>=0 ? start[k+1]-start[k] : 0;
+        if (!len) { retFirst[r] = nomatch; retLength[r] = nomatch==0 ? 0 : 1; continue; }
+        switch (mult[0]) {
+        case 'a' : retFirst[r] = start[k]+1; retLength[r] = len; allLen1 &= len==1; break;
+        case 'f' : retFirst[r] = start[k]+1; retLength[r] = 1; break;
+        default  : retFirst[r] = start[k+1]; retLength[r] = 1; break;
+        }
+    }
+    free(rep); free(idb); free(idp);
+
+    SEXP ans = PROTECT(allocVector(VECSXP, 6)); protecti++;
+    SEXP ansnames = PROTECT(allocVector(STRSXP, 6)); protecti++;
+    SET_VECTOR_ELT(ans, 0, retFirstArg);
+    SET_VECTOR_ELT(ans, 1, retLengthArg);
+    SET_VECTOR_ELT(ans, 2, allocVector(INTSXP, 0));
+    SET_VECTOR_ELT(ans, 3, ScalarLogical(allLen1));
+    SET_VECTOR_ELT(ans, 4, ScalarLogical(TRUE));
+    SET_VECTOR_ELT(ans, 5, xoArg);
+    SET_STRING_ELT(ansnames, 0, char_starts);
+    SET_STRING_ELT(ansnames, 1, mkChar("lens"));
+    SET_STRING_ELT(ansnames, 2, mkChar("indices"));
+    SET_STRING_ELT(ansnames, 3, mkChar("allLen1"));
+    SET_STRING_ELT(ansnames, 4, mkChar("allGrp1"));
+    SET_STRING_ELT(ansnames, 5, mkChar("xo"));
+    setAttrib(ans, R_NamesSymbol, ansnames);
+    UNPROTECT(protecti);
+    return ans;
+}
@@ -2,686 +2,154 @@
 #include <Rdefines.h>
 #include <time.h>
 
-// TODO: implement 'lookup' for 'gaps' and 'overlaps' arguments
-SEXP lookup(SEXP ux, SEXP xlen, SEXP indices, SEXP gaps, SEXP overlaps, SEXP multArg, SEXP typeArg, SEXP verbose) {
-    
-    SEXP vv, tt, lookup, type_lookup;
-    R_len_t i,j,k,*idx,*len1,*len2,xrows=INTEGER(xlen)[0],uxrows=LENGTH(VECTOR_ELT(ux, 0)),uxcols=LENGTH(ux);
-    int *from = (int *)INTEGER(VECTOR_ELT(indices, 0));
-    int *to   = (int *)INTEGER(VECTOR_ELT(indices, 1));
-    clock_t pass1, pass2, pass3, start;
-    enum {ALL, FIRST, LAST} mult = ALL;
-    enum {ANY, WITHIN, START, END, EQUAL} type = ANY;
-    
-    if (!strcmp(CHAR(STRING_ELT(multArg, 0)), "all"))  mult = ALL;
-    else if (!strcmp(CHAR(STRING_ELT(multArg, 0)), "first")) mult = FIRST;
-    else if (!strcmp(CHAR(STRING_ELT(multArg, 0)), "last")) mult = LAST;
-    else error("Internal error: invalid value for 'mult'; this should have been caught before. Please report to datatable-help");
+// Overlap join for foverlaps(). The interval ends of y and x have been matched (by bmerge) to positions 1..nux on the
+// sorted unique end points of y, so y row i covers positions from[i]..to[i] and x row r spans from[r]..to[r]. y is
+// keyed, so its from is non-decreasing. Which y rows a position p 'stabs', i.e. from[i] <= p <= to[i], are those
+// before the first with from > p whose 'to' is at least p : a max tree over 'to' finds them in order in
+// O(log(ny) + matches), without the per position lists of y rows the previous lookup() built (which took memory
+// proportional to the sum over y of the positions each covers). For each x row the matching y rows, in increasing
+// order, are :
+//   any    : y rows stabbed by from[r], then those starting in (from[r], to[r]]
+//   within : y rows with from[i] <= from[r] and to[i] >= to[r]
+//   start, end : y rows stabbed by from[r] (from[r] == to[r] for these, the ends match exactly)
+// mult="first"/"last" take the first/last of them. The x rows are done in parallel: a first pass counts the result
+// of each row, then each row writes its part of the result directly, so no lists or buffers are grown.
 
-    if (!strcmp(CHAR(STRING_ELT(typeArg, 0)), "any"))  type = ANY;
-    else if (!strcmp(CHAR(STRING_ELT(typeArg, 0)), "within")) type = WITHIN;
-    else if (!strcmp(CHAR(STRING_ELT(typeArg, 0)), "start")) type = START;
-    else if (!strcmp(CHAR(STRING_ELT(typeArg, 0)), "end")) type = END;
-    else if (!strcmp(CHAR(STRING_ELT(typeArg, 0)), "equal")) type = EQUAL;
-    else error("Internal error: invalid value for 'type'; this should have been caught before. Please report to datatable-help");
-    
-    // For reference: uxcols-1 = type_count, uxcols-2 = count, uxcols-3 = type_lookup, uxcols-4 = lookup
-    // first pass: calculate lengths first
-    start = clock();
-    len1 = (int *)INTEGER(VECTOR_ELT(ux, uxcols-2));
-    len2 = (int *)INTEGER(VECTOR_ELT(ux, uxcols-1));
-    switch (mult) {
-        case FIRST: 
-        for (i=0; i<xrows; i++) {
-            for (j=from[i]; j<=to[i]; j++) {
-                len1[j-1]++;
-            }
-        }
-        if (type != WITHIN) {
-            for (i=0; i<uxrows; i++)                      // TODO: this allocation can be avoided if we take care of FIRST/LAST accordingly in 'overlaps'
-                if (len1[i]) len2[i] = 1;
-        }
-        break;
-        
-        case LAST :
-        switch (type) {
-            case ANY:
-            for (i=0; i<xrows; i++) {
-                for (j=from[i]; j<=to[i]; j++) {
-                    len1[j-1]++;
-                    if (from[i]==j && !len2[j-1]) len2[j-1]++;
-                }
-            }
-            break;
-            case START: case END: case EQUAL: case WITHIN:
-            for (i=0; i<xrows; i++) {
-                for (j=from[i]; j<=to[i]; j++) {
-                    len1[j-1]++;
-                }
-            }
-            if (type != WITHIN) {
-                for (i=0; i<uxrows; i++)              // TODO: this allocation can be avoided if we take care of FIRST/LAST accordingly in 'overlaps'
-                    if (len1[i]) len2[i] = 1;                    
-            }
-            break;
-        }
-        break;
-        
-        case ALL : 
-            switch (type) {
-                case START: case END:
-                for (i=0; i<xrows; i++) {
-                    for (j=from[i]; j<=to[i]; j++) {
-                        len1[j-1]++; len2[j-1]++;       // alternatively, we could simply do with len2=len1 ?
-                    }
-                }
-                break;
-                case EQUAL:
-                for (i=0; i<xrows; i++) {
-                    len1[from[i]-1]++; len1[to[i]-1]++;
-                    len2[from[i]-1]++; len2[to[i]-1]++;
-                }
-                break;
-                case ANY :
-                for (i=0; i<xrows; i++) {
-                    k = from[i];
-                    for (j=from[i]; j<=to[i]; j++) {
-                        len1[j-1]++;
-                        if (k==j) len2[j-1]++;
-                    }
-                }
-                break;
-                case WITHIN :
-                for (i=0; i<xrows; i++) {
-                    for (j=from[i]; j<=to[i]; j++) {
-                        len1[j-1]++;
-                    }
-                }
-                break;
-            }
-        break;
-    }
-    pass1 = clock() - start;
-    if (LOGICAL(verbose)[0])
-        Rprintf("First pass on calculating lengths in lookup ... done in %8.3f seconds\n", 1.0*(pass1)/CLOCKS_PER_SEC);
-    // second pass: allocate vectors
-    start = clock();
-    lookup = VECTOR_ELT(ux, uxcols-4);
-    type_lookup = VECTOR_ELT(ux, uxcols-3);
-    for (i=0; i<uxrows; i++) {
-        vv = allocVector(INTSXP, len1[i]);
-        SET_VECTOR_ELT(lookup, i, vv);
-        if (type != WITHIN) {
-            vv = allocVector(INTSXP, len2[i]);
-            SET_VECTOR_ELT(type_lookup, i, vv);
-        }
-    }
-    pass2 = clock() - start;
-    if (LOGICAL(verbose)[0])
-        Rprintf("Second pass on allocation in lookup ... done in %8.3f seconds\n", 1.0*(pass2)/CLOCKS_PER_SEC);
-    // generate lookup
-    start = clock();
-    idx = Calloc(uxrows, R_len_t); // resets bits, =0
+enum { OANY, OWITHIN, OSTART, OEND };
+enum { OALL, OFIRST, OLAST };
+
+typedef struct {
+    int ny, m;          // m : number of leaves of the tree, a power of 2 >= ny
+    const int *yto;
+    int *tree;          // tree[1] is the root, tree[m+i] = yto[i] (INT_MIN for i >= ny); a node holds the max of its leaves
+    int *ystart;        // ystart[p] : the first y row with from > p, i.e. the number of y rows with from <= p, p = 0..nux
+} oindex;
+
+// the y rows in [0, hi) with to >= thr, in increasing order : written to out (when not NULL), and counted
+static int ostab(const oindex *ix, int node, int l, int r, int hi, int thr, int *out) {
+    if (l >= hi || ix->tree[node] < thr) return 0;
+    if (r-l == 1) { if (out) out[0] = l+1; return 1; }
+    int mid = l + (r-l)/2, n = ostab(ix, 2*node, l, mid, hi, thr, out);
+    return n + ostab(ix, 2*node+1, mid, r, hi, thr, out ? out+n : NULL);
+}
+
+// the first (last when fromright) y row in [0, hi) with to >= thr, 1-based, else 0
+static int ostab1(const oindex *ix, int node, int l, int r, int hi, int thr, Rboolean fromright) {
+    if (l >= hi || ix->tree[node] < thr) return 0;
+    if (r-l == 1) return l+1;
+    int mid = l + (r-l)/2, a = fromright ? 2*node+1 : 2*node, b = fromright ? 2*node : 2*node+1;
+    int ans = ostab1(ix, a, fromright ? mid : l, fromright ? r : mid, hi, thr, fromright);
+    return ans ? ans : ostab1(ix, b, fromright ? l : mid, fromright ? mid : r, hi, thr, fromright);
+}
+
+// the y rows matching an x row spanning positions k..t, as a stabbing query plus a range of y rows starting in (k, t]
+static void oquery(const oindex *ix, int type, int k, int t, int *hi, int *thr, int *rlo, int *rhi) {
+    *hi = 0; *thr = 0; *rlo = *rhi = 0;
     switch (type) {
-        case ANY: case START: case END: case WITHIN:
-        for (i=0; i<xrows; i++) {
-            for (j=from[i]; j<=to[i]; j++) {
-                vv = VECTOR_ELT(lookup, j-1);  // cache misses - memory efficiency? but 'lookups' are tiny - takes 0.036s on A.thaliana GFF for entire process)
-                INTEGER(vv)[idx[j-1]++] = i+1;
-            }
-        }
+    case OANY :
+        if (k > t || t < 1) return;
+        if (k > 0) { *hi = ix->ystart[k]; *thr = k; }
+        *rlo = ix->ystart[k > 0 ? k : 0]; *rhi = ix->ystart[t];
         break;
-        case EQUAL:
-        for (i=0; i<xrows; i++) {
-            INTEGER(VECTOR_ELT(lookup, from[i]-1))[idx[from[i]-1]++] = i+1;
-            INTEGER(VECTOR_ELT(lookup, to[i]-1))[idx[to[i]-1]++] = i+1;
-        }
+    case OWITHIN :
+        if (k > 0 && k <= t) { *hi = ix->ystart[k]; *thr = t; }
         break;
-    }
-    Free(idx);
-    // generate type_lookup
-    if (type != WITHIN) {
-        switch (mult) {
-            case FIRST :
-            for (i=0; i<uxrows; i++) {
-                if (!len1[i]) continue;
-                vv = VECTOR_ELT(lookup, i);
-                tt = VECTOR_ELT(type_lookup, i);
-                INTEGER(tt)[0] = INTEGER(vv)[0];
-            }
-            break;
-
-            case LAST :
-            for (i=0; i<uxrows; i++) {
-                if (!len1[i]) continue;
-                vv = VECTOR_ELT(lookup, i);
-                tt = VECTOR_ELT(type_lookup, i);
-                INTEGER(tt)[0] = INTEGER(vv)[len1[i]-1];
-            }
-        
-            case ALL :
-            switch (type) {
-                case START: case END: case EQUAL:
-                for (i=0; i<uxrows; i++)
-                    SET_VECTOR_ELT(type_lookup, i, VECTOR_ELT(lookup, i));
-                break;
-            
-                case ANY :
-                for (i=0; i<uxrows; i++) {
-                    vv = VECTOR_ELT(lookup, i);
-                    tt = VECTOR_ELT(type_lookup, i);
-                    k=0;
-                    for (j=len1[i]-len2[i]; j<len1[i]; j++)
-                        INTEGER(tt)[k++] = INTEGER(vv)[j];
-                }
-                break;
-            
-                case WITHIN :
-                // for (i=0; i<uxrows; i++) {
-                //     vv = VECTOR_ELT(lookup, i);
-                //     tt = VECTOR_ELT(type_lookup, i);
-                //     for (j=0; j<len2[i]; j++)
-                //         INTEGER(tt)[j] = INTEGER(vv)[j];
-                // }
-                break;
-            }
+    default :  // start, end
+        if (k > 0) { *hi = ix->ystart[k]; *thr = k; }
         break;
-        }
     }
-    pass3 = clock() - start;
-    if (LOGICAL(verbose)[0])
-        Rprintf("Final step in generating lookup ... done in %8.3f seconds\n", 1.0*(pass3)/CLOCKS_PER_SEC);    
-    return(R_NilValue);
 }
 
-SEXP overlaps(SEXP ux, SEXP imatches, SEXP multArg, SEXP typeArg, SEXP nomatchArg, SEXP verbose) {
+SEXP overlaps(SEXP yidx, SEXP nuxArg, SEXP imatches, SEXP multArg, SEXP typeArg, SEXP nomatchArg, SEXP verbose) {
 
-    R_len_t i,j,k,m,uxcols=LENGTH(ux),rows=length(VECTOR_ELT(imatches,0));
-    int nomatch = INTEGER(nomatchArg)[0], totlen=0, len, thislen, wlen=0;
-    int *from   = (int *)INTEGER(VECTOR_ELT(imatches, 0));
-    int *to     = (int *)INTEGER(VECTOR_ELT(imatches, 1));
-    int *len1   = (int *)INTEGER(VECTOR_ELT(ux, uxcols-2));
-    int *len2   = (int *)INTEGER(VECTOR_ELT(ux, uxcols-1));
-    SEXP lookup = VECTOR_ELT(ux, uxcols-4);
-    SEXP type_lookup = VECTOR_ELT(ux, uxcols-3);
-    SEXP ans, f1__, f2__, tmp1, tmp2;
+    R_len_t ny = length(VECTOR_ELT(yidx, 0)), rows = length(VECTOR_ELT(imatches, 0)), nux = INTEGER(nuxArg)[0];
+    int nomatch = INTEGER(nomatchArg)[0];
+    const int *yfrom = INTEGER(VECTOR_ELT(yidx, 0)), *yto = INTEGER(VECTOR_ELT(yidx, 1));
+    const int *from = INTEGER(VECTOR_ELT(imatches, 0)), *to = INTEGER(VECTOR_ELT(imatches, 1));
+    SEXP ans, f1__, f2__;
     clock_t end1, end2, start;
-    enum {ALL, FIRST, LAST} mult = ALL;
-    enum {ANY, WITHIN, START, END, EQUAL} type = ANY;
-    
-    if (!strcmp(CHAR(STRING_ELT(multArg, 0)), "all"))  mult = ALL;
-    else if (!strcmp(CHAR(STRING_ELT(multArg, 0)), "first")) mult = FIRST;
-    else if (!strcmp(CHAR(STRING_ELT(multArg, 0)), "last")) mult = LAST;
+    int mult = OALL, type = OANY;
+
+    if (!strcmp(CHAR(STRING_ELT(multArg, 0)), "all"))  mult = OALL;
+    else if (!strcmp(CHAR(STRING_ELT(multArg, 0)), "first")) mult = OFIRST;
+    else if (!strcmp(CHAR(STRING_ELT(multArg, 0)), "last")) mult = OLAST;
     else error("Internal error: invalid value for 'mult'; this should have been caught before. Please report to datatable-help");
 
-    if (!strcmp(CHAR(STRING_ELT(typeArg, 0)), "any"))  type = ANY;
-    else if (!strcmp(CHAR(STRING_ELT(typeArg, 0)), "within")) type = WITHIN;
-    else if (!strcmp(CHAR(STRING_ELT(typeArg, 0)), "start")) type = START;
-    else if (!strcmp(CHAR(STRING_ELT(typeArg, 0)), "end")) type = END;
-    else if (!strcmp(CHAR(STRING_ELT(typeArg, 0)), "equal")) type = EQUAL;
+    if (!strcmp(CHAR(STRING_ELT(typeArg, 0)), "any"))  type = OANY;
+    else if (!strcmp(CHAR(STRING_ELT(typeArg, 0)), "within")) type = OWITHIN;
+    else if (!strcmp(CHAR(STRING_ELT(typeArg, 0)), "start")) type = OSTART;
+    else if (!strcmp(CHAR(STRING_ELT(typeArg, 0)), "end")) type = OEND;
     else error("Internal error: invalid value for 'type'; this should have been caught before. Please report to datatable-help");
 
-    // As a first pass get the final length, so that we can allocate up-front and not deal with Calloc + Realloc + size calculation hassle
-    // Checked the time for this loop on realisitc data (81m reads) and took 0.27 seconds! No excuses ;).
+    // the index on y
     start = clock();
-    if (mult == ALL) {
-        totlen=0;
-        switch (type) {
-            case START: case END: 
-            for (i=0; i<rows; i++)
-                totlen += (from[i] > 0 && len2[from[i]-1]) ? len2[from[i]-1] : 1;
-            break;
+    oindex ix = {ny, 1, yto, NULL, NULL};
+    while (ix.m < ny) ix.m <<= 1;
+    ix.tree = (int *)R_alloc(2*(size_t)ix.m, sizeof(int));
+    ix.ystart = (int *)R_alloc((size_t)nux+1, sizeof(int));
+    for (int i=0; i<ix.m; i++) ix.tree[ix.m+i] = i < ny ? yto[i] : INT_MIN;
+    for (int p=ix.m-1; p>0; p--) ix.tree[p] = ix.tree[2*p] > ix.tree[2*p+1] ? ix.tree[2*p] : ix.tree[2*p+1];
+    for (int i=0; i<ny; i++) {
+        if (yfrom[i] < 1 || yto[i] < yfrom[i] || yto[i] > nux || (i && yfrom[i] < yfrom[i-1]))
+            error("Internal error: the intervals of y must match positions 1..%d in order. Please report to datatable-help", nux);
+    }
+    for (int i=0, p=0; p<=nux; p++) {
+        while (i < ny && yfrom[i] <= p) i++;
+        ix.ystart[p] = i;
+    }
+    for (int i=0; i<rows; i++) {
+        if (from[i] > nux || to[i] > nux) error("Internal error: the intervals of x must match positions 0..%d. Please report to datatable-help", nux);
+    }
 
-            case EQUAL:
-            for (i=0; i<rows; i++) {
-                len = totlen; wlen=0, j=0, m=0;
-                k = (from[i]>0) ? from[i] : 1;
-                if (k == to[i]) {
-                    wlen = len1[k-1];
-                } else if (k < to[i]) {
-                    tmp1 = VECTOR_ELT(lookup, k-1);
-                    tmp2 = VECTOR_ELT(type_lookup, to[i]-1);
-                    while (j<len1[k-1] && m<len2[to[i]-1]) {
-                        if ( INTEGER(tmp1)[j] == INTEGER(tmp2)[m] ) {
-                            ++wlen; ++j; ++m;
-                        } else if ( INTEGER(tmp1)[j] > INTEGER(tmp2)[m] ) {
-                            break;
-                        } else ++j;
-                    }
-                }
-                totlen += wlen;
-                if (len == totlen) 
-                    ++totlen;
-            }
-            break;
-                        
-            case ANY:
-            for (i=0; i<rows; i++) {
-                len = totlen;
-                // k = (from[i] > 0) ? from[i] : 1;
-                k = from[i];
-                if (k<=to[i])
-                    totlen += len1[k-1];
-                for (j=k+1; j<=to[i]; j++)
-                    totlen += len2[j-1];
-                if (len == totlen) 
-                    ++totlen;
-            }
-            break;
-            
-            case WITHIN:
-            for (i=0; i<rows; i++) {
-                len = totlen; j=0; m=0;
-                k = from[i];
-                if (k > 0) {
-                    if (k == to[i]) {
-                        totlen += len1[k-1];
-                    } else if (k < to[i]) {
-                        tmp1 = VECTOR_ELT(lookup, k-1);
-                        tmp2 = VECTOR_ELT(lookup, to[i]-1);
-                        while (j<len1[k-1] && m<len1[to[i]-1]) {
-                            if ( INTEGER(tmp1)[j] == INTEGER(tmp2)[m] ) {
-                                ++totlen; ++j; ++m;
-                            } else if ( INTEGER(tmp1)[j] > INTEGER(tmp2)[m] ) {
-                                ++m;
-                            } else ++j;
-                        }
-                    }
-                }
-                if (len == totlen) 
-                    ++totlen;
-            }
-            break;
-        }
-    } else totlen = rows;
+    // first pass : the number of result rows of each x row, a row of nomatch when none (dropped when nomatch=0)
+    int *cnt = (int *)R_alloc((size_t)rows+1, sizeof(int));
+    int nth = getDTthreads();
+    if (nth > rows/1024) nth = rows/1024;
+    if (nth < 1) nth = 1;
+    #pragma omp parallel for num_threads(nth) schedule(dynamic, 1024)
+    for (int i=0; i<rows; i++) {
+        int hi, thr, rlo, rhi, n = 0;
+        oquery(&ix, type, from[i], to[i], &hi, &thr, &rlo, &rhi);
+        if (mult == OALL) {
+            if (hi) n = ostab(&ix, 1, 0, ix.m, hi, thr, NULL);
+            n += rhi - rlo;
+        } else n = (hi && ostab1(&ix, 1, 0, ix.m, hi, thr, FALSE)) || rhi > rlo;
+        cnt[i] = n ? n : (mult != OALL || nomatch != 0);
+    }
+    long long totlen = 0;
+    for (int i=0; i<rows; i++) { int n = cnt[i]; cnt[i] = (int)totlen; totlen += n; }
+    if (totlen > INT_MAX) error("foverlaps found %lld overlaps, more than the 2^31-1 rows a data.table can have", totlen);
     end1 = clock() - start;
     if (LOGICAL(verbose)[0])
         Rprintf("First pass on calculating lengths in overlaps ... done in %8.3f seconds\n", 1.0*(end1)/CLOCKS_PER_SEC);
-    
+
     // ans[0] is the the position of 'query' and ans[1] is that of 'subject'
-    // allocate f1__ and f2__ and assign 'nomatch' to f2__
     ans = PROTECT(allocVector(VECSXP, 2));
     f1__ = allocVector(INTSXP, totlen);
     SET_VECTOR_ELT(ans, 0, f1__);
     f2__ = allocVector(INTSXP, totlen);
     SET_VECTOR_ELT(ans, 1, f2__);
-    thislen=0;
+    int *f1 = INTEGER(f1__), *f2 = INTEGER(f2__);
     start = clock();
-
-    // switching mult=ALL,FIRST,LAST separately to
-    //   - enhance performance for special cases, and 
-    //   - easy to fix any bugs in the future
-    switch (mult) {
-        case ALL:
-        switch (type) {
-            case START : case END :
-            for (i=0; i<rows; i++) {
-                len = thislen;
-                if (from[i] > 0) {
-                    k = from[i];
-                    tmp2 = VECTOR_ELT(type_lookup, k-1);
-                    for (j=0; j<len2[k-1]; j++) {
-                        INTEGER(f1__)[thislen] = i+1;
-                        INTEGER(f2__)[thislen] = INTEGER(tmp2)[j];
-                        ++thislen;
-                    }
-                }
-                if (len == thislen) {
-                    INTEGER(f1__)[thislen] = i+1;
-                    INTEGER(f2__)[thislen] = nomatch;
-                    ++thislen;
-                }
-            }
-            break;
-            
-            case EQUAL :
-            for (i=0; i<rows; i++) {
-                len = thislen;
-                if (from[i] > 0 && to[i] > 0) {
-                    k = from[i];
-                    if (k == to[i]) {
-                        tmp1 = VECTOR_ELT(lookup, k-1);
-                        tmp2 = VECTOR_ELT(type_lookup, to[i]-1);
-                        for (j=0; j<len1[k-1]; j++) {
-                            INTEGER(f1__)[thislen] = i+1;
-                            INTEGER(f2__)[thislen] = INTEGER(tmp1)[j];
-                            ++thislen;
-                        }
-                    } else if (k < to[i]) {
-                        j=0; m=0;
-                        tmp1 = VECTOR_ELT(lookup, k-1);
-                        tmp2 = VECTOR_ELT(type_lookup, to[i]-1);
-                        while (j<len1[k-1] && m<len2[to[i]-1]) {
-                            if ( INTEGER(tmp1)[j] == INTEGER(tmp2)[m] ) {
-                                INTEGER(f1__)[thislen] = i+1;
-                                INTEGER(f2__)[thislen] = INTEGER(tmp1)[j];
-                                 ++thislen; ++j; ++m;
-                             } else if ( INTEGER(tmp1)[j] > INTEGER(tmp2)[m] ) {
-                                 ++m;
-                             } else ++j;
-                         }
-                     }
-                 }
-                 if (len == thislen) {
-                     INTEGER(f1__)[thislen] = i+1;
-                     INTEGER(f2__)[thislen] = nomatch;
-                     ++thislen;
-                 }
-            }
-            break;
-            
-            case ANY :
-            for (i=0; i<rows; i++) {
-                len = thislen;
-                // k = (from[i]>0) ? from[i] : 1;
-                k = from[i];
-                if (k<=to[i]) {
-                    tmp1 = VECTOR_ELT(lookup, k-1);
-                    for (m=0; m<len1[k-1]; m++) {
-                        INTEGER(f1__)[thislen] = i+1;
-                        INTEGER(f2__)[thislen] = INTEGER(tmp1)[m];
-                        ++thislen;
-                    }
-                }
-                for (j=k+1; j<=to[i]; j++) {
-                    tmp2 = VECTOR_ELT(type_lookup, j-1);
-                    for (m=0; m<len2[j-1]; m++) {
-                        INTEGER(f1__)[thislen] = i+1;
-                        INTEGER(f2__)[thislen] = INTEGER(tmp2)[m];
-                        ++thislen;
-                    }
-                }
-                // dint go through any loops above
-                if (len == thislen) {
-                    INTEGER(f1__)[thislen] = i+1;
-                    INTEGER(f2__)[thislen] = nomatch;
-                    ++thislen; 
-                }
-            }
-            break;
-            
-            case WITHIN :
-            for (i=0; i<rows; i++) {
-                len = thislen;
-                k=from[i];
-                if (k > 0) {
-                    if (k == to[i]) {
-                        tmp1 = VECTOR_ELT(lookup, k-1);
-                        for (j=0; j<len1[k-1]; j++) {
-                            INTEGER(f1__)[thislen] = i+1;
-                            INTEGER(f2__)[thislen] = INTEGER(tmp1)[j];
-                            ++thislen;
-                        }
-                    } else if (k < to[i]) {
-                        j=0; m=0;
-                        tmp1 = VECTOR_ELT(lookup, k-1);
-                        tmp2 = VECTOR_ELT(lookup, to[i]-1);
-                        while (j<len1[k-1] && m<len1[to[i]-1]) {
-                            if ( INTEGER(tmp1)[j] == INTEGER(tmp2)[m] ) {
-                                INTEGER(f1__)[thislen] = i+1;
-                                INTEGER(f2__)[thislen] = INTEGER(tmp1)[j];
-                                 ++thislen; ++j; ++m;
-                             } else if ( INTEGER(tmp1)[j] > INTEGER(tmp2)[m] ) {
-                                 ++m;
-                             } else ++j;
-                         }
-                     }
-                 }
-                 if (len == thislen) {
-                     INTEGER(f1__)[thislen] = i+1;
-                     INTEGER(f2__)[thislen] = nomatch;
-                     ++thislen;
-                 }
-            }
-            break;
-        }
-        break;
-        
-        case FIRST:
-        switch (type) {
-            case START: case END:
-            for (i=0; i<rows; i++) {
-                len = thislen;
-                INTEGER(f1__)[thislen] = i+1;
-                k = (from[i]>0) ? from[i] : 1;
-                if (k <= to[i]) { // len1[k-1] is equal to len2[k-1] and will always be >0, so no length check necessary.
-                    tmp1 = VECTOR_ELT(lookup, k-1);
-                    INTEGER(f2__)[thislen] = INTEGER(tmp1)[0];
-                    ++thislen;
-                }
-                if (len == thislen) {
-                    INTEGER(f2__)[thislen] = nomatch;
-                    ++thislen;
-                }
-            }
-            break;
-            
-            case EQUAL :
-            for (i=0; i<rows; i++) {
-                len = thislen;
-                INTEGER(f1__)[thislen] = i+1;
-                if (from[i] > 0 && to[i] > 0) {
-                    k = from[i];
-                    if (k == to[i]) {
-                        tmp1 = VECTOR_ELT(lookup, k-1);
-                        INTEGER(f2__)[thislen] = INTEGER(tmp1)[0];
-                        ++thislen;
-                    } else if (k < to[i]) {
-                        j=0; m=0;
-                        tmp1 = VECTOR_ELT(lookup, k-1);
-                        tmp2 = VECTOR_ELT(type_lookup, to[i]-1);
-                        while (j<len1[k-1] && m<len2[to[i]-1]) {
-                            if ( INTEGER(tmp1)[j] == INTEGER(tmp2)[m] ) {
-                                INTEGER(f2__)[thislen] = INTEGER(tmp1)[j];
-                                 ++thislen; ++j; ++m;
-                                 break;
-                             } else if ( INTEGER(tmp1)[j] > INTEGER(tmp2)[m] ) {
-                                 ++m;
-                             } else ++j;
-                         }
-                     }
-                 }
-                 if (len == thislen) {
-                     INTEGER(f2__)[thislen] = nomatch;
-                     ++thislen;
-                 }
-            }
-            break;
-
-            case ANY:
-            for (i=0; i<rows; i++) {
-                len = thislen;
-                INTEGER(f1__)[thislen] = i+1;
-                // k = (from[i]>0) ? from[i] : 1;
-                k = from[i];
-                for (j=k; j<=to[i]; j++) {
-                    if (len2[j-1]) {
-                        tmp2 = VECTOR_ELT(type_lookup, j-1);
-                        INTEGER(f2__)[thislen] = INTEGER(tmp2)[0];
-                        ++thislen;
-                        break;
-                    }
-                }
-                if (len == thislen) {
-                    INTEGER(f2__)[thislen] = nomatch;
-                    ++thislen;
-                }
-            }
-            break;
-
-            case WITHIN:
-            for (i=0; i<rows; i++) {
-                len = thislen;
-                INTEGER(f1__)[thislen] = i+1;
-                k = from[i];
-                if (k > 0) {
-                    if (k == to[i] && len1[k-1]) {
-                        tmp1 = VECTOR_ELT(lookup, k-1);
-                        INTEGER(f2__)[thislen] = INTEGER(tmp1)[0];
-                        ++thislen;
-                    } else if (k < to[i]) {
-                        j=0; m=0;
-                        tmp1 = VECTOR_ELT(lookup, k-1);
-                        tmp2 = VECTOR_ELT(lookup, to[i]-1);
-                        while (j<len1[k-1] && m<len1[to[i]-1]) {
-                            if ( INTEGER(tmp1)[j] == INTEGER(tmp2)[m] ) {
-                                INTEGER(f2__)[thislen] = INTEGER(tmp1)[j];
-                                 ++thislen; ++j; ++m;
-                                 break;
-                             } else if ( INTEGER(tmp1)[j] > INTEGER(tmp2)[m] ) {
-                                 ++m;;
-                             } else ++j;
-                         }
-                     }
-                }
-                if (len == thislen) {
-                    INTEGER(f2__)[thislen] = nomatch;
-                    ++thislen;
-                }
-            }
-            break;
+    #pragma omp parallel for num_threads(nth) schedule(dynamic, 1024)
+    for (int i=0; i<rows; i++) {
+        int hi, thr, rlo, rhi, pos = cnt[i], n = 0, len = (i < rows-1 ? cnt[i+1] : (int)totlen) - pos;
+        if (!len) continue;
+        oquery(&ix, type, from[i], to[i], &hi, &thr, &rlo, &rhi);
+        if (mult == OALL) {
+            if (hi) n = ostab(&ix, 1, 0, ix.m, hi, thr, f2+pos);
+            for (int j=rlo; j<rhi; j++) f2[pos+n++] = j+1;
+        } else if (mult == OFIRST) {
+            f2[pos] = hi ? ostab1(&ix, 1, 0, ix.m, hi, thr, FALSE) : 0;
+            if (!f2[pos] && rhi > rlo) f2[pos] = rlo+1;
+            n = f2[pos] != 0;
+        } else {
+            // y rows starting in (k, t] come after all those stabbed by k
+            f2[pos] = rhi > rlo ? rhi : hi ? ostab1(&ix, 1, 0, ix.m, hi, thr, TRUE) : 0;
+            n = f2[pos] != 0;
         }
-        break;
-
-        case LAST:
-        switch (type) {
-            case START: case END:
-            for (i=0; i<rows; i++) {
-                len = thislen;
-                INTEGER(f1__)[thislen] = i+1;
-                k = (from[i]>0) ? from[i] : 1;
-                if (k <= to[i]) { // len1[k-1] is equal to len2[k-1] and will always be >0, so no length check necessary.
-                    tmp1 = VECTOR_ELT(lookup, k-1);
-                    INTEGER(f2__)[thislen] = INTEGER(tmp1)[len1[k-1]-1];
-                    ++thislen;
-                }
-                if (len == thislen) {
-                    INTEGER(f2__)[thislen] = nomatch;
-                    ++thislen;
-                }
-            }
-            break;
-            
-            case EQUAL :
-            for (i=0; i<rows; i++) {
-                len = thislen;
-                INTEGER(f1__)[thislen] = i+1;
-                if (from[i] > 0 && to[i] > 0) {
-                    k = from[i];
-                    if (k == to[i]) {
-                        tmp1 = VECTOR_ELT(lookup, k-1);
-                        INTEGER(f2__)[thislen] = INTEGER(tmp1)[len1[k-1]-1];
-                        ++thislen;
-                    } else if (k < to[i]) {
-                        tmp1 = VECTOR_ELT(lookup, k-1);
-                        tmp2 = VECTOR_ELT(type_lookup, to[i]-1);
-                        j=len1[k-1]-1; m=len2[k-1]-1;
-                        while (j>=0 && m>=0) {
-                            if ( INTEGER(tmp1)[j] == INTEGER(tmp2)[m] ) {
-                                INTEGER(f2__)[thislen] = INTEGER(tmp1)[j];
-                                 ++thislen; --j; --m;
-                                 break;
-                             } else if ( INTEGER(tmp1)[j] < INTEGER(tmp2)[m] ) {
-                                 --m;
-                             } else --j;
-                         }
-                     }
-                 }
-                 if (len == thislen) {
-                     INTEGER(f2__)[thislen] = nomatch;
-                     ++thislen;
-                 }
-            }
-            break;
-
-            // OLD logic for 'any,last' which had to check for maximum for each 'i'. Better logic below.
-            // for 'first' we need to just get the minimum of first non-zero-length element, but not the same case for 'last'.
-            // We've to loop over from[i]:to[i] and get maximum of all tmp2 values (each is of length 1 already conveniently set uo) in that range
-            // case ANY:
-            // for (i=0; i<rows; i++) {
-            //     len = thislen;
-            //     INTEGER(f1__)[thislen] = i+1;
-            //     INTEGER(f2__)[thislen] = 0;
-            //     // k = (from[i]>0) ? from[i] : 1;
-            //     k = from[i];
-            //     for (j=k; j<=to[i]; j++) {
-            //         if (len2[j-1]) {
-            //             tmp2 = VECTOR_ELT(type_lookup, j-1);
-            //             INTEGER(f2__)[thislen] = (INTEGER(f2__)[thislen] < INTEGER(tmp2)[len2[j-1]-1]) ? INTEGER(tmp2)[len2[j-1]-1] : INTEGER(f2__)[thislen];
-            //         }
-            //     }
-            //     if (INTEGER(f2__)[thislen] == 0)
-            //         INTEGER(f2__)[thislen] = nomatch;
-            //     ++thislen;
-            // }
-            // break;
-
-            case ANY:
-            for (i=0; i<rows; i++) {
-                len = thislen;
-                INTEGER(f1__)[thislen] = i+1;
-                // k = (from[i]>0) ? from[i] : 1;
-                k = from[i];
-                if (k <= to[i]) {
-                    if (k==to[i] && len1[k-1]) {
-                        tmp1 = VECTOR_ELT(lookup, k-1);
-                        INTEGER(f2__)[thislen] = INTEGER(tmp1)[len1[k-1]-1];
-                        ++thislen;
-                    } else {
-                        for (j=to[i]; j>k; j--) {
-                            if (len2[j-1]) {
-                                tmp2 = VECTOR_ELT(type_lookup, j-1);
-                                INTEGER(f2__)[thislen] = INTEGER(tmp2)[0]; // tmp2 will be length 1
-                                ++thislen; break;
-                            }
-                        }
-                        if (len == thislen && len1[k-1]) {
-                            tmp1 = VECTOR_ELT(lookup, k-1);
-                            INTEGER(f2__)[thislen] = INTEGER(tmp1)[len1[k-1]-1];
-                            ++thislen;
-                        }
-                    }
-                }
-                if (len == thislen) {
-                    INTEGER(f2__)[thislen] = nomatch;
-                    ++thislen;
-                }
-            }
-            break;
-            
-            case WITHIN:
-            for (i=0; i<rows; i++) {
-                len = thislen;
-                INTEGER(f1__)[thislen] = i+1;
-                k = from[i];
-                if (k > 0) {
-                    if (k == to[i] && len1[k-1]) {
-                        tmp1 = VECTOR_ELT(lookup, k-1);
-                        INTEGER(f2__)[thislen] = INTEGER(tmp1)[len1[k-1]-1];
-                        ++thislen;
-                    } else if (k < to[i]) {
-                        tmp1 = VECTOR_ELT(lookup, k-1);
-                        tmp2 = VECTOR_ELT(lookup, to[i]-1);
-                        j=len1[k-1]-1; m=len1[to[i]-1]-1;
-                        while (j>=0 && m>=0) {
-                            if ( INTEGER(tmp1)[j] == INTEGER(tmp2)[m] ) {
-                                INTEGER(f2__)[thislen] = INTEGER(tmp1)[j];
-                                 ++thislen; --j; --m;
-                                 break;
-                             } else if ( INTEGER(tmp1)[j] < INTEGER(tmp2)[m] ) {
-                                 --m;
-                             } else --j;
-                         }
-                     }
-                 }
-                 if (len == thislen) {
-                     INTEGER(f2__)[thislen] = nomatch;
-                     ++thislen;
-                 }
-            }
-            break;
-        }
-        break;
+        if (!n) { f2[pos] = nomatch; n = 1; }
+        for (int j=0; j<n; j++) f1[pos+j] = i+1;
     }
     end2 = clock() - start;
     if (LOGICAL(verbose)[0])
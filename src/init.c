@@ -6,6 +6,7 @@
 // .Calls
 SEXP setattrib();
 SEXP bmerge();
+SEXP hashjoin();
 SEXP assign();
 SEXP dogroups();
 SEXP copy();
@@ -22,6 +23,7 @@ SEXP genLookups();
 SEXP reorder();
 SEXP rbindlist();
 SEXP vecseq();
+SEXP notjoinrows();
 SEXP copyattr();
 SEXP setlistelt();
 SEXP setnamed();
@@ -33,8 +35,10 @@ SEXP uniqlist();
 SEXP uniqlengths();
 SEXP setrev();
 SEXP forder();
+SEXP forderStats();
 SEXP fsorted();
 SEXP gforce();
+SEXP gassign();
 SEXP gsum();
 SEXP gmean();
 SEXP gmin();
@@ -50,10 +54,10 @@ SEXP subsetVector();
 SEXP convertNegativeIdx();
 SEXP frank();
 SEXP dt_na();
-SEXP lookup();
 SEXP overlaps();
 SEXP whichwrapper();
 SEXP shift();
+SEXP froll();
 SEXP transpose();
 SEXP anyNA();
 SEXP isReallyReal();
@@ -69,11 +73,24 @@ SEXP dim();
 SEXP gvar();
 SEXP gsd();
 SEXP gprod();
+SEXP guniqueN();
+SEXP gany();
+SEXP gall();
+SEXP gweightedmean();
+SEXP gquantile();
+SEXP gnotna();
+SEXP gcumsum();
+SEXP gcumprod();
+SEXP gcummin();
+SEXP gcummax();
+SEXP gseq();
+SEXP gfrank();
 SEXP nestedid();
 SEXP setDTthreads();
 SEXP getDTthreads_R();
 SEXP nqnewindices();
 SEXP fsort();
+SEXP ftopn();
 SEXP inrange();
 SEXP between();
 SEXP hasOpenMP();
@@ -85,6 +102,7 @@ static const
 R_CallMethodDef callMethods[] = {
 {"Csetattrib", (DL_FUNC) &setattrib, -1},
 {"Cbmerge", (DL_FUNC) &bmerge, -1},
+{"Chashjoin", (DL_FUNC) &hashjoin, -1},
 {"Cassign", (DL_FUNC) &assign, -1},
 {"Cdogroups", (DL_FUNC) &dogroups, -1},
 {"Ccopy", (DL_FUNC) &copy, -1},
@@ -101,6 +119,7 @@ R_CallMethodDef callMethods[] = {
 {"Creorder", (DL_FUNC) &reorder, -1},
 {"Crbindlist", (DL_FUNC) &rbindlist, -1},
 {"Cvecseq", (DL_FUNC) &vecseq, -1},
+{"Cnotjoinrows", (DL_FUNC) &notjoinrows, -1},
 {"Ccopyattr", (DL_FUNC) &copyattr, -1},
 {"Csetlistelt", (DL_FUNC) &setlistelt, -1},
 {"Csetnamed", (DL_FUNC) &setnamed, -1},
@@ -112,8 +131,10 @@ R_CallMethodDef callMethods[] = {
 {"Cuniqlengths", (DL_FUNC) &uniqlengths, -1},
 {"Csetrev", (DL_FUNC) &setrev, -1},
 {"Cforder", (DL_FUNC) &forder, -1},
+{"CforderStats", (DL_FUNC) &forderStats, -1},
 {"Cfsorted", (DL_FUNC) &fsorted, -1},
 {"Cgforce", (DL_FUNC) &gforce, -1},
+{"Cgassign", (DL_FUNC) &gassign, -1},
 {"Cgsum", (DL_FUNC) &gsum, -1},
 {"Cgmean", (DL_FUNC) &gmean, -1},
 {"Cgmin", (DL_FUNC) &gmin, -1},
@@ -129,10 +150,10 @@ R_CallMethodDef callMethods[] = {
 {"CconvertNegativeIdx", (DL_FUNC) &convertNegativeIdx, -1},
 {"Cfrank", (DL_FUNC) &frank, -1},
 {"Cdt_na", (DL_FUNC) &dt_na, -1},
-{"Clookup", (DL_FUNC) &lookup, -1},
 {"Coverlaps", (DL_FUNC) &overlaps, -1},
 {"Cwhichwrapper", (DL_FUNC) &whichwrapper, -1},
 {"Cshift", (DL_FUNC) &shift, -1},
+{"Cfroll", (DL_FUNC) &froll, -1},
 {"Ctranspose", (DL_FUNC) &transpose, -1},
 {"CanyNA", (DL_FUNC) &anyNA, -1},
 {"CisReallyReal", (DL_FUNC) &isReallyReal, -1},
@@ -148,11 +169,24 @@ R_CallMethodDef callMethods[] = {
 {"Cgvar", (DL_FUNC) &gvar, -1},
 {"Cgsd", (DL_FUNC) &gsd, -1},
 {"Cgprod", (DL_FUNC) &gprod, -1},
+{"CguniqueN", (DL_FUNC) &guniqueN, -1},
+{"Cgany", (DL_FUNC) &gany, -1},
+{"Cgall", (DL_FUNC) &gall, -1},
+{"Cgweightedmean", (DL_FUNC) &gweightedmean, -1},
+{"Cgquantile", (DL_FUNC) &gquantile, -1},
+{"Cgnotna", (DL_FUNC) &gnotna, -1},
+{"Cgcumsum", (DL_FUNC) &gcumsum, -1},
+{"Cgcumprod", (DL_FUNC) &gcumprod, -1},
+{"Cgcummin", (DL_FUNC) &gcummin, -1},
+{"Cgcummax", (DL_FUNC) &gcummax, -1},
+{"Cgseq", (DL_FUNC) &gseq, -1},
+{"Cgfrank", (DL_FUNC) &gfrank, -1},
 {"Cnestedid", (DL_FUNC) &nestedid, -1},
 {"CsetDTthreads", (DL_FUNC) &setDTthreads, -1},
 {"CgetDTthreads", (DL_FUNC) &getDTthreads_R, -1},
 {"Cnqnewindices", (DL_FUNC) &nqnewindices, -1},
 {"Cfsort", (DL_FUNC) &fsort, -1},
+{"Cftopn", (DL_FUNC) &ftopn, -1},
 {"Cinrange", (DL_FUNC) &inrange, -1},
 {"Cbetween", (DL_FUNC) &between, -1},
 {"ChasOpenMP", (DL_FUNC) &hasOpenMP, -1},
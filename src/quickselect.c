@@ -8,13 +8,36 @@
 // from good ol' Numerical Recipes in C
 #define SWAP(a,b) temp=(a);(a)=(b);(b)=temp;
 
+// Median of 3 partitioning is quadratic on some inputs (organ pipes, many ties at the ends). As in introselect,
+// once the partitions have stopped shrinking geometrically the remaining range is just sorted, O(n log n).
+static int depthlimit(int n) {
+    int d = 0;
+    while (n > 1) { n >>= 1; d++; }
+    return 2*d + 4;
+}
+
+static int dcmp(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int icmp(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
 double dquickselect(double *x, int n, int k) {
     unsigned long i,ir,j,l,mid;
     double a,temp;
+    int depth = depthlimit(n);
 
     l=0;
     ir=n-1;
     for(;;) {
+        if (--depth < 0) {
+            qsort(x+l, ir-l+1, sizeof(double), dcmp);
+            return x[k];
+        }
         if (ir <= l+1) { 
             if (ir == l+1 && x[ir] < x[l]) {
                 SWAP(x[l],x[ir]);
@@ -52,10 +75,15 @@ double dquickselect(double *x, int n, int k) {
 double iquickselect(int *x, int n, int k) {
     unsigned long i,ir,j,l,mid;
     int a,temp;
+    int depth = depthlimit(n);
 
     l=0;
     ir=n-1;
     for(;;) {
+        if (--depth < 0) {
+            qsort(x+l, ir-l+1, sizeof(int), icmp);
+            return (double)(x[k]);
+        }
         if (ir <= l+1) { 
             if (ir == l+1 && x[ir] < x[l]) {
                 SWAP(x[l],x[ir]);
@@ -6,18 +6,20 @@ SEXP reorder(SEXP x, SEXP order)
     // 'order' must strictly be a permutation of 1:n (i.e. no repeats, zeros or NAs)
     // If only a small subset in the middle is reordered the ends are moved in: [start,end].
     // x may be a vector, or a list of same-length vectors such as data.table
+    // order may be double rather than integer for long vectors (more than INT_MAX rows), as fsort returns then
     
-    R_len_t nrow, ncol;
+    R_xlen_t nrow;
+    R_len_t ncol;
     int maxSize = 0;
     if (isNewList(x)) {
-      nrow = length(VECTOR_ELT(x,0));
+      nrow = xlength(VECTOR_ELT(x,0));
       ncol = length(x);
       for (int i=0; i<ncol; i++) {
         SEXP v = VECTOR_ELT(x,i);
         if (SIZEOF(v)!=4 && SIZEOF(v)!=8)
           error("Item %d of list is type '%s' which isn't yet supported", i+1, type2char(TYPEOF(v)));
-        if (length(v)!=nrow)
-          error("Column %d is length %d which differs from length of column 1 (%d). Invalid data.table.", i+1, length(v), nrow);
+        if (xlength(v)!=nrow)
+          error("Column %d is length %lld which differs from length of column 1 (%lld). Invalid data.table.", i+1, (long long)xlength(v), (long long)nrow);
         if (SIZEOF(v) > maxSize)
           maxSize=SIZEOF(v);
       }
@@ -25,20 +27,23 @@ SEXP reorder(SEXP x, SEXP order)
       if (SIZEOF(x)!=4 && SIZEOF(x)!=8)
         error("reorder accepts vectors but this non-VECSXP is type '%s' which isn't yet supported", type2char(TYPEOF(x)));
       maxSize = SIZEOF(x);
-      nrow = length(x);
+      nrow = xlength(x);
       ncol = 1;
     }
-    if (!isInteger(order)) error("order must be an integer vector");
-    if (length(order) != nrow) error("nrow(x)[%d]!=length(order)[%d]",nrow,length(order));
+    if (!isInteger(order) && !isReal(order)) error("order must be an integer vector (or double for long vectors)");
+    if (xlength(order) != nrow) error("nrow(x)[%lld]!=length(order)[%lld]", (long long)nrow, (long long)xlength(order));
+    const int *io = isInteger(order) ? INTEGER(order) : NULL;
+    const double *dorder = io ? NULL : REAL(order);
+    #define ORD(i) (io ? (R_xlen_t)io[i] : (ISNAN(dorder[i]) ? 0 : (R_xlen_t)dorder[i]))   // NA to 0, caught below
     
-    R_len_t start = 0;
-    while (start<nrow && INTEGER(order)[start] == start+1) start++;
+    R_xlen_t start = 0;
+    while (start<nrow && ORD(start) == start+1) start++;
     if (start==nrow) return(R_NilValue);  // input is 1:n, nothing to do
-    R_len_t end = nrow-1;
-    while (INTEGER(order)[end] == end+1) end--;
-    for (R_len_t i=start; i<=end; i++) { 
-      int itmp = INTEGER(order)[i]-1;
-      if (itmp<start || itmp>end) error("order is not a permutation of 1:nrow[%d]", nrow);
+    R_xlen_t end = nrow-1;
+    while (ORD(end) == end+1) end--;
+    for (R_xlen_t i=start; i<=end; i++) { 
+      R_xlen_t itmp = ORD(i)-1;
+      if (itmp<start || itmp>end) error("order is not a permutation of 1:nrow[%lld]", (long long)nrow);
     }
     // Creorder is for internal use (so we should get the input right!), but the check above seems sensible, otherwise
     // would be segfault below. The for loop above should run in neglible time (sequential) and will also catch NAs.
@@ -57,7 +62,7 @@ SEXP reorder(SEXP x, SEXP order)
       tmp[ok] = malloc(oneTmpSize);
       if (tmp[ok] == NULL) break;
     }
-    if (ok==0) error("unable to allocate %d * %d bytes of working memory for reordering data.table", end-start+1, maxSize);
+    if (ok==0) error("unable to allocate %lld * %d bytes of working memory for reordering data.table", (long long)(end-start+1), maxSize);
     nth = ok;  // as many threads for which we have a successful malloc
     // So we can still reorder a 10GB table in 16GB of RAM, as long as we have at least one column's worth of tmp
     
@@ -66,18 +71,25 @@ SEXP reorder(SEXP x, SEXP order)
       const SEXP v = isNewList(x) ? VECTOR_ELT(x,i) : x;
       const int size = SIZEOF(v);
       const int me = omp_get_thread_num();
-      const int *vi = INTEGER(order)+start;
       if (size==4) {
         const int *vd = (const int *)DATAPTR(v);
         int *tmpp = (int *)tmp[me];
-        for (int j=start; j<=end; j++) {
-          *tmpp++ = vd[*vi++ -1];  // just copies 4 bytes, including pointers on 32bit
+        if (io) {
+          const int *vi = io+start;
+          for (R_xlen_t j=start; j<=end; j++) *tmpp++ = vd[*vi++ -1];  // just copies 4 bytes, including pointers on 32bit
+        } else {
+          const double *vi = dorder+start;
+          for (R_xlen_t j=start; j<=end; j++) *tmpp++ = vd[(R_xlen_t)*vi++ -1];
         }
       } else {
         const double *vd = (const double *)DATAPTR(v);
         double *tmpp = (double *)tmp[me];
-        for (int j=start; j<=end; j++) {
-          *tmpp++ = vd[*vi++ -1];  // just copies 8 bytes, pointers too including STRSXP and VECSXP
+        if (io) {
+          const int *vi = io+start;
+          for (R_xlen_t j=start; j<=end; j++) *tmpp++ = vd[*vi++ -1];  // just copies 8 bytes, pointers too including STRSXP and VECSXP
+        } else {
+          const double *vi = dorder+start;
+          for (R_xlen_t j=start; j<=end; j++) *tmpp++ = vd[(R_xlen_t)*vi++ -1];
         }
       }
       // How is this possible to not only ignore the write barrier but in parallel too?
@@ -100,6 +112,7 @@ SEXP reorder(SEXP x, SEXP order)
       // size_t, otherwise #5305 (integer overflow in memcpy)
     }
     for (int i=0; i<nth; i++) free(tmp[i]);
+    #undef ORD
     return(R_NilValue);
 }
 
@@ -10,36 +10,47 @@ SEXP uniqlist(SEXP l, SEXP order)
     // row. l must be a list of same length vectors ans is allocated first 
     // (maximum length the number of rows) and the length returned in anslen.
     // DONE: ans is now grown
+    // Long vectors: order may be double (as fsort returns for more than INT_MAX rows) and the result is then double too.
     Rboolean b, byorder;
     unsigned long long *ulv; // for numeric check speed-up
     SEXP v, ans, class;
-    R_len_t i, j, nrow, ncol, len, thisi, previ, isize=1000;
+    R_len_t j, ncol;
+    R_xlen_t i, nrow, len, thisi, previ, isize=1000;
 
-    int *iidx = Calloc(isize, int); // for 'idx'
-    int *n_iidx; // to catch allocation errors using Realloc!
+    R_xlen_t *iidx = Calloc(isize, R_xlen_t); // for 'idx'
+    R_xlen_t *n_iidx; // to catch allocation errors using Realloc!
     if (NA_INTEGER != NA_LOGICAL || sizeof(NA_INTEGER)!=sizeof(NA_LOGICAL)) 
         error("Have assumed NA_INTEGER == NA_LOGICAL (currently R_NaInt). If R changes this in future (seems unlikely), an extra case is required; a simple change.");
     ncol = length(l);
-    nrow = length(VECTOR_ELT(l,0));
+    nrow = xlength(VECTOR_ELT(l,0));
+    // character columns are translated to UTF-8 once here (ENC2UTF8vec), so rows are compared by pointer alone
+    SEXP lu = PROTECT(allocVector(VECSXP, ncol));
+    for (j=0; j<ncol; j++) {
+        v = VECTOR_ELT(l,j);
+        SET_VECTOR_ELT(lu, j, isString(v) ? ENC2UTF8vec(v) : v);
+    }
+    if (!isInteger(order) && !isReal(order)) error("order must be an integer vector (or double for long vectors)");
+    const double *dorder = isReal(order) ? REAL(order) : NULL;
+    #define ORD(i) (dorder ? (R_xlen_t)dorder[i] : (R_xlen_t)INTEGER(order)[i])
     len = 1;
     iidx[0] = 1; // first row is always the first of the first group
-    byorder = INTEGER(order)[0] != -1;
+    byorder = ORD(0) != -1;
     // Using MISSING() does not seem stable under windows. Always having arguments passed in seems a good idea anyway.
-    thisi = byorder ? INTEGER(order)[0]-1 : 0;
+    thisi = byorder ? ORD(0)-1 : 0;
     for (i=1; i<nrow; i++) {
         previ = thisi;
-        thisi = byorder ? INTEGER(order)[i]-1 : i;
+        thisi = byorder ? ORD(i)-1 : i;
         j = ncol;  // the last column varies the most frequently so check that first and work backwards
         b = TRUE;
         while (--j>=0 && b) {
-            v=VECTOR_ELT(l,j);
+            v=VECTOR_ELT(lu,j);
             switch (TYPEOF(v)) {
             case INTSXP : case LGLSXP :
                 b=INTEGER(v)[thisi]==INTEGER(v)[previ]; break;
             case STRSXP :
                 // fix for #469, when key is set, duplicated calls uniqlist, where encoding 
                 // needs to be taken care of.
-                b=ENC2UTF8(STRING_ELT(v,thisi))==ENC2UTF8(STRING_ELT(v,previ)); break;  // marked non-utf8 encodings are converted to utf8 so as to match properly when inputs are of different encodings.
+                b=STRING_ELT(v,thisi)==STRING_ELT(v,previ); break;  // marked non-utf8 encodings were converted to utf8 above so as to match properly when inputs are of different encodings.
             case REALSXP :
                 ulv = (unsigned long long *)REAL(v);  
                 b = ulv[thisi] == ulv[previ]; // (gives >=2x speedup)
@@ -57,28 +68,53 @@ SEXP uniqlist(SEXP l, SEXP order)
         if (!b) iidx[len++] = i+1;
         if (len >= isize) {
             isize = 1.1*isize*nrow/i;
-            n_iidx = Realloc(iidx, isize, int);
+            n_iidx = Realloc(iidx, isize, R_xlen_t);
             if (n_iidx != NULL) iidx = n_iidx; else error("Error in reallocating memory in 'uniqlist'\n");
         }
     }
-    PROTECT(ans = allocVector(INTSXP, len));
-    memcpy(INTEGER(ans), iidx, sizeof(int)*len); // sizeof is of type size_t - no integer overflow issues   
+    #undef ORD
+    if (nrow > INT_MAX) {
+        PROTECT(ans = allocVector(REALSXP, len));
+        for (i=0; i<len; i++) REAL(ans)[i] = (double)iidx[i];
+    } else {
+        PROTECT(ans = allocVector(INTSXP, len));
+        for (i=0; i<len; i++) INTEGER(ans)[i] = (int)iidx[i];
+    }
     Free(iidx);
-    UNPROTECT(1);
+    UNPROTECT(2);
     return(ans);
 }
 
 SEXP uniqlengths(SEXP x, SEXP n) {
+    // x may be double when uniqlist was passed a long vector; a single group may then be larger than INT_MAX too.
+    // The result is integer whenever n fits in integer (no group can be longer than n), so only long vectors get double.
     SEXP ans;
-    R_len_t i, len;
-    if (TYPEOF(x) != INTSXP || length(x) < 0) error("Input argument 'x' to 'uniqlengths' must be an integer vector of length >= 0");
-    if (TYPEOF(n) != INTSXP || length(n) != 1) error("Input argument 'n' to 'uniqlengths' must be an integer vector of length 1");
-    PROTECT(ans = allocVector(INTSXP, length(x)));
-    len = length(x);
-    for (i=1; i<len; i++) {
-        INTEGER(ans)[i-1] = INTEGER(x)[i] - INTEGER(x)[i-1];
+    R_xlen_t i, len;
+    if ((TYPEOF(x) != INTSXP && TYPEOF(x) != REALSXP) || xlength(x) < 0) error("Input argument 'x' to 'uniqlengths' must be an integer vector of length >= 0");
+    if ((TYPEOF(n) != INTSXP && TYPEOF(n) != REALSXP) || length(n) != 1) error("Input argument 'n' to 'uniqlengths' must be an integer vector of length 1");
+    len = xlength(x);
+    if (len == 0) return(allocVector(INTSXP, 0));
+    double nn = TYPEOF(n) == REALSXP ? REAL(n)[0] : INTEGER(n)[0];
+    if (TYPEOF(x) == INTSXP && TYPEOF(n) == INTSXP) {
+        PROTECT(ans = allocVector(INTSXP, len));
+        for (i=1; i<len; i++) {
+            INTEGER(ans)[i-1] = INTEGER(x)[i] - INTEGER(x)[i-1];
+        }
+        INTEGER(ans)[len-1] = INTEGER(n)[0] - INTEGER(x)[len-1] + 1;
+    } else {
+        double *dx = TYPEOF(x) == REALSXP ? REAL(x) : NULL;
+        #define X(i) (dx ? dx[i] : (double)INTEGER(x)[i])
+        if (nn <= INT_MAX) {
+            PROTECT(ans = allocVector(INTSXP, len));
+            for (i=1; i<len; i++) INTEGER(ans)[i-1] = (int)(X(i) - X(i-1));
+            INTEGER(ans)[len-1] = (int)(nn - X(len-1) + 1);
+        } else {
+            PROTECT(ans = allocVector(REALSXP, len));
+            for (i=1; i<len; i++) REAL(ans)[i-1] = X(i) - X(i-1);
+            REAL(ans)[len-1] = nn - X(len-1) + 1;
+        }
+        #undef X
     }
-    INTEGER(ans)[len-1] = INTEGER(n)[0] - INTEGER(x)[len-1] + 1;
     UNPROTECT(1);
     return(ans);
 }
@@ -133,6 +169,22 @@ SEXP rleid(SEXP l, SEXP cols)
   return(ans);
 }
 
+// whether row a of v may follow row b in a nested group : >= for numbers, the same string for character
+static Rboolean nestedge(SEXP v, int i64, int a, int b) {
+    switch(TYPEOF(v)) {
+    case INTSXP: case LGLSXP:
+        return INTEGER(v)[a] >= INTEGER(v)[b];
+    case STRSXP :
+        return STRING_ELT(v,a) == STRING_ELT(v,b);
+    case REALSXP:
+        twiddle = i64 ? &i64twiddle : &dtwiddle;
+        return twiddle(DATAPTR(v), a, 1) >= twiddle(DATAPTR(v), b, 1);
+    default:
+        error("Type '%s' not supported", type2char(TYPEOF(v)));
+    }
+    return FALSE;
+}
+
 SEXP nestedid(SEXP l, SEXP cols, SEXP order, SEXP grps, SEXP resetvals, SEXP multArg) {
     Rboolean b, byorder = length(order);
     SEXP v, ans, class;
@@ -154,6 +206,12 @@ SEXP nestedid(SEXP l, SEXP cols, SEXP order, SEXP grps, SEXP resetvals, SEXP mul
         class = getAttrib(VECTOR_ELT(l, INTEGER(cols)[j]-1), R_ClassSymbol);
         i64[j] = isString(class) && STRING_ELT(class, 0) == char_integer64;
     }
+    // character columns in UTF-8 once, as in uniqlist
+    SEXP lu = PROTECT(allocVector(VECSXP, length(l)));
+    for (j=0; j<length(l); j++) {
+        v = VECTOR_ELT(l, j);
+        SET_VECTOR_ELT(lu, j, isString(v) ? ENC2UTF8vec(v) : v);
+    }
     ans  = PROTECT(allocVector(INTSXP, nrows));
     int *ians = INTEGER(ans), *igrps = INTEGER(grps);
     grplen = (ngrps == 1) ? nrows : igrps[1]-igrps[0];
@@ -163,6 +221,11 @@ SEXP nestedid(SEXP l, SEXP cols, SEXP order, SEXP grps, SEXP resetvals, SEXP mul
         ians[byorder ? INTEGER(order)[igrps[0]-1+j]-1 : igrps[0]-1+j] = 1;
     }
     nansgrp = 1;
+    // With mult="all" and one column after the first, a group joins the first nested group whose last value in that
+    // column is <= its own. Those last values then only decrease from one nested group to the next, so the first such
+    // group is found by bisection rather than by trying each in turn, which was O(ngrps * nansgrp).
+    v = VECTOR_ELT(lu, INTEGER(cols)[ncols-1]-1);
+    Rboolean bisect = mult == ALL && ncols == 2 && TYPEOF(v) != STRSXP;
     for (i=1; i<ngrps; i++) {
         // "first"=add next grp to current grp iff min(next) >= min(current)
         // "last"=add next grp to current grp iff max(next) >= max(current)
@@ -172,7 +235,15 @@ SEXP nestedid(SEXP l, SEXP cols, SEXP order, SEXP grps, SEXP resetvals, SEXP mul
         grplen = (i+1 < ngrps) ? igrps[i+1]-igrps[i] : nrows-igrps[i]+1;
         starts = igrps[i]-1 + (mult != LAST ? 0 : grplen-1);
         thisi = byorder ? INTEGER(order)[starts]-1 : starts;
-        for (k=0; k<nansgrp; k++) {
+        if (bisect) {
+            int lo = -1, hi = nansgrp;
+            while (lo < hi-1) {
+                int mid = lo + (hi-lo)/2;
+                if (nestedge(v, i64[1], thisi, ansgrp[mid])) hi = mid; else lo = mid;
+            }
+            k = hi;
+            b = k < nansgrp;
+        } else for (k=0; k<nansgrp; k++) {
             j = ncols;
             previ = ansgrp[k];
             // b=TRUE is ideal for mult=ALL, results in lesser groups
@@ -180,23 +251,7 @@ SEXP nestedid(SEXP l, SEXP cols, SEXP order, SEXP grps, SEXP resetvals, SEXP mul
             // >= 0 is not necessary as first col will always be in 
             // increasing order. NOTE: all "==" cols are already skipped for 
             // computing nestedid during R-side call, for efficiency.
-            while(b && --j>0) {
-                v = VECTOR_ELT(l,INTEGER(cols)[j]-1);
-                switch(TYPEOF(v)) {
-                    case INTSXP: case LGLSXP:
-                    b = INTEGER(v)[thisi] >= INTEGER(v)[previ];
-                    break;
-                    case STRSXP :
-                    b = ENC2UTF8(STRING_ELT(v,thisi)) == ENC2UTF8(STRING_ELT(v,previ));
-                    break;
-                    case REALSXP:
-                    twiddle = i64[j] ? &i64twiddle : &dtwiddle;
-                    b = twiddle(DATAPTR(v), thisi, 1) >= twiddle(DATAPTR(v), previ, 1);
-                    break;
-                    default:
-                    error("Type '%s' not supported", type2char(TYPEOF(v)));
-                }
-            }
+            while(b && --j>0) b = nestedge(VECTOR_ELT(lu,INTEGER(cols)[j]-1), i64[j], thisi, previ);
             if (b) break;
         }
         // TODO: move this as the outer for-loop and parallelise..
@@ -221,7 +276,7 @@ SEXP nestedid(SEXP l, SEXP cols, SEXP order, SEXP grps, SEXP resetvals, SEXP mul
     }
     Free(ansgrp);
     Free(i64);
-    UNPROTECT(1);
+    UNPROTECT(2);
     return(ans);
 }
 
@@ -40,3 +40,56 @@ SEXP vecseq(SEXP x, SEXP len, SEXP clamp)
     return(ans);
 }
 
+
+SEXP notjoinrows(SEXP starts, SEXP lens, SEXP xo, SEXP nrowArg)
+{
+    // The rows of x matched by no row of i, for X[!i]. starts and lens are bmerge's, so they index xo (the order of
+    // x, or 1:nrow when empty); rather than expanding every match with vecseq (a row of x matched by many rows of i
+    // is repeated each time) and dropping those from 1:nrow, the ranges are marked with a difference array, so the
+    // cost is O(nrow(i) + nrow(x)) however many matches there are. Returns the rows in increasing order.
+    if (!isInteger(starts) || !isInteger(lens) || LENGTH(starts) != LENGTH(lens)) error("Internal error: starts and lens must be integer vectors of the same length");
+    if (!isInteger(xo)) error("Internal error: xo must be an integer vector");
+    if (!isInteger(nrowArg) || LENGTH(nrowArg) != 1 || INTEGER(nrowArg)[0] < 0) error("Internal error: nrow must be a non-negative integer length 1");
+    int ni = LENGTH(starts), nx = INTEGER(nrowArg)[0], no = LENGTH(xo) ? LENGTH(xo) : nx;
+    const int *s = INTEGER(starts), *l = INTEGER(lens), *o = LENGTH(xo) ? INTEGER(xo) : NULL;
+    int *cover = (int *)R_alloc((size_t)no+1, sizeof(int));
+    char *matched = (char *)R_alloc((size_t)nx+1, sizeof(char));
+    memset(cover, 0, ((size_t)no+1) * sizeof(int));
+    for (int i=0; i<ni; i++) {
+        if (s[i] == NA_INTEGER || s[i] < 1 || l[i] < 1) continue;  // no match
+        if (l[i] > no-s[i]+1) error("Internal error: starts[%d]+lens[%d] is beyond the %d rows of x", i+1, i+1, no);
+        cover[s[i]-1]++;
+        cover[s[i]-1+l[i]]--;
+    }
+    memset(matched, 0, (size_t)nx);
+    for (int p=0, n=0; p<no; p++) {
+        n += cover[p];
+        if (n) {
+            int r = o ? o[p]-1 : p;
+            if (r < 0 || r >= nx) error("Internal error: xo[%d]=%d is not a row of x", p+1, r+1);
+            matched[r] = 1;
+        }
+    }
+    // the rows left, in parallel : each thread counts the rows of its part of x, then writes them from its offset
+    int nth = getDTthreads();
+    if (nth > nx/1024) nth = nx/1024;
+    if (nth < 1) nth = 1;
+    int *off = (int *)R_alloc((size_t)nth+1, sizeof(int));
+    #pragma omp parallel for num_threads(nth) schedule(static, 1)
+    for (int t=0; t<nth; t++) {
+        int from = (int)((long long)nx*t/nth), to = (int)((long long)nx*(t+1)/nth), n = 0;
+        for (int r=from; r<to; r++) n += !matched[r];
+        off[t+1] = n;
+    }
+    off[0] = 0;
+    for (int t=0; t<nth; t++) off[t+1] += off[t];
+    SEXP ans = PROTECT(allocVector(INTSXP, off[nth]));
+    int *ians = INTEGER(ans);
+    #pragma omp parallel for num_threads(nth) schedule(static, 1)
+    for (int t=0; t<nth; t++) {
+        int from = (int)((long long)nx*t/nth), to = (int)((long long)nx*(t+1)/nth), k = off[t];
+        for (int r=from; r<to; r++) if (!matched[r]) ians[k++] = r+1;
+    }
+    UNPROTECT(1);
+    return(ans);
+}